@@ -0,0 +1,465 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <new>
+#include <vector>
+
+#include <glm\glm.hpp>
+
+#include "..\OpenGLPlayground\ogldev_skinned_mesh.h"
+#include "..\OpenGLPlayground\GLAnimationLod.h"
+#include "..\OpenGLPlayground\GLSkinning.h"
+#include "..\OpenGLPlayground\GLThreadPool.h"
+#include "..\OpenGLPlayground\ogldev_util.h"
+
+#define DEFAULT_MODEL "../OpenGLPlayground/resource/boblampclean.md5mesh"
+#define BENCHMARK_FRAMES 20
+#define POSE_NUM 64		// distinct poses handed out round robin over the crowd
+#define LOD_FRAMES 120
+#define FRAME_SECONDS (1.0f / 60.0f)
+#define SWEEP_STEPS 64			// times per instance in the BoneTransform sweep
+#define SWEEP_SECONDS 10.0f
+#define MATRIX_NUM 4096			// matrices per operation in the Matrix4f comparison
+#define MATRIX_PASSES 256
+
+static const unsigned int CrowdSizes[] = { 1, 16, 256, 1024 };
+
+// Every heap allocation of the process goes through here, so that the
+// animation path can be checked for allocations per call
+static std::atomic<unsigned long long> allocationCount(0);
+
+void *operator new(size_t size)
+{
+	allocationCount++;
+
+	void *p = malloc(size > 0 ? size : 1);
+	if (!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+// The array and sized forms forward to the two above, so that no allocator
+// pairs a counted malloc with the library's own delete
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete[](void *p) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+	operator delete(p);
+}
+
+// Output of one instance inside the crowd's buffer, six arrays of vertexNum floats
+static SkinnedVertices InstanceOutput(std::vector<float> &output, unsigned int vertexNum, unsigned int instance)
+{
+	float *base = &output[(size_t)instance * vertexNum * 6];
+
+	SkinnedVertices out;
+	out.positionX = base;
+	out.positionY = base + vertexNum;
+	out.positionZ = base + vertexNum * 2;
+	out.normalX = base + vertexNum * 3;
+	out.normalY = base + vertexNum * 4;
+	out.normalZ = base + vertexNum * 5;
+	return out;
+}
+
+// Skins every instance, with one pool item per instance and vertex batch so
+// that small meshes still spread over all threads
+static void SkinCrowd(SkinningKernel kernel, const SkinningInput &input, const std::vector<SkinningPalette> &palettes,
+	unsigned int crowd, std::vector<float> &output)
+{
+	const unsigned int batchNum = (input.vertexNum + SKINNING_BATCH_VERTICES - 1) / SKINNING_BATCH_VERTICES;
+
+	ThreadPool::Shared().ParallelFor(crowd * batchNum, [&](unsigned int i)
+	{
+		unsigned int instance = i / batchNum;
+		unsigned int begin = (i % batchNum) * SKINNING_BATCH_VERTICES;
+		unsigned int end = begin + SKINNING_BATCH_VERTICES < input.vertexNum ? begin + SKINNING_BATCH_VERTICES : input.vertexNum;
+
+		CpuSkinning::Skin(kernel, input, palettes[instance % palettes.size()], begin, end,
+			InstanceOutput(output, input.vertexNum, instance));
+	});
+}
+
+// BoneTransform across a sweep of times for every crowd size: cost per
+// instance and per bone, and heap allocations per call
+static void BenchmarkBoneTransform(SkinnedMesh &mesh)
+{
+	const unsigned int boneNum = mesh.NumBones();
+	std::vector<AffineTransform> transforms;
+
+	// The first call sizes the output
+	mesh.BoneTransform(0.0f, transforms);
+
+	for (unsigned int c = 0; c < ARRAY_SIZE_IN_ELEMENTS(CrowdSizes); c++) {
+		const unsigned int crowd = CrowdSizes[c];
+		const unsigned long long calls = (unsigned long long)crowd * SWEEP_STEPS;
+
+		unsigned long long allocations = allocationCount;
+		long long start = GetCurrentTimeMicros();
+
+		for (unsigned int step = 0; step < SWEEP_STEPS; step++) {
+			const float time = step * SWEEP_SECONDS / SWEEP_STEPS;
+			for (unsigned int i = 0; i < crowd; i++)
+				mesh.BoneTransform(time + i * 0.37f, transforms);
+		}
+
+		long long elapsed = GetCurrentTimeMicros() - start;
+		allocations = allocationCount - allocations;
+
+		const double nsPerInstance = elapsed * 1000.0 / calls;
+		printf("crowd %5u  BoneTransform  %9.1f ns/instance  %7.2f ns/bone  %.2f allocations/call\n",
+			crowd, nsPerInstance, nsPerInstance / boneNum, allocations / (double)calls);
+	}
+	printf("\n");
+}
+
+// BoneTransform one instance after the other against the batched BoneTransforms
+static void BenchmarkPoses(SkinnedMesh &mesh)
+{
+	const unsigned int boneNum = mesh.NumBones();
+	std::vector<AffineTransform> transforms;
+
+	for (unsigned int c = 0; c < ARRAY_SIZE_IN_ELEMENTS(CrowdSizes); c++) {
+		const unsigned int crowd = CrowdSizes[c];
+
+		std::vector<float> times(crowd);
+		for (unsigned int i = 0; i < crowd; i++)
+			times[i] = i * 0.37f;
+
+		long long start = GetCurrentTimeMicros();
+		for (int frame = 0; frame < BENCHMARK_FRAMES; frame++) {
+			for (unsigned int i = 0; i < crowd; i++)
+				mesh.BoneTransform(times[i] + frame / 60.0f, transforms);
+		}
+		long long serial = GetCurrentTimeMicros() - start;
+
+		std::vector<AffineTransform> palettes((size_t)crowd * boneNum);
+		mesh.BoneTransforms(&times[0], NULL, crowd, &palettes[0]);
+
+		unsigned long long allocations = allocationCount;
+		start = GetCurrentTimeMicros();
+		for (int frame = 0; frame < BENCHMARK_FRAMES; frame++) {
+			for (unsigned int i = 0; i < crowd; i++)
+				times[i] += 1.0f / 60.0f;
+			mesh.BoneTransforms(&times[0], NULL, crowd, &palettes[0]);
+		}
+		long long batched = GetCurrentTimeMicros() - start;
+		allocations = allocationCount - allocations;
+
+		printf("crowd %5u  pose     serial %9.3f ms/frame  batched %9.3f ms/frame  speedup %.2fx  %.1f allocations/call\n",
+			crowd, serial / 1000.0 / BENCHMARK_FRAMES, batched / 1000.0 / BENCHMARK_FRAMES,
+			batched > 0 ? serial / (double)batched : 0.0, allocations / (double)BENCHMARK_FRAMES);
+	}
+	printf("\n");
+}
+
+// Pose cost and skinned vertex error of the compressed clips against the imported ones
+static void BenchmarkCompression(SkinnedMesh &mesh, const char *filename)
+{
+	SkinnedMesh compressedMesh;
+	compressedMesh.SetHeadless(true);
+	compressedMesh.SetAnimationCompression(AnimationCompression());
+
+	if (!compressedMesh.LoadMesh(filename)) {
+		fprintf(stderr, "BenchmarkCompression(): failed to load '%s'\n", filename);
+		return;
+	}
+
+	const unsigned int crowd = CrowdSizes[ARRAY_SIZE_IN_ELEMENTS(CrowdSizes) - 1];
+	const unsigned int boneNum = mesh.NumBones();
+
+	std::vector<float> times(crowd);
+	for (unsigned int i = 0; i < crowd; i++)
+		times[i] = i * 0.37f;
+
+	std::vector<AffineTransform> transforms((size_t)crowd * boneNum), compressedTransforms((size_t)crowd * boneNum);
+	long long elapsed[2];
+
+	for (int pass = 0; pass < 2; pass++) {
+		SkinnedMesh &source = pass == 0 ? mesh : compressedMesh;
+		std::vector<AffineTransform> &palettes = pass == 0 ? transforms : compressedTransforms;
+
+		long long start = GetCurrentTimeMicros();
+		for (int frame = 0; frame < BENCHMARK_FRAMES; frame++)
+			source.BoneTransforms(&times[0], NULL, crowd, &palettes[0]);
+		elapsed[pass] = GetCurrentTimeMicros() - start;
+	}
+
+	// Skin a few of the poses both ways and compare the vertices
+	const SkinningInput input = mesh.GetSkinningInput();
+	std::vector<SkinningPalette> palettes(POSE_NUM), compressedPalettes(POSE_NUM);
+	for (unsigned int i = 0; i < POSE_NUM; i++) {
+		palettes[i].Set(&transforms[(size_t)i * boneNum].m[0][0], boneNum);
+		compressedPalettes[i].Set(&compressedTransforms[(size_t)i * boneNum].m[0][0], boneNum);
+	}
+
+	std::vector<float> vertices((size_t)input.vertexNum * 6 * POSE_NUM), compressedVertices(vertices.size());
+	SkinCrowd(SKINNING_SCALAR, input, palettes, POSE_NUM, vertices);
+	SkinCrowd(SKINNING_SCALAR, input, compressedPalettes, POSE_NUM, compressedVertices);
+
+	float maxError = 0.0f;
+	for (unsigned int instance = 0; instance < POSE_NUM; instance++) {
+		SkinnedVertices a = InstanceOutput(vertices, input.vertexNum, instance);
+		SkinnedVertices b = InstanceOutput(compressedVertices, input.vertexNum, instance);
+
+		for (unsigned int v = 0; v < input.vertexNum; v++) {
+			float dx = a.positionX[v] - b.positionX[v];
+			float dy = a.positionY[v] - b.positionY[v];
+			float dz = a.positionZ[v] - b.positionZ[v];
+			maxError = fmaxf(maxError, sqrtf(dx * dx + dy * dy + dz * dz));
+		}
+	}
+
+	printf("crowd %5u  pose     imported %9.3f ms/frame  compressed %9.3f ms/frame  max vertex error %g\n\n",
+		crowd, elapsed[0] / 1000.0 / BENCHMARK_FRAMES, elapsed[1] / 1000.0 / BENCHMARK_FRAMES, maxError);
+}
+
+// Every instance posed every frame against the scheduler, for a crowd
+// spread out in depth with a third of it off screen
+static void BenchmarkLod(SkinnedMesh &mesh)
+{
+	const unsigned int crowd = CrowdSizes[ARRAY_SIZE_IN_ELEMENTS(CrowdSizes) - 1];
+	const unsigned int boneNum = mesh.NumBones();
+
+	std::vector<float> pixels(crowd), times(crowd);
+	float totalPixels = 0.0f;
+	for (unsigned int i = 0; i < crowd; i++) {
+		float distance = 1.0f + 39.0f * ((i * 7919) % crowd) / (float)crowd;
+		pixels[i] = i % 3 == 2 ? 0.0f : 400.0f / distance;
+		totalPixels += pixels[i];
+	}
+
+	std::vector<AffineTransform> palettes((size_t)crowd * boneNum);
+
+	long long start = GetCurrentTimeMicros();
+	for (int frame = 0; frame < LOD_FRAMES; frame++) {
+		for (unsigned int i = 0; i < crowd; i++)
+			times[i] = i * 0.37f + frame * FRAME_SECONDS;
+		mesh.BoneTransforms(&times[0], NULL, crowd, &palettes[0]);
+	}
+	long long everyFrame = GetCurrentTimeMicros() - start;
+
+	AnimationScheduler scheduler;
+	scheduler.Init(crowd, boneNum, AnimationLodSettings());
+
+	unsigned int posed = 0;
+
+	start = GetCurrentTimeMicros();
+	for (int frame = 0; frame < LOD_FRAMES; frame++) {
+		scheduler.BeginFrame(&pixels[0]);
+
+		for (unsigned int d = 0; d < scheduler.DueNum(); d++) {
+			unsigned int i = scheduler.DueInstances()[d];
+			times[d] = i * 0.37f + (frame + scheduler.LeadFrames(d)) * FRAME_SECONDS;
+		}
+
+		mesh.BoneTransforms(&times[0], NULL, scheduler.DueNum(), scheduler.DuePalettes(), scheduler.DueLowDetail());
+		scheduler.EndFrame();
+		posed += scheduler.DueNum();
+	}
+	long long scheduled = GetCurrentTimeMicros() - start;
+
+	printf("crowd %5u  lod      every frame %9.3f ms/frame  scheduled %9.3f ms/frame  %.0f poses/frame, %.0f pixels tall in total\n\n",
+		crowd, everyFrame / 1000.0 / LOD_FRAMES, scheduled / 1000.0 / LOD_FRAMES, posed / (float)LOD_FRAMES, totalPixels);
+}
+
+// Average time of op(i) over MATRIX_PASSES passes of MATRIX_NUM
+template <typename Op>
+static double NsPerMatrix(Op op)
+{
+	long long start = GetCurrentTimeMicros();
+
+	for (int pass = 0; pass < MATRIX_PASSES; pass++) {
+		for (unsigned int i = 0; i < MATRIX_NUM; i++)
+			op(i);
+	}
+
+	return (GetCurrentTimeMicros() - start) * 1000.0 / ((double)MATRIX_PASSES * MATRIX_NUM);
+}
+
+// Matrix4f operations as built (SIMD unless OGLDEV_NO_SIMD) against their
+// plain versions and against glm on the same matrices
+static void BenchmarkMatrix()
+{
+#if defined(OGLDEV_SIMD) && defined(__AVX__)
+	const char *build = "AVX";
+#elif defined(OGLDEV_SIMD)
+	const char *build = "SSE";
+#else
+	const char *build = "none";
+#endif
+
+	std::vector<Matrix4f> a(MATRIX_NUM), b(MATRIX_NUM), out(MATRIX_NUM);
+	std::vector<Vector4f> v(MATRIX_NUM), vout(MATRIX_NUM);
+	std::vector<glm::mat4> ga(MATRIX_NUM), gb(MATRIX_NUM), gout(MATRIX_NUM);
+	std::vector<glm::vec4> gv(MATRIX_NUM), gvout(MATRIX_NUM);
+
+	// Invertible: random entries plus a strong diagonal
+	srand(1);
+	for (unsigned int i = 0; i < MATRIX_NUM; i++) {
+		for (int r = 0; r < 4; r++) {
+			for (int c = 0; c < 4; c++) {
+				a[i].m[r][c] = RandomFloat() * 2.0f - 1.0f + (r == c ? 4.0f : 0.0f);
+				b[i].m[r][c] = RandomFloat() * 2.0f - 1.0f;
+
+				// glm is column-major
+				ga[i][c][r] = a[i].m[r][c];
+				gb[i][c][r] = b[i].m[r][c];
+			}
+		}
+
+		v[i] = Vector4f(RandomFloat(), RandomFloat(), RandomFloat(), 1.0f);
+		gv[i] = glm::vec4(v[i].x, v[i].y, v[i].z, v[i].w);
+	}
+
+	double ns[4][3];
+	float maxError[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+	// Multiply
+	ns[0][1] = NsPerMatrix([&](unsigned int i) { out[i] = a[i].MulScalar(b[i]); });
+	std::vector<Matrix4f> reference = out;
+	ns[0][0] = NsPerMatrix([&](unsigned int i) { out[i] = a[i] * b[i]; });
+	ns[0][2] = NsPerMatrix([&](unsigned int i) { gout[i] = ga[i] * gb[i]; });
+	for (unsigned int i = 0; i < MATRIX_NUM; i++)
+		for (int k = 0; k < 16; k++)
+			maxError[0] = fmaxf(maxError[0], fabsf((&out[i].m[0][0])[k] - (&reference[i].m[0][0])[k]));
+
+	// Inverse
+	ns[1][1] = NsPerMatrix([&](unsigned int i) { out[i] = a[i]; out[i].InverseScalar(); });
+	reference = out;
+	ns[1][0] = NsPerMatrix([&](unsigned int i) { out[i] = a[i]; out[i].Inverse(); });
+	ns[1][2] = NsPerMatrix([&](unsigned int i) { gout[i] = glm::inverse(ga[i]); });
+	for (unsigned int i = 0; i < MATRIX_NUM; i++)
+		for (int k = 0; k < 16; k++)
+			maxError[1] = fmaxf(maxError[1], fabsf((&out[i].m[0][0])[k] - (&reference[i].m[0][0])[k]));
+
+	// Transpose
+	ns[2][1] = NsPerMatrix([&](unsigned int i) { out[i] = a[i].TransposeScalar(); });
+	reference = out;
+	ns[2][0] = NsPerMatrix([&](unsigned int i) { out[i] = a[i].Transpose(); });
+	ns[2][2] = NsPerMatrix([&](unsigned int i) { gout[i] = glm::transpose(ga[i]); });
+	for (unsigned int i = 0; i < MATRIX_NUM; i++)
+		for (int k = 0; k < 16; k++)
+			maxError[2] = fmaxf(maxError[2], fabsf((&out[i].m[0][0])[k] - (&reference[i].m[0][0])[k]));
+
+	// Matrix times vector
+	ns[3][1] = NsPerMatrix([&](unsigned int i) { vout[i] = a[i].MulScalar(v[i]); });
+	std::vector<Vector4f> vreference = vout;
+	ns[3][0] = NsPerMatrix([&](unsigned int i) { vout[i] = a[i] * v[i]; });
+	ns[3][2] = NsPerMatrix([&](unsigned int i) { gvout[i] = ga[i] * gv[i]; });
+	for (unsigned int i = 0; i < MATRIX_NUM; i++) {
+		maxError[3] = fmaxf(maxError[3], fmaxf(fabsf(vout[i].x - vreference[i].x), fabsf(vout[i].y - vreference[i].y)));
+		maxError[3] = fmaxf(maxError[3], fmaxf(fabsf(vout[i].z - vreference[i].z), fabsf(vout[i].w - vreference[i].w)));
+	}
+
+	// The same products for transforms known to be affine
+	std::vector<AffineTransform> affineA(MATRIX_NUM), affineB(MATRIX_NUM), affineOut(MATRIX_NUM);
+	for (unsigned int i = 0; i < MATRIX_NUM; i++) {
+		affineA[i] = AffineTransform(a[i]);
+		affineB[i] = AffineTransform(b[i]);
+	}
+	const double affineNs = NsPerMatrix([&](unsigned int i) { affineOut[i] = affineA[i] * affineB[i]; });
+
+	static const char *names[4] = { "multiply", "inverse", "transpose", "vector" };
+
+	printf("Matrix4f, SIMD: %s\n", build);
+	for (int op = 0; op < 4; op++) {
+		printf("%-10s  Matrix4f %7.2f ns  plain %7.2f ns  glm %7.2f ns  speedup %.2fx  max error %g\n",
+			names[op], ns[op][0], ns[op][1], ns[op][2], ns[op][0] > 0.0 ? ns[op][1] / ns[op][0] : 0.0, maxError[op]);
+	}
+	printf("%-10s  AffineTransform %7.2f ns\n", "affine", affineNs);
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filename = argc > 1 ? argv[1] : DEFAULT_MODEL;
+
+	SkinnedMesh mesh;
+	mesh.SetHeadless(true);
+
+	if (!mesh.LoadMesh(filename)) {
+		fprintf(stderr, "main(): failed to load '%s'\n", filename);
+		return -1;
+	}
+
+	const SkinningInput input = mesh.GetSkinningInput();
+	printf("%u vertices, %u bones, %u threads, best kernel %s\n\n", input.vertexNum, mesh.NumBones(),
+		ThreadPool::Shared().NumThreads(), CpuSkinning::KernelName(CpuSkinning::BestKernel()));
+
+	BenchmarkMatrix();
+	BenchmarkBoneTransform(mesh);
+	BenchmarkPoses(mesh);
+	BenchmarkCompression(mesh, filename);
+	BenchmarkLod(mesh);
+
+	// Poses spread over the first seconds of the animation
+	std::vector<float> times(POSE_NUM);
+	for (unsigned int i = 0; i < POSE_NUM; i++)
+		times[i] = i / 30.0f;
+
+	std::vector<AffineTransform> transforms((size_t)POSE_NUM * mesh.NumBones());
+	mesh.BoneTransforms(&times[0], NULL, POSE_NUM, &transforms[0]);
+
+	std::vector<SkinningPalette> palettes(POSE_NUM);
+	for (unsigned int i = 0; i < POSE_NUM; i++)
+		palettes[i].Set(&transforms[(size_t)i * mesh.NumBones()].m[0][0], mesh.NumBones());
+
+	// Reference for the error column
+	std::vector<float> reference((size_t)input.vertexNum * 6 * POSE_NUM);
+	SkinCrowd(SKINNING_SCALAR, input, palettes, POSE_NUM, reference);
+
+	std::vector<float> output;
+
+	for (unsigned int c = 0; c < ARRAY_SIZE_IN_ELEMENTS(CrowdSizes); c++) {
+		const unsigned int crowd = CrowdSizes[c];
+		output.assign((size_t)input.vertexNum * 6 * crowd, 0.0f);
+
+		for (int k = 0; k < NUM_SKINNING_KERNELS; k++) {
+			const SkinningKernel kernel = (SkinningKernel)k;
+			if (!CpuSkinning::IsSupported(kernel))
+				continue;
+
+			// Warm up the caches and the pool
+			SkinCrowd(kernel, input, palettes, crowd, output);
+
+			long long start = GetCurrentTimeMicros();
+			for (int frame = 0; frame < BENCHMARK_FRAMES; frame++)
+				SkinCrowd(kernel, input, palettes, crowd, output);
+			long long elapsed = GetCurrentTimeMicros() - start;
+
+			float maxError = 0.0f;
+			const size_t compared = (size_t)input.vertexNum * 6 * (crowd < POSE_NUM ? crowd : POSE_NUM);
+			for (size_t i = 0; i < compared; i++)
+				maxError = fmaxf(maxError, fabsf(output[i] - reference[i]));
+
+			const double frameMs = elapsed / 1000.0 / BENCHMARK_FRAMES;
+			const double verticesPerSecond = (double)input.vertexNum * crowd * BENCHMARK_FRAMES / (elapsed / 1000000.0);
+
+			printf("crowd %5u  %-6s  %9.3f ms/frame  %8.1f M vertices/s  max error %g\n",
+				crowd, CpuSkinning::KernelName(kernel), frameMs, verticesPerSecond / 1000000.0, maxError);
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,451 @@
+#include "GLAnimationClip.h"
+
+#include <cmath>
+#include <assimp/scene.h>
+
+static const float DefaultValues[NUM_ANIMATION_CURVES][4] = {
+	{ 0.0f, 0.0f, 0.0f, 0.0f },
+	{ 0.0f, 0.0f, 0.0f, 1.0f },
+	{ 1.0f, 1.0f, 1.0f, 0.0f },
+};
+
+// Source keys of one curve as times and 4-float values
+static void CopySourceKeys(const aiNodeAnim *nodeAnim, AnimationCurveType curve,
+	std::vector<float> &times, std::vector<float> &values)
+{
+	times.clear();
+	values.clear();
+
+	if (curve == ANIMATION_ROTATION) {
+		for (unsigned int i = 0; i < nodeAnim->mNumRotationKeys; i++) {
+			const aiQuatKey &key = nodeAnim->mRotationKeys[i];
+			times.push_back((float)key.mTime);
+			values.push_back(key.mValue.x);
+			values.push_back(key.mValue.y);
+			values.push_back(key.mValue.z);
+			values.push_back(key.mValue.w);
+		}
+		return;
+	}
+
+	const unsigned int keyNum = curve == ANIMATION_POSITION ? nodeAnim->mNumPositionKeys : nodeAnim->mNumScalingKeys;
+	const aiVectorKey *keys = curve == ANIMATION_POSITION ? nodeAnim->mPositionKeys : nodeAnim->mScalingKeys;
+
+	for (unsigned int i = 0; i < keyNum; i++) {
+		times.push_back((float)keys[i].mTime);
+		values.push_back(keys[i].mValue.x);
+		values.push_back(keys[i].mValue.y);
+		values.push_back(keys[i].mValue.z);
+		values.push_back(0.0f);
+	}
+}
+
+// Same as aiQuaternion::Interpolate followed by Normalize
+static void Slerp(const float *start, const float *end, float factor, float *out)
+{
+	float cosom = start[0] * end[0] + start[1] * end[1] + start[2] * end[2] + start[3] * end[3];
+	float sign = 1.0f;
+
+	if (cosom < 0.0f) {
+		cosom = -cosom;
+		sign = -1.0f;
+	}
+
+	float sclp, sclq;
+	if (1.0f - cosom > 0.0001f) {
+		float omega = acosf(cosom);
+		float sinom = sinf(omega);
+		sclp = sinf((1.0f - factor) * omega) / sinom;
+		sclq = sinf(factor * omega) / sinom;
+	}
+	else {
+		sclp = 1.0f - factor;
+		sclq = factor;
+	}
+	sclq *= sign;
+
+	float length = 0.0f;
+	for (int k = 0; k < 4; k++) {
+		out[k] = sclp * start[k] + sclq * end[k];
+		length += out[k] * out[k];
+	}
+
+	length = sqrtf(length);
+	if (length > 0.0f) {
+		for (int k = 0; k < 4; k++)
+			out[k] /= length;
+	}
+}
+
+static void Interpolate(AnimationCurveType curve, const float *start, const float *end, float factor, float *out)
+{
+	if (curve == ANIMATION_ROTATION) {
+		Slerp(start, end, factor, out);
+		return;
+	}
+
+	for (int k = 0; k < 3; k++)
+		out[k] = start[k] + factor * (end[k] - start[k]);
+}
+
+// Evaluates source keys at 'time' with a binary search; used for resampling
+static void EvaluateSourceKeys(AnimationCurveType curve, const std::vector<float> &times, const std::vector<float> &values,
+	float time, float *out)
+{
+	const unsigned int keyNum = times.size();
+
+	if (time <= times[0] || keyNum == 1) {
+		for (int k = 0; k < 4; k++)
+			out[k] = values[k];
+		return;
+	}
+	if (time >= times[keyNum - 1]) {
+		for (int k = 0; k < 4; k++)
+			out[k] = values[(keyNum - 1) * 4 + k];
+		return;
+	}
+
+	unsigned int first = 0, last = keyNum - 1;
+	while (last - first > 1) {
+		unsigned int middle = (first + last) / 2;
+		if (times[middle] <= time)
+			first = middle;
+		else
+			last = middle;
+	}
+
+	float factor = (time - times[first]) / (times[last] - times[first]);
+	out[3] = 0.0f;
+	Interpolate(curve, &values[first * 4], &values[last * 4], factor, out);
+}
+
+// Distance between two values of a curve: radians for rotations
+static float KeyError(AnimationCurveType curve, const float *a, const float *b)
+{
+	if (curve == ANIMATION_ROTATION) {
+		float dot = fabsf(a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3]);
+		return 2.0f * acosf(fminf(dot, 1.0f));
+	}
+
+	float dx = a[0] - b[0], dy = a[1] - b[1], dz = a[2] - b[2];
+	return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+// Whether interpolating keys 'first' and 'last' reproduces every key between them
+static bool SpanFits(AnimationCurveType curve, const float *times, const float *values,
+	unsigned int first, unsigned int last, float tolerance)
+{
+	for (unsigned int k = first + 1; k < last; k++) {
+		float factor = (times[k] - times[first]) / (times[last] - times[first]);
+		float value[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		Interpolate(curve, &values[first * 4], &values[last * 4], factor, value);
+
+		if (KeyError(curve, value, &values[k * 4]) > tolerance)
+			return false;
+	}
+	return true;
+}
+
+// Keys to keep: each kept key reaches as far ahead as the tolerance allows
+static void ReduceKeys(AnimationCurveType curve, const float *times, const float *values, unsigned int keyNum,
+	float tolerance, std::vector<unsigned int> &kept)
+{
+	kept.clear();
+	if (keyNum == 0)
+		return;
+
+	kept.push_back(0);
+
+	bool constant = true;
+	for (unsigned int k = 1; k < keyNum && constant; k++)
+		constant = KeyError(curve, &values[0], &values[k * 4]) <= tolerance;
+	if (constant)
+		return;
+
+	unsigned int anchor = 0;
+	while (anchor + 1 < keyNum) {
+		unsigned int next = anchor + 1;
+		while (next + 1 < keyNum && SpanFits(curve, times, values, anchor, next + 1, tolerance))
+			next++;
+
+		kept.push_back(next);
+		anchor = next;
+	}
+}
+
+#define SMALLEST_THREE_RANGE 0.70710678f	// no other component of a unit quaternion exceeds 1/sqrt(2)
+#define SMALLEST_THREE_MAX 32767.0f		// 15 bits per component
+
+// The three smallest components in 15 bits each; the index of the dropped,
+// largest one goes in the top bits of the first two words
+static void EncodeRotation(const float *q, unsigned short *out)
+{
+	int largest = 0;
+	for (int i = 1; i < 4; i++) {
+		if (fabsf(q[i]) > fabsf(q[largest]))
+			largest = i;
+	}
+
+	// q and -q are the same rotation; make the dropped component positive
+	const float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+
+	int n = 0;
+	for (int i = 0; i < 4; i++) {
+		if (i == largest)
+			continue;
+
+		float normalized = (q[i] * sign / SMALLEST_THREE_RANGE) * 0.5f + 0.5f;
+		normalized = fminf(fmaxf(normalized, 0.0f), 1.0f);
+		out[n++] = (unsigned short)(normalized * SMALLEST_THREE_MAX + 0.5f);
+	}
+
+	out[0] |= (unsigned short)((largest & 1) << 15);
+	out[1] |= (unsigned short)((largest >> 1) << 15);
+}
+
+static void DecodeRotation(const unsigned short *in, float *q)
+{
+	const int largest = (in[0] >> 15) | ((in[1] >> 15) << 1);
+
+	float sum = 0.0f;
+	int n = 0;
+	for (int i = 0; i < 4; i++) {
+		if (i == largest)
+			continue;
+
+		q[i] = ((in[n++] & 0x7FFF) / SMALLEST_THREE_MAX * 2.0f - 1.0f) * SMALLEST_THREE_RANGE;
+		sum += q[i] * q[i];
+	}
+
+	q[largest] = sqrtf(fmaxf(1.0f - sum, 0.0f));
+}
+
+AnimationClip::AnimationClip() :
+	duration(0.0f), ticksPerSecond(25.0f), sampleStep(0.0f), compressed(false), sourceBytes(0)
+{
+}
+
+void AnimationClip::Init(const aiAnimation *animation, float sampleRate)
+{
+	name = animation->mName.data;
+	duration = (float)animation->mDuration;
+	ticksPerSecond = (float)(animation->mTicksPerSecond != 0 ? animation->mTicksPerSecond : 25.0f);
+	sampleStep = sampleRate > 0.0f ? ticksPerSecond / sampleRate : 0.0f;
+
+	channels.resize(animation->mNumChannels);
+	channelMapping.clear();
+	times.clear();
+	values.clear();
+	packed.clear();
+	compressed = false;
+	sourceBytes = 0;
+
+	const unsigned int sampleNum = IsResampled() ? (unsigned int)ceilf(duration / sampleStep) + 1 : 0;
+
+	std::vector<float> sourceTimes, sourceValues;
+
+	for (unsigned int i = 0; i < animation->mNumChannels; i++) {
+		const aiNodeAnim *nodeAnim = animation->mChannels[i];
+		AnimationChannel &channel = channels[i];
+
+		channel.nodeName = nodeAnim->mNodeName.data;
+		channelMapping[channel.nodeName] = i;
+
+		sourceBytes += sizeof(aiVectorKey) * (nodeAnim->mNumPositionKeys + nodeAnim->mNumScalingKeys) +
+			sizeof(aiQuatKey) * nodeAnim->mNumRotationKeys;
+
+		for (int c = 0; c < NUM_ANIMATION_CURVES; c++) {
+			const AnimationCurveType curve = (AnimationCurveType)c;
+			CopySourceKeys(nodeAnim, curve, sourceTimes, sourceValues);
+
+			channel.curves[c].keyOffset = times.size();
+			for (int k = 0; k < 3; k++) {
+				channel.curves[c].rangeMin[k] = 0.0f;
+				channel.curves[c].rangeExtent[k] = 0.0f;
+			}
+
+			// Constant curves keep their single key
+			if (!IsResampled() || sourceTimes.size() <= 1) {
+				times.insert(times.end(), sourceTimes.begin(), sourceTimes.end());
+				values.insert(values.end(), sourceValues.begin(), sourceValues.end());
+				channel.curves[c].keyNum = sourceTimes.size();
+				continue;
+			}
+
+			for (unsigned int j = 0; j < sampleNum; j++) {
+				float time = fminf(j * sampleStep, duration);
+				float value[4];
+				EvaluateSourceKeys(curve, sourceTimes, sourceValues, time, value);
+
+				times.push_back(time);
+				values.insert(values.end(), value, value + 4);
+			}
+			channel.curves[c].keyNum = sampleNum;
+		}
+	}
+}
+
+void AnimationClip::Compress(const AnimationCompression &settings)
+{
+	if (compressed)
+		return;
+
+	const float tolerances[NUM_ANIMATION_CURVES] = {
+		settings.positionTolerance, settings.rotationTolerance, settings.scalingTolerance
+	};
+
+	std::vector<float> compressedTimes;
+	std::vector<unsigned short> compressedValues;
+	std::vector<unsigned int> kept;
+
+	for (unsigned int i = 0; i < channels.size(); i++) {
+		for (int c = 0; c < NUM_ANIMATION_CURVES; c++) {
+			const AnimationCurveType type = (AnimationCurveType)c;
+			AnimationCurve &curve = channels[i].curves[c];
+			const float *curveTimes = curve.keyNum > 0 ? &times[curve.keyOffset] : NULL;
+			const float *curveValues = curve.keyNum > 0 ? &values[curve.keyOffset * 4] : NULL;
+
+			ReduceKeys(type, curveTimes, curveValues, curve.keyNum, tolerances[c], kept);
+
+			if (type != ANIMATION_ROTATION && !kept.empty()) {
+				for (int k = 0; k < 3; k++) {
+					float low = curveValues[kept[0] * 4 + k], high = low;
+					for (unsigned int j = 1; j < kept.size(); j++) {
+						low = fminf(low, curveValues[kept[j] * 4 + k]);
+						high = fmaxf(high, curveValues[kept[j] * 4 + k]);
+					}
+					curve.rangeMin[k] = low;
+					curve.rangeExtent[k] = high - low;
+				}
+			}
+
+			curve.keyOffset = compressedTimes.size();
+			curve.keyNum = kept.size();
+
+			for (unsigned int j = 0; j < kept.size(); j++) {
+				const float *value = &curveValues[kept[j] * 4];
+				unsigned short key[3] = { 0, 0, 0 };
+
+				if (type == ANIMATION_ROTATION) {
+					EncodeRotation(value, key);
+				}
+				else {
+					for (int k = 0; k < 3; k++) {
+						if (curve.rangeExtent[k] > 0.0f)
+							key[k] = (unsigned short)((value[k] - curve.rangeMin[k]) / curve.rangeExtent[k] * 65535.0f + 0.5f);
+					}
+				}
+
+				compressedTimes.push_back(curveTimes[kept[j]]);
+				compressedValues.insert(compressedValues.end(), key, key + 3);
+			}
+		}
+	}
+
+	times.swap(compressedTimes);
+	packed.swap(compressedValues);
+	std::vector<float>().swap(values);
+
+	// Keys are no longer evenly spaced
+	sampleStep = 0.0f;
+	compressed = true;
+}
+
+void AnimationClip::DecodeKey(AnimationCurveType curve, const AnimationCurve &keys, unsigned int key, float *out) const
+{
+	if (!compressed) {
+		for (int k = 0; k < 4; k++)
+			out[k] = values[key * 4 + k];
+		return;
+	}
+
+	const unsigned short *in = &packed[key * 3];
+
+	if (curve == ANIMATION_ROTATION) {
+		DecodeRotation(in, out);
+		return;
+	}
+
+	for (int k = 0; k < 3; k++)
+		out[k] = keys.rangeMin[k] + in[k] / 65535.0f * keys.rangeExtent[k];
+	out[3] = 0.0f;
+}
+
+size_t AnimationClip::MemoryBytes() const
+{
+	return sizeof(float) * (times.size() + values.size()) + sizeof(unsigned short) * packed.size() +
+		sizeof(AnimationChannel) * channels.size();
+}
+
+unsigned int AnimationClip::FindChannel(const std::string &nodeName) const
+{
+	std::map<std::string, unsigned int>::const_iterator it = channelMapping.find(nodeName);
+	return it != channelMapping.end() ? it->second : INVALID_ANIMATION_CHANNEL;
+}
+
+void AnimationClip::InitCursor(AnimationCursor &cursor) const
+{
+	cursor.keys.assign(channels.size() * NUM_ANIMATION_CURVES, 0);
+}
+
+unsigned int AnimationClip::FindKey(const AnimationCurve &curve, float time, unsigned int *cursorKey) const
+{
+	const unsigned int lastKey = curve.keyNum - 2;
+
+	if (IsResampled()) {
+		unsigned int key = time > 0.0f ? (unsigned int)(time / sampleStep) : 0;
+		return key < lastKey ? key : lastKey;
+	}
+
+	// Keys only move forwards during playback; start over when time wrapped
+	const float *curveTimes = &times[curve.keyOffset];
+	unsigned int firstKey = 0;
+	if (!cursorKey)
+		cursorKey = &firstKey;
+	unsigned int key = *cursorKey;
+
+	if (key > lastKey || time < curveTimes[key])
+		key = 0;
+
+	while (key < lastKey && curveTimes[key + 1] <= time)
+		key++;
+
+	*cursorKey = key;
+	return key;
+}
+
+void AnimationClip::Sample(unsigned int channel, AnimationCurveType curve, float time, AnimationCursor *cursor, float *out) const
+{
+	const AnimationCurve &keys = channels[channel].curves[curve];
+	const int width = curve == ANIMATION_ROTATION ? 4 : 3;
+
+	if (keys.keyNum == 0) {
+		for (int k = 0; k < width; k++)
+			out[k] = DefaultValues[curve][k];
+		return;
+	}
+
+	if (keys.keyNum == 1) {
+		float value[4];
+		DecodeKey(curve, keys, keys.keyOffset, value);
+		for (int k = 0; k < width; k++)
+			out[k] = value[k];
+		return;
+	}
+
+	unsigned int *cursorKey = cursor ? &cursor->keys[channel * NUM_ANIMATION_CURVES + curve] : NULL;
+	const unsigned int key = keys.keyOffset + FindKey(keys, time, cursorKey);
+
+	float factor = (time - times[key]) / (times[key + 1] - times[key]);
+	factor = fminf(fmaxf(factor, 0.0f), 1.0f);
+
+	if (!compressed) {
+		Interpolate(curve, &values[key * 4], &values[(key + 1) * 4], factor, out);
+		return;
+	}
+
+	float start[4], end[4];
+	DecodeKey(curve, keys, key, start);
+	DecodeKey(curve, keys, key + 1, end);
+	Interpolate(curve, start, end, factor, out);
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+struct aiAnimation;
+
+enum AnimationCurveType
+{
+	ANIMATION_POSITION,	// 3 floats per key
+	ANIMATION_ROTATION,	// 4 floats per key: x, y, z, w
+	ANIMATION_SCALING,	// 3 floats per key
+	NUM_ANIMATION_CURVES
+};
+
+// Keys of one curve of one channel. The times and the values live in the
+// clip's shared arrays, so a channel's keys are contiguous and the times
+// can be searched without touching the values.
+struct AnimationCurve
+{
+	unsigned int keyOffset;		// into the clip's times; values start at keyOffset * 4
+	unsigned int keyNum;
+
+	// Compressed position and scaling keys are quantized to this box
+	float rangeMin[3];
+	float rangeExtent[3];
+};
+
+struct AnimationChannel
+{
+	std::string nodeName;
+	AnimationCurve curves[NUM_ANIMATION_CURVES];
+};
+
+// How far a compressed clip may stray from the source
+struct AnimationCompression
+{
+	float positionTolerance;	// units
+	float rotationTolerance;	// radians
+	float scalingTolerance;
+
+	AnimationCompression() :
+		positionTolerance(0.001f), rotationTolerance(0.001f), scalingTolerance(0.001f)
+	{
+	}
+};
+
+// Where the last sample of each curve was found, so that playing forwards
+// finds the next key without searching from the first. One per playing
+// instance of a clip.
+struct AnimationCursor
+{
+	std::vector<unsigned int> keys;	// NUM_ANIMATION_CURVES per channel
+};
+
+// Runtime copy of an imported animation. With a sample rate the keys are
+// resampled to a uniform step, so finding the keys around a time is one
+// division. Without one the source keys are kept and looked up through an
+// AnimationCursor.
+class AnimationClip
+{
+public:
+	AnimationClip();
+
+	// sampleRate: keys per second, or 0 to keep the source keys
+	void Init(const aiAnimation *animation, float sampleRate);
+
+	const std::string &Name() const { return name; }
+	bool IsResampled() const { return sampleStep > 0.0f; }
+	float Duration() const { return duration; }				// ticks
+	float TicksPerSecond() const { return ticksPerSecond; }
+
+	unsigned int ChannelNum() const { return channels.size(); }
+	const AnimationChannel &Channel(unsigned int i) const { return channels[i]; }
+
+	// Channel animating the node, or INVALID_ANIMATION_CHANNEL
+	unsigned int FindChannel(const std::string &nodeName) const;
+
+	// Drops the keys that interpolating their neighbours reproduces within
+	// the tolerances, then packs the rest into 6 bytes a key: rotations as
+	// smallest-three quaternions, positions and scalings as 16 bits per axis
+	// across the curve's range. Sampling unpacks the two keys it blends.
+	// A resampled clip goes back to cursor lookups.
+	void Compress(const AnimationCompression &settings);
+	bool IsCompressed() const { return compressed; }
+
+	// Sets up a cursor for this clip; resampled clips do not need one
+	void InitCursor(AnimationCursor &cursor) const;
+
+	// Interpolated value of one curve at 'time' (ticks, 0 .. Duration).
+	// 'cursor' is only used, and then required, when the clip keeps its
+	// source keys.
+	void Sample(unsigned int channel, AnimationCurveType curve, float time, AnimationCursor *cursor, float *out) const;
+
+	size_t KeyNum() const { return times.size(); }
+
+	// Bytes of keys held by the clip, and by the aiAnimation it came from
+	size_t MemoryBytes() const;
+	size_t SourceBytes() const { return sourceBytes; }
+
+#define INVALID_ANIMATION_CHANNEL 0xFFFFFFFF
+
+private:
+	std::string name;
+	float duration;
+	float ticksPerSecond;
+	float sampleStep;	// ticks between resampled keys, 0 when not resampled
+	bool compressed;
+	size_t sourceBytes;
+
+	std::vector<AnimationChannel> channels;
+	std::map<std::string, unsigned int> channelMapping;
+
+	// Keys of every curve, curve after curve. Every key has 4 value
+	// floats whatever the curve width, so a key index addresses both.
+	std::vector<float> times;
+	std::vector<float> values;
+
+	// Values of a compressed clip, 3 per key; 'values' is empty then
+	std::vector<unsigned short> packed;
+
+	void DecodeKey(AnimationCurveType curve, const AnimationCurve &keys, unsigned int key, float *out) const;
+
+	unsigned int FindKey(const AnimationCurve &curve, float time, unsigned int *cursorKey) const;
+};
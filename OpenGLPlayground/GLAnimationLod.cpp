@@ -0,0 +1,142 @@
+#include "GLAnimationLod.h"
+#include "GLThreadPool.h"
+
+#define ANIMATION_LOD_BATCH_INSTANCES 64	// instances per ThreadPool item in EndFrame
+
+AnimationScheduler::AnimationScheduler() :
+	boneNum(0), frame(0)
+{
+}
+
+void AnimationScheduler::Init(unsigned int instanceNum, unsigned int boneNum, const AnimationLodSettings &settings)
+{
+	this->settings = settings;
+	this->boneNum = boneNum;
+	frame = 0;
+
+	InstanceState state;
+	state.period = 1;
+	state.span = 1;
+	state.lead = 0;
+	state.age = 0;
+	state.evaluated = false;
+	state.visible = false;
+	states.assign(instanceNum, state);
+
+	previous.resize((size_t)instanceNum * boneNum);
+	current.resize((size_t)instanceNum * boneNum);
+	output.resize((size_t)instanceNum * boneNum);
+
+	due.reserve(instanceNum);
+	dueLowDetail.reserve(instanceNum);
+	dueLead.reserve(instanceNum);
+	dueSpan.reserve(instanceNum);
+	duePalettes.reserve((size_t)instanceNum * boneNum);
+}
+
+void AnimationScheduler::BeginFrame(const float *screenPixels)
+{
+	due.clear();
+	dueLowDetail.clear();
+	dueLead.clear();
+	dueSpan.clear();
+
+	for (unsigned int i = 0; i < states.size(); i++) {
+		InstanceState &state = states[i];
+		const float pixels = screenPixels[i];
+
+		state.visible = pixels > 0.0f;
+		state.period = pixels >= settings.fullRatePixels ? 1 : pixels >= settings.halfRatePixels ? 2 : 4;
+
+		// Off screen instances keep what they have, once they have something.
+		// One that got bigger does not wait for the rest of its old period.
+		if (state.evaluated && (!state.visible || (state.age < state.span && state.period >= state.span)))
+			continue;
+
+		// Frames until the instance's slot in its period comes round again
+		unsigned int span = state.period - (frame + i) % state.period;
+		unsigned int lead = settings.interpolate && state.period > 1 ? span : 0;
+
+		// The very first pose is shown at once, and replaced by one that
+		// leads into the slots on the next frame
+		if (!state.evaluated && lead > 0) {
+			span = 1;
+			lead = 0;
+		}
+
+		due.push_back(i);
+		dueLowDetail.push_back(pixels < settings.detailPixels ? 1 : 0);
+		dueLead.push_back((unsigned char)lead);
+		dueSpan.push_back((unsigned char)span);
+	}
+
+	duePalettes.resize(due.size() * boneNum);
+}
+
+void AnimationScheduler::Blend(unsigned int instance)
+{
+	const InstanceState &state = states[instance];
+	AffineTransform *out = &output[(size_t)instance * boneNum];
+	const AffineTransform *to = &current[(size_t)instance * boneNum];
+
+	if (state.age >= state.lead) {
+		for (unsigned int b = 0; b < boneNum; b++)
+			out[b] = to[b];
+		return;
+	}
+
+	const AffineTransform *from = &previous[(size_t)instance * boneNum];
+	const float factor = state.age / (float)state.lead;
+
+	for (unsigned int b = 0; b < boneNum; b++) {
+		const float *a = &from[b].m[0][0];
+		const float *c = &to[b].m[0][0];
+		float *o = &out[b].m[0][0];
+
+		for (int k = 0; k < 12; k++)
+			o[k] = a[k] + factor * (c[k] - a[k]);
+	}
+}
+
+void AnimationScheduler::EndFrame()
+{
+	// The due instances: what would be shown now becomes the start of the
+	// blend towards the new pose
+	for (unsigned int d = 0; d < due.size(); d++) {
+		const unsigned int instance = due[d];
+		InstanceState &state = states[instance];
+		const size_t offset = (size_t)instance * boneNum;
+
+		if (state.evaluated) {
+			Blend(instance);
+			for (unsigned int b = 0; b < boneNum; b++)
+				previous[offset + b] = output[offset + b];
+		}
+
+		for (unsigned int b = 0; b < boneNum; b++)
+			current[offset + b] = duePalettes[d * boneNum + b];
+
+		state.span = dueSpan[d];
+		state.lead = dueLead[d];
+		state.age = 0;
+		state.evaluated = true;
+	}
+
+	const unsigned int batchNum = ((unsigned int)states.size() + ANIMATION_LOD_BATCH_INSTANCES - 1) / ANIMATION_LOD_BATCH_INSTANCES;
+
+	ThreadPool::Shared().ParallelFor(batchNum, [&](unsigned int batch)
+	{
+		unsigned int begin = batch * ANIMATION_LOD_BATCH_INSTANCES;
+		unsigned int end = begin + ANIMATION_LOD_BATCH_INSTANCES < states.size() ? begin + ANIMATION_LOD_BATCH_INSTANCES : (unsigned int)states.size();
+
+		for (unsigned int i = begin; i < end; i++) {
+			if (states[i].visible)
+				Blend(i);
+
+			if (states[i].age < 255)
+				states[i].age++;
+		}
+	});
+
+	frame++;
+}
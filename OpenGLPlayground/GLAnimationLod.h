@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+
+#include "ogldev_math_3d.h"
+
+// Thresholds on an instance's projected height in pixels
+struct AnimationLodSettings
+{
+	float fullRatePixels;	// at or above: a pose every frame
+	float halfRatePixels;	// at or above: every 2nd frame, below: every 4th
+	float detailPixels;		// below: detail bones stay in their bind pose
+	bool interpolate;		// blend between the last two poses instead of holding the last
+
+	AnimationLodSettings() :
+		fullRatePixels(200.0f), halfRatePixels(80.0f), detailPixels(100.0f), interpolate(true)
+	{
+	}
+};
+
+// Decides which instances of a skinned mesh get a new pose this frame and
+// keeps every instance's palette in between. Small instances update every
+// 2nd or 4th frame, each in its own slot of the period so that the same
+// share of them is due every frame, and instances off screen are not
+// updated at all. With interpolation a reduced-rate pose is evaluated as
+// far ahead as the instance's next slot and blended into; without it the
+// last pose is held.
+//
+// Per frame:
+//	scheduler.BeginFrame(pixels);
+//	for every i < DueNum(): time of DueInstances()[i], plus LeadFrames() frames
+//	mesh.BoneTransforms(times, clips, DueNum(), DuePalettes(), DueLowDetail());
+//	scheduler.EndFrame();
+//	... Palette(instance) for skinning
+class AnimationScheduler
+{
+public:
+	AnimationScheduler();
+
+	void Init(unsigned int instanceNum, unsigned int boneNum, const AnimationLodSettings &settings);
+
+	// screenPixels: projected height of every instance, 0 when culled
+	void BeginFrame(const float *screenPixels);
+
+	unsigned int DueNum() const { return (unsigned int)due.size(); }
+	const unsigned int *DueInstances() const { return due.empty() ? 0 : &due[0]; }
+	const unsigned char *DueLowDetail() const { return dueLowDetail.empty() ? 0 : &dueLowDetail[0]; }
+
+	// Where the poses of the due instances go, boneNum matrices each
+	AffineTransform *DuePalettes() { return duePalettes.empty() ? 0 : &duePalettes[0]; }
+
+	// How many frames ahead of now the due instance's pose should be
+	unsigned int LeadFrames(unsigned int dueIndex) const { return dueLead[dueIndex]; }
+
+	// Takes the due poses and updates the palettes of the visible instances
+	void EndFrame();
+
+	const AffineTransform *Palette(unsigned int instance) const { return &output[(size_t)instance * boneNum]; }
+	unsigned int Period(unsigned int instance) const { return states[instance].period; }
+
+private:
+	struct InstanceState
+	{
+		unsigned char period;		// frames between poses
+		unsigned char span;			// frames from the current pose to the next
+		unsigned char lead;			// frames the current pose was evaluated ahead, 0 to show it at once
+		unsigned char age;			// frames since the current pose was evaluated
+		bool evaluated;
+		bool visible;
+	};
+
+	AnimationLodSettings settings;
+	unsigned int boneNum;
+	unsigned int frame;
+
+	std::vector<InstanceState> states;
+	std::vector<AffineTransform> previous;	// per instance: what was shown when the current pose came in
+	std::vector<AffineTransform> current;	// per instance: the last evaluated pose
+	std::vector<AffineTransform> output;	// per instance: what is shown
+
+	std::vector<unsigned int> due;
+	std::vector<unsigned char> dueLowDetail;
+	std::vector<unsigned char> dueLead;
+	std::vector<unsigned char> dueSpan;
+	std::vector<AffineTransform> duePalettes;
+
+	void Blend(unsigned int instance);
+};
@@ -0,0 +1,117 @@
+#include "GLAsyncLoader.h"
+
+#include <chrono>
+
+static long long NowMicros()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+AsyncLoader::AsyncLoader(unsigned int numThreads) :
+	running(0), quit(false)
+{
+	if (numThreads == 0) {
+		unsigned int cores = std::thread::hardware_concurrency();
+		numThreads = cores > 1 ? cores - 1 : 1;
+	}
+
+	for (unsigned int i = 0; i < numThreads; i++)
+		workers.push_back(std::thread(&AsyncLoader::WorkerMain, this));
+}
+
+AsyncLoader::~AsyncLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+		tasks.clear();
+	}
+	wake.notify_all();
+
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+AsyncLoader &AsyncLoader::Shared()
+{
+	static AsyncLoader loader;
+	return loader;
+}
+
+AsyncLoadHandle AsyncLoader::Load(const Work &work, const UploadStep &upload)
+{
+	Task task;
+	task.handle = std::make_shared<AsyncLoad>();
+	task.work = work;
+	task.upload = upload;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(task);
+	}
+	wake.notify_one();
+
+	return task.handle;
+}
+
+void AsyncLoader::Update(long long budgetMicros)
+{
+	const long long start = NowMicros();
+
+	do {
+		Task task;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (uploads.empty())
+				return;
+			task = uploads.front();
+			uploads.pop_front();
+		}
+
+		if (task.upload()) {
+			task.handle->status = AsyncLoad::READY;
+		}
+		else {
+			// Not finished; keep its place at the front
+			std::lock_guard<std::mutex> lock(mutex);
+			uploads.push_front(task);
+		}
+	} while (NowMicros() - start < budgetMicros);
+}
+
+bool AsyncLoader::IsIdle()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return tasks.empty() && uploads.empty() && running == 0;
+}
+
+void AsyncLoader::WorkerMain()
+{
+	for (;;) {
+		Task task;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return quit || !tasks.empty(); });
+			if (quit)
+				return;
+
+			task = tasks.front();
+			tasks.pop_front();
+			running++;
+		}
+
+		bool ok = task.work();
+
+		std::lock_guard<std::mutex> lock(mutex);
+		running--;
+
+		if (ok) {
+			task.handle->status = AsyncLoad::UPLOADING;
+			uploads.push_back(task);
+		}
+		else {
+			task.handle->status = AsyncLoad::FAILED;
+		}
+	}
+}
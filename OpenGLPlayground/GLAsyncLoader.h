@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Progress of one load started with AsyncLoader::Load
+class AsyncLoad
+{
+public:
+	enum Status
+	{
+		LOADING,	// CPU work queued or running on a worker
+		UPLOADING,	// CPU work done, GL uploads pending on the GL thread
+		READY,
+		FAILED
+	};
+
+	AsyncLoad() : status(LOADING) {}
+
+	Status GetStatus() const { return (Status)status.load(); }
+	bool IsDone() const { Status s = GetStatus(); return s == READY || s == FAILED; }
+	bool IsReady() const { return GetStatus() == READY; }
+
+private:
+	friend class AsyncLoader;
+	std::atomic<int> status;
+};
+
+typedef std::shared_ptr<AsyncLoad> AsyncLoadHandle;
+
+// Runs the CPU part of loads (parsing, conversion, image decoding) on
+// worker threads and hands the GL part back to the GL thread, which drains
+// it in Update under a time budget. GL calls must only be made from the
+// upload steps.
+class AsyncLoader
+{
+public:
+	// Returns true on success; runs on a worker thread
+	typedef std::function<bool()> Work;
+	// Returns true once everything is uploaded; called again on later
+	// Updates until then, so large uploads can be cut into steps
+	typedef std::function<bool()> UploadStep;
+
+	// numThreads == 0 leaves one core for the GL thread
+	explicit AsyncLoader(unsigned int numThreads = 0);
+	~AsyncLoader();
+
+	AsyncLoadHandle Load(const Work &work, const UploadStep &upload);
+
+	// GL thread, once per frame. Runs upload steps until budgetMicros has
+	// passed; at least one step runs so loads always make progress.
+	void Update(long long budgetMicros);
+
+	// True when no load is queued, running or waiting for upload
+	bool IsIdle();
+
+	// Loader shared by the model loaders
+	static AsyncLoader &Shared();
+
+private:
+	struct Task
+	{
+		AsyncLoadHandle handle;
+		Work work;
+		UploadStep upload;
+	};
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::deque<Task> tasks;		// waiting for a worker
+	std::deque<Task> uploads;	// waiting for the GL thread
+	unsigned int running;
+	bool quit;
+
+	AsyncLoader(const AsyncLoader &);
+	AsyncLoader &operator=(const AsyncLoader &);
+
+	void WorkerMain();
+};
@@ -0,0 +1,229 @@
+#include "GLGeometryRegistry.h"
+
+#include <cstdio>
+#include <cstring>
+
+static inline unsigned long long MixWord(unsigned long long k)
+{
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+// Writes the mirror image across X = 0: negated position and normal X,
+// reversed winding. Zeros stay +0 so a mirrored copy hashes the same as
+// geometry that was authored mirrored.
+static void MirrorGeometry(const GeometryLayout &layout, const void *vertices, unsigned int vertexNum,
+	const unsigned int *indices, unsigned int indexNum,
+	std::vector<unsigned char> &mirroredVertices, std::vector<unsigned int> &mirroredIndices)
+{
+	const unsigned char *src = (const unsigned char*)vertices;
+	mirroredVertices.assign(src, src + (size_t)layout.vertexSize * vertexNum);
+
+	for (unsigned int i = 0; i < vertexNum; i++) {
+		unsigned char *vertex = &mirroredVertices[(size_t)i * layout.vertexSize];
+		const int offsets[2] = { layout.positionOffset, layout.normalOffset };
+
+		for (int k = 0; k < 2; k++) {
+			if (offsets[k] < 0)
+				continue;
+
+			float x;
+			memcpy(&x, vertex + offsets[k], sizeof(float));
+			x = (x == 0.0f) ? 0.0f : -x;
+			memcpy(vertex + offsets[k], &x, sizeof(float));
+		}
+	}
+
+	mirroredIndices.assign(indices, indices + indexNum);
+	for (unsigned int i = 0; i + 2 < indexNum; i += 3) {
+		unsigned int swap = mirroredIndices[i + 1];
+		mirroredIndices[i + 1] = mirroredIndices[i + 2];
+		mirroredIndices[i + 2] = swap;
+	}
+}
+
+GeometryRegistry::GeometryRegistry() :
+	nextHandle(INVALID_GEOMETRY + 1), bytesSaved(0), sharedNum(0), mirroredNum(0)
+{
+}
+
+GeometryRegistry::~GeometryRegistry()
+{
+}
+
+GeometryRegistry &GeometryRegistry::Shared()
+{
+	static GeometryRegistry registry;
+	return registry;
+}
+
+unsigned long long GeometryRegistry::Hash(const void *data, size_t bytes, unsigned long long seed)
+{
+	const unsigned char *p = (const unsigned char*)data;
+	unsigned long long h = seed ^ MixWord(bytes + 0x9e3779b97f4a7c15ULL);
+
+	// Eight bytes at a time; the streams are float and int arrays
+	size_t words = bytes / 8;
+	for (size_t i = 0; i < words; i++) {
+		unsigned long long w;
+		memcpy(&w, p + i * 8, 8);
+		h = (h ^ MixWord(w)) * 0x9e3779b97f4a7c15ULL;
+	}
+
+	unsigned long long tail = 0;
+	memcpy(&tail, p + words * 8, bytes - words * 8);
+
+	return MixWord(h ^ MixWord(tail));
+}
+
+unsigned long long GeometryRegistry::HashGeometry(const void *vertices, unsigned int vertexSize, unsigned int vertexNum,
+	const unsigned int *indices, unsigned int indexNum)
+{
+	unsigned long long h = Hash(vertices, (size_t)vertexSize * vertexNum, vertexSize);
+	return Hash(indices, sizeof(unsigned int) * indexNum, h);
+}
+
+GeometryHandle GeometryRegistry::Find(unsigned long long hash, unsigned int vertexSize, unsigned int vertexNum, unsigned int indexNum) const
+{
+	typedef std::multimap<unsigned long long, GeometryHandle>::const_iterator Iterator;
+	std::pair<Iterator, Iterator> range = byHash.equal_range(hash);
+
+	for (Iterator it = range.first; it != range.second; ++it) {
+		const Geometry &geometry = geometries.find(it->second)->second;
+		if (geometry.vertexSize == vertexSize && geometry.vertexNum == vertexNum && geometry.indexNum == indexNum)
+			return it->second;
+	}
+
+	return INVALID_GEOMETRY;
+}
+
+GeometryRef GeometryRegistry::Acquire(const GeometryLayout &layout, const void *vertices, unsigned int vertexNum,
+	const unsigned int *indices, unsigned int indexNum)
+{
+	const size_t bytes = (size_t)layout.vertexSize * vertexNum + sizeof(unsigned int) * indexNum;
+	const unsigned long long hash = HashGeometry(vertices, layout.vertexSize, vertexNum, indices, indexNum);
+
+	// Hash the mirror image outside the lock too, in case there is no exact match
+	unsigned long long mirroredHash = 0;
+	const bool canMirror = layout.positionOffset >= 0;
+
+	GeometryRef ref;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		ref.handle = Find(hash, layout.vertexSize, vertexNum, indexNum);
+	}
+
+	if (ref.handle == INVALID_GEOMETRY && canMirror) {
+		std::vector<unsigned char> mirroredVertices;
+		std::vector<unsigned int> mirroredIndices;
+		MirrorGeometry(layout, vertices, vertexNum, indices, indexNum, mirroredVertices, mirroredIndices);
+		mirroredHash = HashGeometry(mirroredVertices.empty() ? NULL : &mirroredVertices[0], layout.vertexSize, vertexNum,
+			mirroredIndices.empty() ? NULL : &mirroredIndices[0], indexNum);
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Another thread may have registered it in the meantime
+	ref.handle = Find(hash, layout.vertexSize, vertexNum, indexNum);
+	if (ref.handle == INVALID_GEOMETRY && canMirror) {
+		ref.handle = Find(mirroredHash, layout.vertexSize, vertexNum, indexNum);
+		ref.mirrored = ref.handle != INVALID_GEOMETRY;
+	}
+
+	if (ref.handle != INVALID_GEOMETRY) {
+		geometries[ref.handle].refs++;
+		bytesSaved += bytes;
+		sharedNum++;
+		if (ref.mirrored)
+			mirroredNum++;
+		return ref;
+	}
+
+	ref.handle = nextHandle++;
+	ref.created = true;
+
+	Geometry &geometry = geometries[ref.handle];
+	geometry.hash = hash;
+	geometry.vertexSize = layout.vertexSize;
+	geometry.vertexNum = vertexNum;
+	geometry.indexNum = indexNum;
+	geometry.refs = 1;
+	geometry.buffers.vertexBuffer = 0;
+	geometry.buffers.indexBuffer = 0;
+
+	const unsigned char *src = (const unsigned char*)vertices;
+	geometry.vertexData.assign(src, src + (size_t)layout.vertexSize * vertexNum);
+	geometry.indexData.assign(indices, indices + indexNum);
+
+	byHash.insert(std::make_pair(hash, ref.handle));
+
+	return ref;
+}
+
+GeometryBuffers GeometryRegistry::Upload(GeometryHandle handle)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	Geometry &geometry = geometries[handle];
+
+	if (geometry.buffers.vertexBuffer == 0) {
+		glGenBuffers(1, &geometry.buffers.vertexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, geometry.buffers.vertexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, geometry.vertexData.size(),
+			geometry.vertexData.empty() ? NULL : &geometry.vertexData[0], GL_STATIC_DRAW);
+
+		glGenBuffers(1, &geometry.buffers.indexBuffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, geometry.buffers.indexBuffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * geometry.indexData.size(),
+			geometry.indexData.empty() ? NULL : &geometry.indexData[0], GL_STATIC_DRAW);
+
+		std::vector<unsigned char>().swap(geometry.vertexData);
+		std::vector<unsigned int>().swap(geometry.indexData);
+	}
+
+	return geometry.buffers;
+}
+
+void GeometryRegistry::Release(GeometryHandle handle)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::map<GeometryHandle, Geometry>::iterator it = geometries.find(handle);
+	if (it == geometries.end() || --it->second.refs > 0)
+		return;
+
+	Geometry &geometry = it->second;
+	if (geometry.buffers.vertexBuffer != 0)
+		glDeleteBuffers(1, &geometry.buffers.vertexBuffer);
+	if (geometry.buffers.indexBuffer != 0)
+		glDeleteBuffers(1, &geometry.buffers.indexBuffer);
+
+	typedef std::multimap<unsigned long long, GeometryHandle>::iterator Iterator;
+	std::pair<Iterator, Iterator> range = byHash.equal_range(geometry.hash);
+	for (Iterator hashIt = range.first; hashIt != range.second; ++hashIt) {
+		if (hashIt->second == handle) {
+			byHash.erase(hashIt);
+			break;
+		}
+	}
+
+	geometries.erase(it);
+}
+
+size_t GeometryRegistry::BytesSaved() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return bytesSaved;
+}
+
+void GeometryRegistry::PrintStats() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	printf("Geometry registry: %u unique, %u shared (%u mirrored), %u KB saved\n",
+		(unsigned int)geometries.size(), sharedNum, mirroredNum, (unsigned int)(bytesSaved / 1024));
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <GL/glew.h>
+
+typedef unsigned int GeometryHandle;
+
+#define INVALID_GEOMETRY 0
+
+// Vertex layout as far as the registry needs it. Mirror detection needs the
+// float3 position and normal offsets; pass -1 to only match exact copies.
+struct GeometryLayout
+{
+	unsigned int vertexSize;
+	int positionOffset;
+	int normalOffset;
+};
+
+struct GeometryRef
+{
+	GeometryHandle handle;
+	// The registered geometry is the mirror image of the one passed in,
+	// across X = 0: draw it scaled by (-1, 1, 1) with the front face flipped
+	bool mirrored;
+	// False when an earlier load already registered it
+	bool created;
+
+	GeometryRef() : handle(INVALID_GEOMETRY), mirrored(false), created(false) {}
+};
+
+struct GeometryBuffers
+{
+	GLuint vertexBuffer;
+	GLuint indexBuffer;
+};
+
+// Vertex and index buffers shared by every loaded mesh with the same
+// content. Geometry is keyed by a 64-bit hash of its streams, so identical
+// submeshes of different models are uploaded once and referenced by handle.
+class GeometryRegistry
+{
+public:
+	GeometryRegistry();
+	~GeometryRegistry();
+
+	// Any thread. Takes a reference to identical geometry, or to its mirror
+	// image, if it is registered already. Otherwise copies the streams and
+	// registers them under a new handle; Upload creates the buffers later.
+	GeometryRef Acquire(const GeometryLayout &layout, const void *vertices, unsigned int vertexNum,
+		const unsigned int *indices, unsigned int indexNum);
+
+	// GL thread. Creates the buffers on the first call for a handle
+	GeometryBuffers Upload(GeometryHandle handle);
+
+	// GL thread. The buffers are deleted with the last reference.
+	void Release(GeometryHandle handle);
+
+	// Bytes that were not uploaded again because the geometry was shared
+	size_t BytesSaved() const;
+	void PrintStats() const;
+
+	// Registry shared by the model loaders
+	static GeometryRegistry &Shared();
+
+	static unsigned long long Hash(const void *data, size_t bytes, unsigned long long seed = 0);
+	static unsigned long long HashGeometry(const void *vertices, unsigned int vertexSize, unsigned int vertexNum,
+		const unsigned int *indices, unsigned int indexNum);
+
+private:
+	struct Geometry
+	{
+		unsigned long long hash;
+		unsigned int vertexSize;
+		unsigned int vertexNum;
+		unsigned int indexNum;
+		unsigned int refs;
+		GeometryBuffers buffers;
+
+		// Until Upload
+		std::vector<unsigned char> vertexData;
+		std::vector<unsigned int> indexData;
+	};
+
+	mutable std::mutex mutex;
+	std::map<GeometryHandle, Geometry> geometries;
+	std::multimap<unsigned long long, GeometryHandle> byHash;
+	GeometryHandle nextHandle;
+
+	size_t bytesSaved;
+	unsigned int sharedNum;
+	unsigned int mirroredNum;
+
+	GeometryRegistry(const GeometryRegistry &);
+	GeometryRegistry &operator=(const GeometryRegistry &);
+
+	GeometryHandle Find(unsigned long long hash, unsigned int vertexSize, unsigned int vertexNum, unsigned int indexNum) const;
+};
@@ -17,43 +17,37 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include "GLMesh.h"
+#include "GLMeshCache.h"
+#include "GLMeshOptimizer.h"
+#include "GLMeshSimplifier.h"
+#include "GLThreadPool.h"
+#include "GLVertexStream.h"
 
-GLMesh::MeshEntry::MeshEntry()
-{
-	VB = INVALID_OGL_VALUE;
-	IB = INVALID_OGL_VALUE;
-	NumIndices = 0;
-	MaterialIndex = INVALID_MATERIAL;
-};
+#include <cfloat>
 
-GLMesh::MeshEntry::~MeshEntry()
-{
-	if (VB != INVALID_OGL_VALUE)
-	{
-		glDeleteBuffers(1, &VB);
-	}
+// Entries smaller than this keep full detail only
+#define MIN_LOD_INDICES (3 * 128)
 
-	if (IB != INVALID_OGL_VALUE)
-	{
-		glDeleteBuffers(1, &IB);
-	}
-}
+// An entry is drawn at full detail while its bounding sphere spans at least
+// this fraction of the viewport height, and one level coarser every time
+// that size halves
+#define LOD_SCREEN_FRACTION 0.25f
 
-void GLMesh::MeshEntry::Init(const std::vector<Vertex>& Vertices,
-	const std::vector<unsigned int>& Indices)
-{
-	NumIndices = Indices.size();
+#define ASSIMP_LOAD_FLAGS (aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs)
 
-	glGenBuffers(1, &VB);
-	glBindBuffer(GL_ARRAY_BUFFER, VB);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * Vertices.size(), &Vertices[0], GL_STATIC_DRAW);
+static const MeshCacheFormat CacheFormat = { "glmesh", ASSIMP_LOAD_FLAGS, MESH_CACHE_OPTIMIZED | MESH_CACHE_LODS };
 
-	glGenBuffers(1, &IB);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, IB);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * NumIndices, &Indices[0], GL_STATIC_DRAW);
-}
+GLMesh::MeshEntry::MeshEntry()
+{
+	BaseVertex = 0;
+	MaterialIndex = INVALID_MATERIAL;
+	NumLods = 0;
+	BoundRadius = 0.0f;
+};
 
-GLMesh::GLMesh()
+GLMesh::GLMesh() :
+	m_VAO(0),
+	m_Arena(sizeof(Vertex))
 {
 }
 
@@ -69,6 +63,13 @@ void GLMesh::Clear()
 	for (unsigned int i = 0; i < m_Textures.size(); i++) {
 		SAFE_DELETE(m_Textures[i]);
 	}
+
+	m_Arena.Clear();
+
+	if (m_VAO != 0) {
+		glDeleteVertexArrays(1, &m_VAO);
+		m_VAO = 0;
+	}
 }
 
 
@@ -78,9 +79,17 @@ bool GLMesh::LoadMesh(const std::string& Filename)
 	Clear();
 
 	bool Ret = false;
+
+	// Use the baked cache when it is up to date - no Assimp import needed
+	MeshCache Cache;
+
+	if (Cache.Open(Filename, CacheFormat)) {
+		return InitFromCache(Cache);
+	}
+
 	Assimp::Importer Importer;
 
-	const aiScene* pScene = Importer.ReadFile(Filename.c_str(), aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs);
+	const aiScene* pScene = Importer.ReadFile(Filename.c_str(), ASSIMP_LOAD_FLAGS);
 
 	if (pScene) {
 		Ret = InitFromScene(pScene, Filename);
@@ -94,39 +103,128 @@ bool GLMesh::LoadMesh(const std::string& Filename)
 
 bool GLMesh::InitFromScene(const aiScene* pScene, const std::string& Filename)
 {
-	m_Entries.resize(pScene->mNumMeshes);
-	m_Textures.resize(pScene->mNumMaterials);
+	std::vector<Vector3f> Positions;
+	std::vector<Vector3f> Normals;
+	std::vector<Vector2f> TexCoords;
+	std::vector<unsigned int> Indices;
+	std::vector<MeshCacheEntry> Entries(pScene->mNumMeshes);
 
-	// Initialize the meshes in the scene one by one
-	for (unsigned int i = 0; i < m_Entries.size(); i++) {
-		const aiMesh* paiMesh = pScene->mMeshes[i];
-		InitMesh(i, paiMesh);
+	unsigned int NumVertices = 0;
+	unsigned int NumIndices = 0;
+
+	for (unsigned int i = 0; i < pScene->mNumMeshes; i++) {
+		Entries[i].baseVertex = NumVertices;
+		Entries[i].numVertices = pScene->mMeshes[i]->mNumVertices;
+		Entries[i].baseIndex = NumIndices;
+		Entries[i].numIndices = pScene->mMeshes[i]->mNumFaces * 3;
+		Entries[i].materialIndex = pScene->mMeshes[i]->mMaterialIndex;
+
+		NumVertices += Entries[i].numVertices;
+		NumIndices += Entries[i].numIndices;
 	}
 
-	return InitMaterials(pScene, Filename);
+	Positions.reserve(NumVertices);
+	Normals.reserve(NumVertices);
+	TexCoords.reserve(NumVertices);
+	Indices.reserve(NumIndices);
+
+	// Convert the meshes in the scene one by one into the merged arrays
+	for (unsigned int i = 0; i < pScene->mNumMeshes; i++) {
+		InitMesh(pScene->mMeshes[i], Positions, Normals, TexCoords, Indices);
+	}
+
+	// Reorder each submesh for the post-transform cache before it is baked
+	VertexCacheStats Before, After;
+	std::vector<unsigned int> Remap;
+
+	for (unsigned int i = 0; i < Entries.size(); i++) {
+		const MeshCacheEntry& Entry = Entries[i];
+		VertexCacheStats MeshBefore, MeshAfter;
+
+		// Nothing to reorder, and its baseIndex may be one past the end
+		if (Entry.numIndices == 0) {
+			continue;
+		}
+
+		MeshOptimizer::Optimize(&Indices[Entry.baseIndex], Entry.numIndices, Entry.numVertices, Remap, &MeshBefore, &MeshAfter);
+		MeshOptimizer::RemapVertices(&Positions[Entry.baseVertex], Entry.numVertices, Remap);
+		MeshOptimizer::RemapVertices(&Normals[Entry.baseVertex], Entry.numVertices, Remap);
+		MeshOptimizer::RemapVertices(&TexCoords[Entry.baseVertex], Entry.numVertices, Remap);
+
+		Before += MeshBefore;
+		After += MeshAfter;
+	}
+
+	MeshOptimizer::PrintStats(Filename.c_str(), Before, After);
+
+	BuildLods(Positions, Indices, Entries);
+
+	std::vector<std::string> TexturePaths;
+	GetTexturePaths(pScene, Filename, TexturePaths);
+
+	MeshCacheData Data;
+	Data.positions = &Positions[0].x;
+	Data.normals = &Normals[0].x;
+	Data.texcoords = &TexCoords[0].x;
+	Data.indices = &Indices[0];
+	Data.numVertices = NumVertices;
+	Data.numIndices = Indices.size();
+	Data.entries = &Entries[0];
+	Data.numEntries = Entries.size();
+	Data.texturePaths = &TexturePaths;
+	MeshCache::Write(Filename, CacheFormat, Data);
+
+	InitEntries(Data);
+
+	return InitMaterials(TexturePaths);
 }
 
-void GLMesh::InitMesh(unsigned int Index, const aiMesh* paiMesh)
+bool GLMesh::InitFromCache(const MeshCache& Cache)
 {
-	m_Entries[Index].MaterialIndex = paiMesh->mMaterialIndex;
+	std::vector<std::string> TexturePaths(Cache.NumMaterials());
 
-	std::vector<Vertex> Vertices;
-	std::vector<unsigned int> Indices;
+	for (unsigned int i = 0; i < TexturePaths.size(); i++) {
+		TexturePaths[i] = Cache.TexturePath(i);
+	}
 
-	const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
+	MeshCacheData Data;
+	Data.positions = Cache.Positions();
+	Data.normals = Cache.Normals();
+	Data.texcoords = Cache.TexCoords();
+	Data.indices = Cache.Indices();
+	Data.numVertices = Cache.NumVertices();
+	Data.numIndices = Cache.NumIndices();
+	Data.entries = Cache.Entries();
+	Data.numEntries = Cache.NumEntries();
 
-	for (unsigned int i = 0; i < paiMesh->mNumVertices; i++) {
-		const aiVector3D* pPos = &(paiMesh->mVertices[i]);
-		const aiVector3D* pNormal = &(paiMesh->mNormals[i]);
-		const aiVector3D* pTexCoord = paiMesh->HasTextureCoords(0) ? &(paiMesh->mTextureCoords[0][i]) : &Zero3D;
+	InitEntries(Data);
 
-		Vertex v(Vector3f(pPos->x, pPos->y, pPos->z),
-			Vector2f(pTexCoord->x, pTexCoord->y),
-			Vector3f(pNormal->x, pNormal->y, pNormal->z));
+	return InitMaterials(TexturePaths);
+}
+
+void GLMesh::InitMesh(const aiMesh* paiMesh,
+	std::vector<Vector3f>& Positions,
+	std::vector<Vector3f>& Normals,
+	std::vector<Vector2f>& TexCoords,
+	std::vector<unsigned int>& Indices)
+{
+	const unsigned int baseVertex = Positions.size();
+	const unsigned int vertexNum = paiMesh->mNumVertices;
 
-		Vertices.push_back(v);
+	Positions.resize(baseVertex + vertexNum);
+	Normals.resize(baseVertex + vertexNum);
+	TexCoords.resize(baseVertex + vertexNum);
+
+	// Faces index the vertices, so there are none either
+	if (vertexNum == 0) {
+		return;
 	}
 
+	VertexStream::Copy3(&paiMesh->mVertices[0].x, vertexNum, &Positions[baseVertex].x, sizeof(Vector3f));
+	VertexStream::Copy3(&paiMesh->mNormals[0].x, vertexNum, &Normals[baseVertex].x, sizeof(Vector3f));
+	VertexStream::Copy3To2(paiMesh->HasTextureCoords(0) ? &paiMesh->mTextureCoords[0][0].x : 0, vertexNum,
+		&TexCoords[baseVertex].x, sizeof(Vector2f));
+
 	for (unsigned int i = 0; i < paiMesh->mNumFaces; i++) {
 		const aiFace& Face = paiMesh->mFaces[i];
 		assert(Face.mNumIndices == 3);
@@ -134,11 +232,139 @@ void GLMesh::InitMesh(unsigned int Index, const aiMesh* paiMesh)
 		Indices.push_back(Face.mIndices[1]);
 		Indices.push_back(Face.mIndices[2]);
 	}
+}
+
+void GLMesh::BuildLods(const std::vector<Vector3f>& Positions, std::vector<unsigned int>& Indices,
+	std::vector<MeshCacheEntry>& Entries)
+{
+	std::vector<std::vector<unsigned int> > Lods(Entries.size() * MESH_CACHE_MAX_LODS);
+	std::vector<float> Errors(Entries.size() * MESH_CACHE_MAX_LODS);
+
+	long long StartTime = GetCurrentTimeMicros();
+
+	ThreadPool::Shared().ParallelFor(Entries.size(), [&](unsigned int i)
+	{
+		MeshCacheEntry& Entry = Entries[i];
+		std::vector<unsigned int>* pLods = &Lods[i * MESH_CACHE_MAX_LODS];
+
+		if (Entry.numIndices == 0) {
+			Entry.numLods = 0;
+			return;
+		}
+
+		Entry.numLods = MeshSimplifier::BuildLodChain(&Positions[Entry.baseVertex].x, Entry.numVertices,
+			&Indices[Entry.baseIndex], Entry.numIndices, MIN_LOD_INDICES,
+			MESH_CACHE_MAX_LODS, pLods, &Errors[i * MESH_CACHE_MAX_LODS]);
+
+		for (unsigned int j = 0; j < Entry.numLods; j++) {
+			MeshOptimizer::OptimizeVertexCache(&pLods[j][0], pLods[j].size(), Entry.numVertices);
+		}
+	});
+
+	// The simplified ranges go behind all full detail indices, in entry order
+	const unsigned int FullIndices = Indices.size();
+
+	for (unsigned int i = 0; i < Entries.size(); i++) {
+		MeshCacheEntry& Entry = Entries[i];
+
+		for (unsigned int j = 0; j < Entry.numLods; j++) {
+			const std::vector<unsigned int>& Lod = Lods[i * MESH_CACHE_MAX_LODS + j];
+
+			Entry.lodBaseIndex[j] = Indices.size();
+			Entry.lodNumIndices[j] = Lod.size();
+			Entry.lodError[j] = Errors[i * MESH_CACHE_MAX_LODS + j];
+
+			Indices.insert(Indices.end(), Lod.begin(), Lod.end());
+		}
+	}
+
+	printf("Built LODs: %u indices on top of %u full detail (%.1f ms)\n",
+		(unsigned int)Indices.size() - FullIndices, FullIndices, (GetCurrentTimeMicros() - StartTime) / 1000.0);
+}
+
+void GLMesh::InitEntries(const MeshCacheData& Data)
+{
+	m_Entries.resize(Data.numEntries);
+
+	std::vector<Vertex> Vertices;
+
+	// Interleave each entry's slice of the merged arrays into the arena
+	for (unsigned int i = 0; i < Data.numEntries; i++) {
+		const MeshCacheEntry& Entry = Data.entries[i];
+
+		Vertices.resize(Entry.numVertices);
+
+		for (unsigned int j = 0; j < Entry.numVertices; j++) {
+			const unsigned int v = Entry.baseVertex + j;
+			const float* pPos = &Data.positions[v * 3];
+			const float* pTexCoord = &Data.texcoords[v * 2];
+			const float* pNormal = &Data.normals[v * 3];
+
+			Vertices[j] = Vertex(Vector3f(pPos[0], pPos[1], pPos[2]),
+				Vector2f(pTexCoord[0], pTexCoord[1]),
+				Vector3f(pNormal[0], pNormal[1], pNormal[2]));
+		}
+
+		MeshArenaRange Range = m_Arena.Add(&Vertices[0], Entry.numVertices, Data.indices + Entry.baseIndex, Entry.numIndices);
+
+		MeshEntry& Dest = m_Entries[i];
+		Dest.BaseVertex = Range.baseVertex;
+		Dest.MaterialIndex = Entry.materialIndex;
+		Dest.NumLods = 1;
+		Dest.Lods[0].NumIndices = Range.indexNum;
+		Dest.Lods[0].IndexOffset = Range.indexOffset;
+		Dest.Lods[0].IndexType = Range.indexType;
+
+		// Simplified levels index the same vertices
+		for (unsigned int j = 0; j < Entry.numLods && Dest.NumLods < MAX_MESH_LODS; j++) {
+			Range = m_Arena.AddIndices(Dest.BaseVertex, Data.indices + Entry.lodBaseIndex[j], Entry.lodNumIndices[j]);
+
+			MeshLod& Lod = Dest.Lods[Dest.NumLods++];
+			Lod.NumIndices = Range.indexNum;
+			Lod.IndexOffset = Range.indexOffset;
+			Lod.IndexType = Range.indexType;
+		}
+
+		// Sphere around the bounding box of the entry
+		Vector3f Min(FLT_MAX, FLT_MAX, FLT_MAX);
+		Vector3f Max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+		for (unsigned int j = 0; j < Entry.numVertices; j++) {
+			const Vector3f& Pos = Vertices[j].m_pos;
+			Min = Vector3f(fminf(Min.x, Pos.x), fminf(Min.y, Pos.y), fminf(Min.z, Pos.z));
+			Max = Vector3f(fmaxf(Max.x, Pos.x), fmaxf(Max.y, Pos.y), fmaxf(Max.z, Pos.z));
+		}
+
+		Dest.BoundCenter = Entry.numVertices ? (Min + Max) * 0.5f : Vector3f(0.0f, 0.0f, 0.0f);
+		Dest.BoundRadius = 0.0f;
+
+		for (unsigned int j = 0; j < Entry.numVertices; j++) {
+			Vector3f d = Vertices[j].m_pos - Dest.BoundCenter;
+			Dest.BoundRadius = fmaxf(Dest.BoundRadius, sqrtf(d.x * d.x + d.y * d.y + d.z * d.z));
+		}
+	}
+
+	// The vertex layout is recorded once in the VAO instead of on every draw
+	glGenVertexArrays(1, &m_VAO);
+	glBindVertexArray(m_VAO);
+
+	m_Arena.Upload();
+
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)12);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)20);
 
-	m_Entries[Index].Init(Vertices, Indices);
+	// Enabled by Render only for entries with a texture
+	glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (const GLvoid*)12);
+
+	// Make sure the VAO is not changed from the outside
+	glBindVertexArray(0);
 }
 
-bool GLMesh::InitMaterials(const aiScene* pScene, const std::string& Filename)
+void GLMesh::GetTexturePaths(const aiScene* pScene, const std::string& Filename, std::vector<std::string>& TexturePaths)
 {
 	// Extract the directory part from the file name
 	std::string::size_type SlashIndex = Filename.find_last_of("/");
@@ -154,30 +380,43 @@ bool GLMesh::InitMaterials(const aiScene* pScene, const std::string& Filename)
 		Dir = Filename.substr(0, SlashIndex);
 	}
 
-	bool Ret = true;
+	TexturePaths.resize(pScene->mNumMaterials);
 
-	// Initialize the materials
 	for (unsigned int i = 0; i < pScene->mNumMaterials; i++) {
 		const aiMaterial* pMaterial = pScene->mMaterials[i];
 
-		m_Textures[i] = NULL;
-
 		if (pMaterial->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
 			aiString Path;
 
 			if (pMaterial->GetTexture(aiTextureType_DIFFUSE, 0, &Path, NULL, NULL, NULL, NULL, NULL) == AI_SUCCESS) {
-				std::string FullPath = Dir + "/" + Path.data;
-				m_Textures[i] = new Texture(GL_TEXTURE_2D, FullPath.c_str());
-
-				if (!m_Textures[i]->Load()) {
-					printf("Error loading texture '%s'\n", FullPath.c_str());
-					delete m_Textures[i];
-					m_Textures[i] = NULL;
-					Ret = false;
-				}
-				else {
-					printf("Loaded texture '%s'\n", FullPath.c_str());
-				}
+				TexturePaths[i] = Dir + "/" + Path.data;
+			}
+		}
+	}
+}
+
+bool GLMesh::InitMaterials(const std::vector<std::string>& TexturePaths)
+{
+	m_Textures.resize(TexturePaths.size());
+
+	bool Ret = true;
+
+	// Initialize the materials
+	for (unsigned int i = 0; i < TexturePaths.size(); i++) {
+		m_Textures[i] = NULL;
+
+		if (!TexturePaths[i].empty()) {
+			const std::string& FullPath = TexturePaths[i];
+			m_Textures[i] = new Texture(GL_TEXTURE_2D, FullPath.c_str());
+
+			if (!m_Textures[i]->Load()) {
+				printf("Error loading texture '%s'\n", FullPath.c_str());
+				delete m_Textures[i];
+				m_Textures[i] = NULL;
+				Ret = false;
+			}
+			else {
+				printf("Loaded texture '%s'\n", FullPath.c_str());
 			}
 		}
 
@@ -194,31 +433,94 @@ bool GLMesh::InitMaterials(const aiScene* pScene, const std::string& Filename)
 
 void GLMesh::Render()
 {
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
+	glBindVertexArray(m_VAO);
 
 	for (unsigned int i = 0; i < m_Entries.size(); i++) {
-		glBindBuffer(GL_ARRAY_BUFFER, m_Entries[i].VB);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)12);
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)20);
+		const unsigned int MaterialIndex = m_Entries[i].MaterialIndex;
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Entries[i].IB);
+		if (MaterialIndex < m_Textures.size() && m_Textures[MaterialIndex]) {
+			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+			m_Textures[MaterialIndex]->Bind(GL_TEXTURE0);
+		}
+
+		const MeshLod& Lod = m_Entries[i].Lods[0];
+
+		glDrawElementsBaseVertex(GL_TRIANGLES,
+			Lod.NumIndices,
+			Lod.IndexType,
+			(void*)(size_t)Lod.IndexOffset,
+			m_Entries[i].BaseVertex);
+		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	}
+
+	// Make sure the VAO is not changed from the outside
+	glBindVertexArray(0);
+}
+
+void GLMesh::Render(Pipeline& p)
+{
+	const Matrix4f& WV = p.GetWVTrans();
 
+	// The camera rotation keeps lengths, so the longest basis vector of the
+	// world-view matrix is the largest world scale
+	float ViewScale = 0.0f;
+
+	for (unsigned int i = 0; i < 3; i++) {
+		ViewScale = fmaxf(ViewScale, sqrtf(WV.m[0][i] * WV.m[0][i] + WV.m[1][i] * WV.m[1][i] + WV.m[2][i] * WV.m[2][i]));
+	}
+
+	// Converts radius / distance into a fraction of the viewport height
+	const float ProjScale = 1.0f / tanf(ToRadian(p.GetPerspectiveProj().FOV / 2.0f));
+
+	glBindVertexArray(m_VAO);
+
+	for (unsigned int i = 0; i < m_Entries.size(); i++) {
 		const unsigned int MaterialIndex = m_Entries[i].MaterialIndex;
 
 		if (MaterialIndex < m_Textures.size() && m_Textures[MaterialIndex]) {
 			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-			glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (const GLvoid*)12);
 			m_Textures[MaterialIndex]->Bind(GL_TEXTURE0);
 		}
 
-		glDrawElements(GL_TRIANGLES, m_Entries[i].NumIndices, GL_UNSIGNED_INT, 0);
+		const MeshLod& Lod = m_Entries[i].Lods[SelectLod(m_Entries[i], WV, ViewScale, ProjScale)];
+
+		glDrawElementsBaseVertex(GL_TRIANGLES,
+			Lod.NumIndices,
+			Lod.IndexType,
+			(void*)(size_t)Lod.IndexOffset,
+			m_Entries[i].BaseVertex);
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 	}
 
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(2);
+	// Make sure the VAO is not changed from the outside
+	glBindVertexArray(0);
+}
+
+unsigned int GLMesh::SelectLod(const MeshEntry& Entry, const Matrix4f& WV, float ViewScale, float ProjScale) const
+{
+	const Vector3f& c = Entry.BoundCenter;
+	const float x = WV.m[0][0] * c.x + WV.m[0][1] * c.y + WV.m[0][2] * c.z + WV.m[0][3];
+	const float y = WV.m[1][0] * c.x + WV.m[1][1] * c.y + WV.m[1][2] * c.z + WV.m[1][3];
+	const float z = WV.m[2][0] * c.x + WV.m[2][1] * c.y + WV.m[2][2] * c.z + WV.m[2][3];
+
+	const float Radius = Entry.BoundRadius * ViewScale;
+	const float Distance = sqrtf(x * x + y * y + z * z);
+
+	// Camera inside the sphere
+	if (Distance <= Radius) {
+		return 0;
+	}
+
+	// Projected diameter over viewport height
+	const float ScreenSize = Radius / Distance * ProjScale;
+
+	unsigned int Lod = 0;
+	float Threshold = LOD_SCREEN_FRACTION;
+
+	while (Lod + 1 < Entry.NumLods && ScreenSize < Threshold) {
+		Lod++;
+		Threshold *= 0.5f;
+	}
+
+	return Lod;
 }
@@ -29,6 +29,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "ogldev_util.h"
 #include "ogldev_math_3d.h"
 #include "ogldev_texture.h"
+#include "ogldev_pipeline.h"
+#include "GLMeshArena.h"
+
+class MeshCache;
+struct MeshCacheData;
+struct MeshCacheEntry;
 
 struct Vertex
 {
@@ -58,28 +64,53 @@ public:
 
 	void Render();
 
+	// Draws every entry at the level of detail that matches its size on
+	// screen, as seen through 'p' (world, camera and projection)
+	void Render(Pipeline& p);
+
 private:
 	bool InitFromScene(const aiScene* pScene, const std::string& Filename);
-	void InitMesh(unsigned int Index, const aiMesh* paiMesh);
-	bool InitMaterials(const aiScene* pScene, const std::string& Filename);
+	bool InitFromCache(const MeshCache& Cache);
+	void InitMesh(const aiMesh* paiMesh,
+		std::vector<Vector3f>& Positions,
+		std::vector<Vector3f>& Normals,
+		std::vector<Vector2f>& TexCoords,
+		std::vector<unsigned int>& Indices);
+	void BuildLods(const std::vector<Vector3f>& Positions, std::vector<unsigned int>& Indices,
+		std::vector<MeshCacheEntry>& Entries);
+	void InitEntries(const MeshCacheData& Data);
+	void GetTexturePaths(const aiScene* pScene, const std::string& Filename, std::vector<std::string>& TexturePaths);
+	bool InitMaterials(const std::vector<std::string>& TexturePaths);
 	void Clear();
 
 #define INVALID_MATERIAL 0xFFFFFFFF
+#define MAX_MESH_LODS 4		// full detail + MESH_CACHE_MAX_LODS simplified
+
+	// One index range in the arena; every LOD shares the entry's vertices
+	struct MeshLod {
+		unsigned int NumIndices;
+		unsigned int IndexOffset;
+		GLenum IndexType;
+	};
 
 	struct MeshEntry {
 		MeshEntry();
 
-		~MeshEntry();
-
-		void Init(const std::vector<Vertex>& Vertices,
-			const std::vector<unsigned int>& Indices);
-
-		GLuint VB;
-		GLuint IB;
-		unsigned int NumIndices;
+		unsigned int BaseVertex;
 		unsigned int MaterialIndex;
+		unsigned int NumLods;
+		MeshLod Lods[MAX_MESH_LODS];	// Lods[0] is full detail
+
+		// Model space bounding sphere, for LOD selection
+		Vector3f BoundCenter;
+		float BoundRadius;
 	};
 
+	unsigned int SelectLod(const MeshEntry& Entry, const Matrix4f& WV, float ViewScale, float ProjScale) const;
+
+	// All entries live in one arena and are drawn from one VAO
+	GLuint m_VAO;
+	MeshArena m_Arena;
 	std::vector<MeshEntry> m_Entries;
 	std::vector<Texture*> m_Textures;
 };
@@ -0,0 +1,77 @@
+#include "GLMeshArena.h"
+#include "GLMeshPacking.h"
+
+#include <cstring>
+
+MeshArena::MeshArena(unsigned int vertexSize) :
+	vertexSize(vertexSize), vertexNum(0), vertexBufferObj(0), indexBufferObj(0)
+{
+}
+
+MeshArena::~MeshArena()
+{
+	Clear();
+}
+
+MeshArenaRange MeshArena::Add(const void *vertices, unsigned int vertexNum, const unsigned int *indices, unsigned int indexNum)
+{
+	MeshArenaRange range;
+	range.baseVertex = this->vertexNum;
+	range.indexNum = indexNum;
+
+	size_t offset = vertexData.size();
+	vertexData.resize(offset + (size_t)vertexSize * vertexNum);
+	if (vertexNum > 0)
+		memcpy(&vertexData[offset], vertices, (size_t)vertexSize * vertexNum);
+	this->vertexNum += vertexNum;
+
+	PackedIndexRange indexRange = MeshPacking::AppendIndices(indexData, indices, indexNum);
+	range.indexOffset = indexRange.offset;
+	range.indexType = indexRange.type;
+
+	return range;
+}
+
+MeshArenaRange MeshArena::AddIndices(unsigned int baseVertex, const unsigned int *indices, unsigned int indexNum)
+{
+	MeshArenaRange range;
+	range.baseVertex = baseVertex;
+	range.indexNum = indexNum;
+
+	PackedIndexRange indexRange = MeshPacking::AppendIndices(indexData, indices, indexNum);
+	range.indexOffset = indexRange.offset;
+	range.indexType = indexRange.type;
+
+	return range;
+}
+
+void MeshArena::Upload()
+{
+	if (vertexBufferObj == 0)
+		glGenBuffers(1, &vertexBufferObj);
+	if (indexBufferObj == 0)
+		glGenBuffers(1, &indexBufferObj);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObj);
+	glBufferData(GL_ARRAY_BUFFER, vertexData.size(), vertexData.empty() ? NULL : &vertexData[0], GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferObj);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexData.size(), indexData.empty() ? NULL : &indexData[0], GL_STATIC_DRAW);
+
+	std::vector<unsigned char>().swap(vertexData);
+	std::vector<unsigned char>().swap(indexData);
+}
+
+void MeshArena::Clear()
+{
+	if (vertexBufferObj != 0)
+		glDeleteBuffers(1, &vertexBufferObj);
+	if (indexBufferObj != 0)
+		glDeleteBuffers(1, &indexBufferObj);
+
+	vertexBufferObj = 0;
+	indexBufferObj = 0;
+	vertexNum = 0;
+	vertexData.clear();
+	indexData.clear();
+}
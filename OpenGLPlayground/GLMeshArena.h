@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <GL/glew.h>
+
+// Where one submesh landed in a MeshArena
+struct MeshArenaRange
+{
+	unsigned int baseVertex;
+	unsigned int indexOffset;	// bytes
+	GLenum indexType;
+	unsigned int indexNum;
+};
+
+// One vertex buffer and one index buffer shared by all submeshes of a
+// model. Submeshes are appended on the CPU side and uploaded together, then
+// drawn with glDrawElementsBaseVertex from a single VAO.
+class MeshArena
+{
+public:
+	explicit MeshArena(unsigned int vertexSize);
+	~MeshArena();
+
+	// Indices are relative to the submesh's first vertex
+	MeshArenaRange Add(const void *vertices, unsigned int vertexNum, const unsigned int *indices, unsigned int indexNum);
+
+	// Another index range over the vertices of an earlier Add, such as a
+	// simplified LOD. 'baseVertex' is the one that Add returned.
+	MeshArenaRange AddIndices(unsigned int baseVertex, const unsigned int *indices, unsigned int indexNum);
+
+	// Creates the buffer objects and leaves both bound, so calling this with
+	// a VAO bound records the index buffer in it. Frees the CPU copies.
+	void Upload();
+
+	void Clear();
+
+	GLuint VertexBuffer() const { return vertexBufferObj; }
+	GLuint IndexBuffer() const { return indexBufferObj; }
+	unsigned int VertexSize() const { return vertexSize; }
+
+private:
+	unsigned int vertexSize;
+	unsigned int vertexNum;
+	std::vector<unsigned char> vertexData;
+	std::vector<unsigned char> indexData;
+	GLuint vertexBufferObj;
+	GLuint indexBufferObj;
+
+	MeshArena(const MeshArena &);
+	MeshArena &operator=(const MeshArena &);
+};
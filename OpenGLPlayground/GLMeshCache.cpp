@@ -0,0 +1,357 @@
+#include "GLMeshCache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define SECTION_ALIGNMENT 16
+
+struct MeshCache::Header
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int importFlags;
+	unsigned int processing;
+	unsigned long long sourceSize;
+	unsigned long long sourceTime;
+
+	unsigned int numVertices;
+	unsigned int numIndices;
+	unsigned int numEntries;
+	unsigned int numMaterials;
+
+	// Byte offsets from the start of the file
+	unsigned long long positionsOffset;
+	unsigned long long normalsOffset;
+	unsigned long long texcoordsOffset;
+	unsigned long long indicesOffset;
+	unsigned long long entriesOffset;
+	unsigned long long stringOffsetsOffset; // numMaterials offsets into the string blob
+	unsigned long long stringsOffset;
+	unsigned long long fileSize;
+};
+
+static bool GetSourceStamp(const std::string &filepath, unsigned long long &size, unsigned long long &time)
+{
+	struct stat st;
+	if (stat(filepath.c_str(), &st) != 0)
+		return false;
+
+	size = (unsigned long long)st.st_size;
+	time = (unsigned long long)st.st_mtime;
+	return true;
+}
+
+static unsigned long long AlignUp(unsigned long long offset)
+{
+	return (offset + SECTION_ALIGNMENT - 1) & ~(unsigned long long)(SECTION_ALIGNMENT - 1);
+}
+
+static bool WriteSection(FILE *fp, unsigned long long &cursor, unsigned long long &offset, const void *data, size_t bytes)
+{
+	static const unsigned char Padding[SECTION_ALIGNMENT] = { 0 };
+
+	offset = AlignUp(cursor);
+	size_t pad = (size_t)(offset - cursor);
+	if (pad > 0 && fwrite(Padding, 1, pad, fp) != pad)
+		return false;
+	if (bytes > 0 && fwrite(data, 1, bytes, fp) != bytes)
+		return false;
+
+	cursor = offset + bytes;
+	return true;
+}
+
+MeshCache::MeshCache() :
+	header(NULL), base(NULL), size(0)
+#ifdef WIN32
+	, fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL)
+#else
+	, fd(-1)
+#endif
+{
+}
+
+MeshCache::~MeshCache()
+{
+	Close();
+}
+
+std::string MeshCache::GetCachePath(const std::string &filepath, const MeshCacheFormat &format)
+{
+	return filepath + "." + format.loader + MESH_CACHE_EXT;
+}
+
+bool MeshCache::Write(const std::string &filepath, const MeshCacheFormat &format, const MeshCacheData &data)
+{
+	Header h;
+	memset(&h, 0, sizeof(h));
+
+	if (!GetSourceStamp(filepath, h.sourceSize, h.sourceTime))
+		return false;
+
+	std::string cachePath = GetCachePath(filepath, format);
+	FILE *fp = fopen(cachePath.c_str(), "wb");
+	if (!fp) {
+		printf("Unable to write mesh cache '%s'\n", cachePath.c_str());
+		return false;
+	}
+
+	h.version = MESH_CACHE_VERSION;
+	h.importFlags = format.importFlags;
+	h.processing = format.processing;
+	h.numVertices = data.numVertices;
+	h.numIndices = data.numIndices;
+	h.numEntries = data.numEntries;
+	h.numMaterials = data.texturePaths ? (unsigned int)data.texturePaths->size() : 0;
+
+	// Flatten the texture paths into one blob of null terminated strings
+	std::vector<unsigned int> stringOffsets(h.numMaterials);
+	std::string strings;
+	for (unsigned int i = 0; i < h.numMaterials; i++) {
+		stringOffsets[i] = (unsigned int)strings.size();
+		strings += (*data.texturePaths)[i];
+		strings.push_back('\0');
+	}
+
+	// The magic stays zero until every section made it to disk, so a cache
+	// cut short by a crash is never mistaken for a valid one
+	unsigned long long cursor = sizeof(Header);
+	bool ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+
+	ok = ok && WriteSection(fp, cursor, h.positionsOffset, data.positions, sizeof(float) * 3 * data.numVertices);
+	ok = ok && WriteSection(fp, cursor, h.normalsOffset, data.normals, sizeof(float) * 3 * data.numVertices);
+	ok = ok && WriteSection(fp, cursor, h.texcoordsOffset, data.texcoords, sizeof(float) * 2 * data.numVertices);
+	ok = ok && WriteSection(fp, cursor, h.indicesOffset, data.indices, sizeof(unsigned int) * data.numIndices);
+	ok = ok && WriteSection(fp, cursor, h.entriesOffset, data.entries, sizeof(MeshCacheEntry) * data.numEntries);
+	ok = ok && WriteSection(fp, cursor, h.stringOffsetsOffset,
+		stringOffsets.empty() ? NULL : &stringOffsets[0], sizeof(unsigned int) * stringOffsets.size());
+	ok = ok && WriteSection(fp, cursor, h.stringsOffset, strings.data(), strings.size());
+
+	h.fileSize = cursor;
+	h.magic = MESH_CACHE_MAGIC;
+	ok = ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, fp) == 1;
+
+	fclose(fp);
+
+	if (!ok) {
+		printf("Error writing mesh cache '%s'\n", cachePath.c_str());
+		remove(cachePath.c_str());
+		return false;
+	}
+
+	printf("Wrote mesh cache '%s' (%llu bytes)\n", cachePath.c_str(), h.fileSize);
+	return true;
+}
+
+bool MeshCache::Open(const std::string &filepath, const MeshCacheFormat &format)
+{
+	Close();
+
+	unsigned long long sourceSize, sourceTime;
+	if (!GetSourceStamp(filepath, sourceSize, sourceTime))
+		return false;
+
+	std::string cachePath = GetCachePath(filepath, format);
+
+#ifdef WIN32
+	HANDLE file = CreateFileA(cachePath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	fileHandle = file;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart < (LONGLONG)sizeof(Header)) {
+		Close();
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+
+	mappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mappingHandle) {
+		Close();
+		return false;
+	}
+
+	base = (const unsigned char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+	fd = open(cachePath.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+		Close();
+		return false;
+	}
+	size = (size_t)st.st_size;
+
+	void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	base = (mapped == MAP_FAILED) ? NULL : (const unsigned char*)mapped;
+#endif
+
+	if (!base) {
+		Close();
+		return false;
+	}
+
+	header = (const Header*)base;
+
+	if (header->magic != MESH_CACHE_MAGIC ||
+		header->version != MESH_CACHE_VERSION ||
+		header->importFlags != format.importFlags ||
+		header->processing != format.processing ||
+		header->fileSize != size) {
+		printf("Ignoring stale mesh cache '%s'\n", cachePath.c_str());
+		Close();
+		return false;
+	}
+
+	if (!IsValid()) {
+		printf("Ignoring corrupt mesh cache '%s'\n", cachePath.c_str());
+		Close();
+		return false;
+	}
+
+	if (header->sourceSize != sourceSize || header->sourceTime != sourceTime) {
+		printf("Mesh cache '%s' is out of date\n", cachePath.c_str());
+		Close();
+		return false;
+	}
+
+	return true;
+}
+
+bool MeshCache::IsInFile(unsigned long long offset, unsigned long long bytes) const
+{
+	return offset >= sizeof(Header) && offset <= size && bytes <= size - offset;
+}
+
+// Every section and every range the loaders index with must lie inside the
+// mapped file; a corrupt header would otherwise read past the view
+bool MeshCache::IsValid() const
+{
+	const Header &h = *header;
+
+	if (!IsInFile(h.positionsOffset, 3ULL * sizeof(float) * h.numVertices) ||
+		!IsInFile(h.normalsOffset, 3ULL * sizeof(float) * h.numVertices) ||
+		!IsInFile(h.texcoordsOffset, 2ULL * sizeof(float) * h.numVertices) ||
+		!IsInFile(h.indicesOffset, (unsigned long long)sizeof(unsigned int) * h.numIndices) ||
+		!IsInFile(h.entriesOffset, (unsigned long long)sizeof(MeshCacheEntry) * h.numEntries) ||
+		!IsInFile(h.stringOffsetsOffset, (unsigned long long)sizeof(unsigned int) * h.numMaterials) ||
+		!IsInFile(h.stringsOffset, 0))
+		return false;
+
+	const MeshCacheEntry *entries = Entries();
+	for (unsigned int i = 0; i < h.numEntries; i++) {
+		const MeshCacheEntry &entry = entries[i];
+
+		if ((unsigned long long)entry.baseVertex + entry.numVertices > h.numVertices ||
+			(unsigned long long)entry.baseIndex + entry.numIndices > h.numIndices ||
+			entry.numLods > MESH_CACHE_MAX_LODS)
+			return false;
+
+		for (unsigned int j = 0; j < entry.numLods; j++) {
+			if ((unsigned long long)entry.lodBaseIndex[j] + entry.lodNumIndices[j] > h.numIndices)
+				return false;
+		}
+	}
+
+	// The strings run to the end of the file, each one null terminated
+	const unsigned long long stringBytes = size - h.stringsOffset;
+	const unsigned int *offsets = (const unsigned int*)Section(h.stringOffsetsOffset);
+
+	if (h.numMaterials > 0 && (stringBytes == 0 || base[size - 1] != '\0'))
+		return false;
+
+	for (unsigned int i = 0; i < h.numMaterials; i++) {
+		if (offsets[i] >= stringBytes)
+			return false;
+	}
+
+	return true;
+}
+
+void MeshCache::Close()
+{
+#ifdef WIN32
+	if (base)
+		UnmapViewOfFile(base);
+	if (mappingHandle)
+		CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(fileHandle);
+	mappingHandle = NULL;
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (base)
+		munmap((void*)base, size);
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+#endif
+	header = NULL;
+	base = NULL;
+	size = 0;
+}
+
+unsigned int MeshCache::NumVertices() const
+{
+	return header->numVertices;
+}
+
+unsigned int MeshCache::NumIndices() const
+{
+	return header->numIndices;
+}
+
+unsigned int MeshCache::NumEntries() const
+{
+	return header->numEntries;
+}
+
+unsigned int MeshCache::NumMaterials() const
+{
+	return header->numMaterials;
+}
+
+const float *MeshCache::Positions() const
+{
+	return (const float*)Section(header->positionsOffset);
+}
+
+const float *MeshCache::Normals() const
+{
+	return (const float*)Section(header->normalsOffset);
+}
+
+const float *MeshCache::TexCoords() const
+{
+	return (const float*)Section(header->texcoordsOffset);
+}
+
+const unsigned int *MeshCache::Indices() const
+{
+	return (const unsigned int*)Section(header->indicesOffset);
+}
+
+const MeshCacheEntry *MeshCache::Entries() const
+{
+	return (const MeshCacheEntry*)Section(header->entriesOffset);
+}
+
+const char *MeshCache::TexturePath(unsigned int material) const
+{
+	const unsigned int *offsets = (const unsigned int*)Section(header->stringOffsetsOffset);
+	return (const char*)Section(header->stringsOffset) + offsets[material];
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define MESH_CACHE_MAGIC	0x4E49424D // "MBIN"
+#define MESH_CACHE_VERSION	4
+#define MESH_CACHE_EXT		".meshbin"
+#define MESH_CACHE_MAX_LODS	3
+
+// Processing a loader applied to the arrays before baking them
+#define MESH_CACHE_OPTIMIZED	0x1	// post-transform cache order (MeshOptimizer)
+#define MESH_CACHE_LODS			0x2	// LOD index ranges filled in
+#define MESH_CACHE_SHARED		0x4	// repeated submeshes point at their first copy
+
+// What a loader bakes. Every loader has a cache file of its own, and one
+// written with other import flags or processing is rejected.
+struct MeshCacheFormat
+{
+	const char *loader;			// file name tag: <model>.<loader>.meshbin
+	unsigned int importFlags;	// aiPostProcessSteps passed to ReadFile
+	unsigned int processing;	// MESH_CACHE_* bits
+};
+
+// One submesh inside the merged vertex/index arrays
+struct MeshCacheEntry
+{
+	unsigned int baseVertex;
+	unsigned int numVertices;
+	unsigned int baseIndex;
+	unsigned int numIndices;
+	unsigned int materialIndex;
+
+	// Simplified index ranges after the full detail one, coarsest last.
+	// Loaders without LODs leave numLods at 0.
+	unsigned int numLods;
+	unsigned int lodBaseIndex[MESH_CACHE_MAX_LODS];
+	unsigned int lodNumIndices[MESH_CACHE_MAX_LODS];
+	float lodError[MESH_CACHE_MAX_LODS];	// model units
+};
+
+// Final SoA streams as the loaders hand them to glBufferData
+struct MeshCacheData
+{
+	const float *positions;		// 3 floats per vertex
+	const float *normals;		// 3 floats per vertex
+	const float *texcoords;		// 2 floats per vertex
+	const unsigned int *indices;
+	unsigned int numVertices;
+	unsigned int numIndices;
+
+	const MeshCacheEntry *entries;
+	unsigned int numEntries;
+
+	// Resolved diffuse texture path per material, empty when the material has none
+	const std::vector<std::string> *texturePaths;
+
+	MeshCacheData() :
+		positions(NULL), normals(NULL), texcoords(NULL), indices(NULL),
+		numVertices(0), numIndices(0),
+		entries(NULL), numEntries(0),
+		texturePaths(NULL) {}
+};
+
+// Versioned binary image of an imported model, written next to the source
+// file (<model>.<loader>.meshbin) and memory-mapped on later runs so the arrays can be
+// passed straight to glBufferData without going through Assimp.
+class MeshCache
+{
+public:
+	MeshCache();
+	~MeshCache();
+
+	static std::string GetCachePath(const std::string &filepath, const MeshCacheFormat &format);
+	static bool Write(const std::string &filepath, const MeshCacheFormat &format, const MeshCacheData &data);
+
+	// Maps the cache of 'filepath'. Fails if it is missing, from another
+	// version or format, older than the source model, or if any section or
+	// submesh range lies outside the file.
+	bool Open(const std::string &filepath, const MeshCacheFormat &format);
+	void Close();
+	bool IsOpen() const { return header != NULL; }
+
+	unsigned int NumVertices() const;
+	unsigned int NumIndices() const;
+	unsigned int NumEntries() const;
+	unsigned int NumMaterials() const;
+
+	const float *Positions() const;
+	const float *Normals() const;
+	const float *TexCoords() const;
+	const unsigned int *Indices() const;
+	const MeshCacheEntry *Entries() const;
+	const char *TexturePath(unsigned int material) const;
+
+	struct Header;
+
+private:
+	const Header *header;
+	const unsigned char *base;
+	size_t size;
+#ifdef WIN32
+	void *fileHandle;
+	void *mappingHandle;
+#else
+	int fd;
+#endif
+
+	MeshCache(const MeshCache &);
+	MeshCache &operator=(const MeshCache &);
+
+	// Only valid for the offsets Open has checked
+	const void *Section(unsigned long long offset) const { return base + offset; }
+
+	bool IsInFile(unsigned long long offset, unsigned long long bytes) const;
+	bool IsValid() const;
+};
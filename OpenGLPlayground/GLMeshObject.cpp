@@ -1,18 +1,24 @@
 #include "GLMeshObject.h"
 #include "GLData.hpp"
+#include "GLMeshOptimizer.h"
+#include "GLVertexStream.h"
 
 #include <vector>
 #include <assimp/Importer.hpp>      // C++ importer interface
 #include <assimp/scene.h>       // Output data structure
 #include <assimp/postprocess.h> // Post processing flags
 
-GLMeshObject::GLMeshObject()
+GLMeshObject::GLMeshObject() :
+	vao(0),
+	arena(sizeof(Vertex))
 {
 }
 
 
 GLMeshObject::~GLMeshObject()
 {
+	if (vao != 0)
+		glDeleteVertexArrays(1, &vao);
 }
 
 bool GLMeshObject::Load(const char * filepath)
@@ -24,29 +30,37 @@ bool GLMeshObject::Load(const char * filepath)
 		aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs);
 
 	if (pScene) {
+		// A reload replaces the VAO and the arena contents of the last one
+		if (vao != 0) {
+			glDeleteVertexArrays(1, &vao);
+			vao = 0;
+		}
+		arena.Clear();
+
+		vertexGroups.clear();
 		vertexGroups.resize(pScene->mNumMeshes);
 		materials.resize(pScene->mNumMaterials);
 
+		VertexCacheStats before, after;
+
 		// Initialize the meshes in the scene one by one
 		for (unsigned int i = 0; i < vertexGroups.size(); i++) {
 			const aiMesh* paiMesh = pScene->mMeshes[i];
 			vertexGroups[i].materialIndex = paiMesh->mMaterialIndex;
 
+			// Faces index the vertices, so an empty group has nothing to load
+			if (paiMesh->mNumVertices == 0)
+				continue;
+
 			std::vector<Vertex> Vertices;
 			std::vector<unsigned int> Indices;
 
-			const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
-			
-			// Pos, Normal, Uv
-			for (unsigned int j = 0; j < paiMesh->mNumVertices; j++) {
-				const aiVector3D* pPos = &(paiMesh->mVertices[j]);
-				const aiVector3D* pNormal = &(paiMesh->mNormals[j]);
-				const aiVector3D* pTexCoord = paiMesh->HasTextureCoords(0) ? &(paiMesh->mTextureCoords[0][j]) : &Zero3D;
-
-				Vertices.push_back(Vertex(glm::vec3(pPos->x, pPos->y, pPos->z),
-					glm::vec3(pNormal->x, pNormal->y, pNormal->z),
-					glm::vec2(pTexCoord->x, pTexCoord->y)));
-			}
+			// Pos, Normal, Uv, interleaved a whole array at a time
+			Vertices.resize(paiMesh->mNumVertices);
+			VertexStream::Copy3(&paiMesh->mVertices[0].x, paiMesh->mNumVertices, &Vertices[0].pos.x, sizeof(Vertex));
+			VertexStream::Copy3(&paiMesh->mNormals[0].x, paiMesh->mNumVertices, &Vertices[0].normal.x, sizeof(Vertex));
+			VertexStream::Copy3To2(paiMesh->HasTextureCoords(0) ? &paiMesh->mTextureCoords[0][0].x : 0, paiMesh->mNumVertices,
+				&Vertices[0].uv.x, sizeof(Vertex));
 
 			// Index
 			for (unsigned int j = 0; j < paiMesh->mNumFaces; j++) {
@@ -57,9 +71,40 @@ bool GLMeshObject::Load(const char * filepath)
 				Indices.push_back(Face.mIndices[2]);
 			}
 
-			vertexGroups[i].Load(Vertices, Indices);
+			// Reorder for the post-transform cache, then renumber vertices by first use
+			VertexCacheStats meshBefore, meshAfter;
+			std::vector<unsigned int> remap;
+			if (!Indices.empty())
+			{
+				MeshOptimizer::Optimize(&Indices[0], Indices.size(), Vertices.size(), remap, &meshBefore, &meshAfter);
+				MeshOptimizer::RemapVertices(&Vertices[0], Vertices.size(), remap);
+				before += meshBefore;
+				after += meshAfter;
+			}
+
+			vertexGroups[i].Load(arena, Vertices, Indices);
 		}
 
+		// The vertex layout is recorded once in the VAO instead of on every draw
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+
+		arena.Upload();
+
+		glEnableVertexAttribArray(0);
+		glEnableVertexAttribArray(1);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
+		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)(sizeof(glm::vec3)));
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)(sizeof(glm::vec3) + sizeof(glm::vec2)));
+
+		// Enabled by Render only for groups with a texture
+		glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (const GLvoid*)12);
+
+		glBindVertexArray(0);
+
+		MeshOptimizer::PrintStats(filepath, before, after);
+
 		Ret = LoadMaterial(pScene, filepath);
 	}
 	else {
@@ -71,33 +116,25 @@ bool GLMeshObject::Load(const char * filepath)
 
 void GLMeshObject::Render()
 {
-	glEnableVertexAttribArray(0);
-	glEnableVertexAttribArray(1);
-	glEnableVertexAttribArray(2);
+	glBindVertexArray(vao);
 
 	for (unsigned int i = 0; i < vertexGroups.size(); i++) {
-		glBindBuffer(GL_ARRAY_BUFFER, vertexGroups[i].vertexBufferObj);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)(sizeof(glm::vec3)));
-		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)(sizeof(glm::vec3) + sizeof(glm::vec2)));
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vertexGroups[i].indexBufferObj);
-
 		const unsigned int MaterialIndex = vertexGroups[i].materialIndex;
 
 		if (MaterialIndex < materials.size() && materials[MaterialIndex]) {
 			glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-			glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (const GLvoid*)12);
 			materials[MaterialIndex]->Bind(GL_TEXTURE0);
 		}
 
-		glDrawElements(GL_TRIANGLES, vertexGroups[i].indexNum, GL_UNSIGNED_INT, 0);
+		glDrawElementsBaseVertex(GL_TRIANGLES,
+			vertexGroups[i].indexNum,
+			vertexGroups[i].indexType,
+			(void*)(size_t)vertexGroups[i].indexOffset,
+			vertexGroups[i].baseVertex);
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
 	}
 
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(2);
+	glBindVertexArray(0);
 }
 
 bool GLMeshObject::LoadMaterial(const aiScene * pScene, const char * filepath)
@@ -155,14 +192,11 @@ bool GLMeshObject::LoadMaterial(const aiScene * pScene, const char * filepath)
 	return Ret;
 }
 
-void VertexGroup::Load(const std::vector<Vertex>& vertexs, const std::vector<unsigned int>& indexs)
+void VertexGroup::Load(MeshArena &arena, const std::vector<Vertex>& vertexs, const std::vector<unsigned int>& indexs)
 {
-	indexNum = indexs.size();
-	glGenBuffers(1, &vertexBufferObj);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObj);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertexs.size(), &vertexs[0], GL_STATIC_DRAW);
-
-	glGenBuffers(1, &indexBufferObj);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferObj);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indexNum, &indexs[0], GL_STATIC_DRAW);
+	MeshArenaRange range = arena.Add(&vertexs[0], vertexs.size(), &indexs[0], indexs.size());
+	baseVertex = range.baseVertex;
+	indexOffset = range.indexOffset;
+	indexType = range.indexType;
+	indexNum = range.indexNum;
 }
@@ -9,6 +9,7 @@
 
 #include "GLData.hpp"
 #include "ogldev_texture.h"
+#include "GLMeshArena.h"
 
 #define INVALD 0xffffffff
 
@@ -18,6 +19,8 @@ struct Vertex
 	glm::vec2 uv;
 	glm::vec3 normal;
 
+	Vertex() {}
+
 	Vertex(const glm::vec3 _pos, const glm::vec3 _normal, const glm::vec2 _uv)
 		: pos(_pos), normal(_normal), uv(_uv)
 	{
@@ -28,19 +31,21 @@ struct Vertex
 
 struct VertexGroup
 {
-	GLuint vertexBufferObj;
-	GLuint indexBufferObj;
+	unsigned int baseVertex;
+	unsigned int indexOffset;	// bytes into the arena's index buffer
 	unsigned int materialIndex;
 	unsigned int indexNum;
+	GLenum indexType;
 
 	VertexGroup() : 
-		vertexBufferObj(INVALD), 
-		indexBufferObj(INVALD),
+		baseVertex(0), 
+		indexOffset(0),
 		materialIndex(INVALD),
-		indexNum(0){}
+		indexNum(0),
+		indexType(GL_UNSIGNED_INT){}
 	~VertexGroup(){}
 
-	void Load(const std::vector<Vertex> &vertexs, const std::vector<unsigned int> &indexs);
+	void Load(MeshArena &arena, const std::vector<Vertex> &vertexs, const std::vector<unsigned int> &indexs);
 };
 
 class GLMeshObject
@@ -52,6 +57,9 @@ public:
 	bool Load(const char *filepath);
 	void Render();
 private:
+	// All groups live in one arena and are drawn from one VAO
+	GLuint vao;
+	MeshArena arena;
 	std::vector<VertexGroup> vertexGroups;
 	std::vector<Texture*> materials;
 
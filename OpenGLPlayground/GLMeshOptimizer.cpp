@@ -0,0 +1,245 @@
+#include "GLMeshOptimizer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Scoring constants from the Forsyth paper
+#define FORSYTH_CACHE_SIZE		32
+#define FORSYTH_CACHE_DECAY		1.5f
+#define FORSYTH_LAST_TRI_SCORE	0.75f
+#define FORSYTH_VALENCE_SCALE	2.0f
+#define FORSYTH_VALENCE_POWER	0.5f
+
+static float VertexScore(int cachePosition, unsigned int remainingTriangles)
+{
+	// No triangle left to draw, the vertex is done
+	if (remainingTriangles == 0)
+		return -1.0f;
+
+	float score = 0.0f;
+
+	if (cachePosition >= 0) {
+		// The three vertices of the last triangle get a fixed score so the
+		// next triangle does not just reuse the same edge
+		if (cachePosition < 3) {
+			score = FORSYTH_LAST_TRI_SCORE;
+		}
+		else {
+			const float scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+			score = powf(1.0f - (cachePosition - 3) * scale, FORSYTH_CACHE_DECAY);
+		}
+	}
+
+	// Favour vertices with few triangles left so lone triangles are not left behind
+	score += FORSYTH_VALENCE_SCALE * powf((float)remainingTriangles, -FORSYTH_VALENCE_POWER);
+
+	return score;
+}
+
+void MeshOptimizer::OptimizeVertexCache(unsigned int *indices, unsigned int indexNum, unsigned int vertexNum)
+{
+	const unsigned int triangleNum = indexNum / 3;
+	if (triangleNum == 0)
+		return;
+
+	// Vertex -> triangle adjacency in one flat array
+	std::vector<unsigned int> remaining(vertexNum, 0);
+	for (unsigned int i = 0; i < indexNum; i++)
+		remaining[indices[i]]++;
+
+	std::vector<unsigned int> offsets(vertexNum + 1, 0);
+	for (unsigned int v = 0; v < vertexNum; v++)
+		offsets[v + 1] = offsets[v] + remaining[v];
+
+	std::vector<unsigned int> adjacency(indexNum);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (unsigned int t = 0; t < triangleNum; t++) {
+		for (unsigned int k = 0; k < 3; k++)
+			adjacency[fill[indices[t * 3 + k]]++] = t;
+	}
+
+	std::vector<int> cachePosition(vertexNum, -1);
+	std::vector<float> vertexScore(vertexNum);
+	for (unsigned int v = 0; v < vertexNum; v++)
+		vertexScore[v] = VertexScore(-1, remaining[v]);
+
+	std::vector<float> triangleScore(triangleNum);
+	std::vector<bool> emitted(triangleNum, false);
+	for (unsigned int t = 0; t < triangleNum; t++) {
+		triangleScore[t] = vertexScore[indices[t * 3 + 0]] +
+			vertexScore[indices[t * 3 + 1]] +
+			vertexScore[indices[t * 3 + 2]];
+	}
+
+	// LRU cache, with room for the 3 vertices pushed in by each triangle
+	unsigned int cache[FORSYTH_CACHE_SIZE + 3];
+	unsigned int cacheCount = 0;
+
+	std::vector<unsigned int> output(indexNum);
+	unsigned int scanCursor = 0;
+	unsigned int bestTriangle = 0;
+
+	// Start with the best triangle overall
+	for (unsigned int t = 1; t < triangleNum; t++) {
+		if (triangleScore[t] > triangleScore[bestTriangle])
+			bestTriangle = t;
+	}
+
+	for (unsigned int emitNum = 0; emitNum < triangleNum; emitNum++) {
+		const unsigned int *tri = &indices[bestTriangle * 3];
+
+		output[emitNum * 3 + 0] = tri[0];
+		output[emitNum * 3 + 1] = tri[1];
+		output[emitNum * 3 + 2] = tri[2];
+		emitted[bestTriangle] = true;
+
+		// Drop the triangle from its vertices' adjacency lists
+		for (unsigned int k = 0; k < 3; k++) {
+			unsigned int v = tri[k];
+			unsigned int *begin = &adjacency[offsets[v]];
+			unsigned int count = remaining[v];
+
+			for (unsigned int j = 0; j < count; j++) {
+				if (begin[j] == bestTriangle) {
+					begin[j] = begin[count - 1];
+					break;
+				}
+			}
+			remaining[v]--;
+		}
+
+		// Move the triangle's vertices to the front of the cache
+		unsigned int newCache[FORSYTH_CACHE_SIZE + 3];
+		unsigned int newCount = 0;
+
+		newCache[newCount++] = tri[0];
+		newCache[newCount++] = tri[1];
+		newCache[newCount++] = tri[2];
+
+		for (unsigned int j = 0; j < cacheCount; j++) {
+			unsigned int v = cache[j];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				newCache[newCount++] = v;
+		}
+
+		// Vertices that fell out of the cache lose their position score
+		for (unsigned int j = FORSYTH_CACHE_SIZE; j < newCount; j++)
+			cachePosition[newCache[j]] = -1;
+
+		cacheCount = newCount < FORSYTH_CACHE_SIZE ? newCount : FORSYTH_CACHE_SIZE;
+		memcpy(cache, newCache, sizeof(unsigned int) * cacheCount);
+
+		for (unsigned int j = 0; j < cacheCount; j++)
+			cachePosition[cache[j]] = (int)j;
+
+		// Rescore everything touched by the cache change
+		for (unsigned int j = 0; j < newCount; j++) {
+			unsigned int v = newCache[j];
+			float oldScore = vertexScore[v];
+			float score = VertexScore(cachePosition[v], remaining[v]);
+			vertexScore[v] = score;
+
+			const unsigned int *adj = &adjacency[offsets[v]];
+			for (unsigned int k = 0; k < remaining[v]; k++)
+				triangleScore[adj[k]] += score - oldScore;
+		}
+
+		// Next triangle: the best one among those touching the cache
+		float bestScore = -1.0f;
+		bool found = false;
+
+		for (unsigned int j = 0; j < cacheCount; j++) {
+			unsigned int v = cache[j];
+			const unsigned int *adj = &adjacency[offsets[v]];
+
+			for (unsigned int k = 0; k < remaining[v]; k++) {
+				unsigned int t = adj[k];
+				if (triangleScore[t] > bestScore) {
+					bestScore = triangleScore[t];
+					bestTriangle = t;
+					found = true;
+				}
+			}
+		}
+
+		// Nothing in the cache, continue with the next untouched triangle
+		if (!found) {
+			while (scanCursor < triangleNum && emitted[scanCursor])
+				scanCursor++;
+			bestTriangle = scanCursor;
+		}
+	}
+
+	memcpy(indices, &output[0], sizeof(unsigned int) * indexNum);
+}
+
+void MeshOptimizer::OptimizeVertexFetch(unsigned int *indices, unsigned int indexNum, unsigned int vertexNum,
+	std::vector<unsigned int> &remap)
+{
+	const unsigned int unused = 0xffffffff;
+	remap.assign(vertexNum, unused);
+
+	unsigned int next = 0;
+
+	for (unsigned int i = 0; i < indexNum; i++) {
+		unsigned int &slot = remap[indices[i]];
+		if (slot == unused)
+			slot = next++;
+		indices[i] = slot;
+	}
+
+	for (unsigned int v = 0; v < vertexNum; v++) {
+		if (remap[v] == unused)
+			remap[v] = next++;
+	}
+}
+
+VertexCacheStats MeshOptimizer::AnalyzeVertexCache(const unsigned int *indices, unsigned int indexNum, unsigned int vertexNum,
+	unsigned int cacheSize)
+{
+	VertexCacheStats stats;
+	stats.triangles = indexNum / 3;
+
+	// Timestamp of the last transform per vertex; a vertex is still in the
+	// FIFO while fewer than cacheSize other vertices came in after it
+	std::vector<unsigned int> timestamp(vertexNum, 0);
+	std::vector<bool> seen(vertexNum, false);
+	unsigned int time = cacheSize + 1;
+
+	for (unsigned int i = 0; i < indexNum; i++) {
+		unsigned int v = indices[i];
+
+		if (!seen[v]) {
+			seen[v] = true;
+			stats.vertices++;
+		}
+
+		if (time - timestamp[v] > cacheSize) {
+			timestamp[v] = time++;
+			stats.transformed++;
+		}
+	}
+
+	return stats;
+}
+
+void MeshOptimizer::Optimize(unsigned int *indices, unsigned int indexNum, unsigned int vertexNum,
+	std::vector<unsigned int> &remap, VertexCacheStats *before, VertexCacheStats *after)
+{
+	if (before)
+		*before = AnalyzeVertexCache(indices, indexNum, vertexNum);
+
+	OptimizeVertexCache(indices, indexNum, vertexNum);
+	OptimizeVertexFetch(indices, indexNum, vertexNum, remap);
+
+	if (after)
+		*after = AnalyzeVertexCache(indices, indexNum, vertexNum);
+}
+
+void MeshOptimizer::PrintStats(const char *name, const VertexCacheStats &before, const VertexCacheStats &after)
+{
+	printf("'%s': ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%u -> %u vertex shader invocations)\n",
+		name, before.ACMR(), after.ACMR(), before.ATVR(), after.ATVR(),
+		before.transformed, after.transformed);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Post-transform cache behaviour of an index buffer, simulated with a FIFO
+// cache of VERTEX_CACHE_SIM_SIZE entries
+struct VertexCacheStats
+{
+	unsigned int transformed;	// simulated vertex shader invocations
+	unsigned int triangles;
+	unsigned int vertices;		// distinct vertices referenced
+
+	VertexCacheStats() : transformed(0), triangles(0), vertices(0) {}
+
+	// Average cache miss ratio: invocations per triangle (0.5 .. 3)
+	float ACMR() const { return triangles ? (float)transformed / triangles : 0.0f; }
+	// Average transform to vertex ratio: invocations per vertex (1 is ideal)
+	float ATVR() const { return vertices ? (float)transformed / vertices : 0.0f; }
+
+	VertexCacheStats &operator+=(const VertexCacheStats &other)
+	{
+		transformed += other.transformed;
+		triangles += other.triangles;
+		vertices += other.vertices;
+		return *this;
+	}
+};
+
+#define VERTEX_CACHE_SIM_SIZE 16
+
+// Import-time reordering of triangle lists. All functions work on one
+// submesh at a time and keep no state, so submeshes may be optimized on
+// several threads at once.
+class MeshOptimizer
+{
+public:
+	// Reorders the triangles for post-transform cache locality
+	// (Forsyth, "Linear-Speed Vertex Cache Optimisation")
+	static void OptimizeVertexCache(unsigned int *indices, unsigned int indexNum, unsigned int vertexNum);
+
+	// Renumbers the vertices in first-use order so fetches walk the vertex
+	// buffer forwards. Rewrites indices and fills remap[old] = new; the
+	// attribute arrays have to be permuted with RemapVertices.
+	// Unreferenced vertices are moved to the end.
+	static void OptimizeVertexFetch(unsigned int *indices, unsigned int indexNum, unsigned int vertexNum,
+		std::vector<unsigned int> &remap);
+
+	static VertexCacheStats AnalyzeVertexCache(const unsigned int *indices, unsigned int indexNum, unsigned int vertexNum,
+		unsigned int cacheSize = VERTEX_CACHE_SIM_SIZE);
+
+	// Both passes above. Returns the stats before and after.
+	static void Optimize(unsigned int *indices, unsigned int indexNum, unsigned int vertexNum,
+		std::vector<unsigned int> &remap, VertexCacheStats *before = NULL, VertexCacheStats *after = NULL);
+
+	static void PrintStats(const char *name, const VertexCacheStats &before, const VertexCacheStats &after);
+
+	// Applies a remap table from OptimizeVertexFetch to one attribute array
+	template <typename T>
+	static void RemapVertices(T *vertices, unsigned int vertexNum, const std::vector<unsigned int> &remap)
+	{
+		std::vector<T> copy(vertices, vertices + vertexNum);
+		for (unsigned int i = 0; i < vertexNum; i++)
+			vertices[remap[i]] = copy[i];
+	}
+};
@@ -0,0 +1,243 @@
+#include "GLMeshPacking.h"
+
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+
+static unsigned short QuantizeUnorm16(float v)
+{
+	if (v < 0.0f) v = 0.0f;
+	if (v > 1.0f) v = 1.0f;
+	return (unsigned short)(v * 65535.0f + 0.5f);
+}
+
+static float DequantizeUnorm16(unsigned short v)
+{
+	return v / 65535.0f;
+}
+
+// Same rule as GL for normalized signed attributes
+static float DequantizeSnorm16(short v)
+{
+	float f = v / 32767.0f;
+	return f < -1.0f ? -1.0f : f;
+}
+
+static float SignNotZero(float v)
+{
+	return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+// Zero-sized ranges would divide by zero when packing
+static float SafeScale(float extent)
+{
+	return extent > 0.0f ? extent : 1.0f;
+}
+
+PackedVertexRange MeshPacking::ComputeRange(const float *positions, const float *texcoords, unsigned int vertexNum)
+{
+	float minPos[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float maxPos[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	float minUV[2] = { FLT_MAX, FLT_MAX };
+	float maxUV[2] = { -FLT_MAX, -FLT_MAX };
+
+	for (unsigned int i = 0; i < vertexNum; i++) {
+		for (int k = 0; k < 3; k++) {
+			minPos[k] = fminf(minPos[k], positions[i * 3 + k]);
+			maxPos[k] = fmaxf(maxPos[k], positions[i * 3 + k]);
+		}
+		for (int k = 0; k < 2; k++) {
+			minUV[k] = fminf(minUV[k], texcoords[i * 2 + k]);
+			maxUV[k] = fmaxf(maxUV[k], texcoords[i * 2 + k]);
+		}
+	}
+
+	PackedVertexRange range;
+
+	for (int k = 0; k < 3; k++) {
+		range.positionOffset[k] = vertexNum ? minPos[k] : 0.0f;
+		range.positionScale[k] = vertexNum ? SafeScale(maxPos[k] - minPos[k]) : 1.0f;
+	}
+	for (int k = 0; k < 2; k++) {
+		range.texcoordOffset[k] = vertexNum ? minUV[k] : 0.0f;
+		range.texcoordScale[k] = vertexNum ? SafeScale(maxUV[k] - minUV[k]) : 1.0f;
+	}
+
+	return range;
+}
+
+void MeshPacking::PackVertices(const float *positions, const float *normals, const float *texcoords, unsigned int vertexNum,
+	const PackedVertexRange &range, PackedVertex *out)
+{
+	for (unsigned int i = 0; i < vertexNum; i++) {
+		PackedVertex &v = out[i];
+
+		for (int k = 0; k < 3; k++)
+			v.position[k] = QuantizeUnorm16((positions[i * 3 + k] - range.positionOffset[k]) / range.positionScale[k]);
+		v.pad = 0;
+
+		EncodeOctahedral(&normals[i * 3], v.normal);
+
+		for (int k = 0; k < 2; k++)
+			v.texcoord[k] = QuantizeUnorm16((texcoords[i * 2 + k] - range.texcoordOffset[k]) / range.texcoordScale[k]);
+	}
+}
+
+PackedVertexError MeshPacking::MeasureError(const float *positions, const float *normals, const float *texcoords, unsigned int vertexNum,
+	const PackedVertexRange &range, const PackedVertex *packed)
+{
+	PackedVertexError error = { 0.0f, 0.0f, 0.0f };
+	float minCos = 1.0f;
+
+	for (unsigned int i = 0; i < vertexNum; i++) {
+		const PackedVertex &v = packed[i];
+
+		for (int k = 0; k < 3; k++) {
+			float p = DequantizeUnorm16(v.position[k]) * range.positionScale[k] + range.positionOffset[k];
+			error.position = fmaxf(error.position, fabsf(p - positions[i * 3 + k]));
+		}
+
+		for (int k = 0; k < 2; k++) {
+			float t = DequantizeUnorm16(v.texcoord[k]) * range.texcoordScale[k] + range.texcoordOffset[k];
+			error.texcoord = fmaxf(error.texcoord, fabsf(t - texcoords[i * 2 + k]));
+		}
+
+		const float *n = &normals[i * 3];
+		float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length > 0.0f) {
+			float decoded[3];
+			DecodeOctahedral(v.normal, decoded);
+			float c = (decoded[0] * n[0] + decoded[1] * n[1] + decoded[2] * n[2]) / length;
+			minCos = fminf(minCos, c);
+		}
+	}
+
+	if (minCos < -1.0f) minCos = -1.0f;
+	error.normal = acosf(minCos) * 180.0f / 3.14159265f;
+
+	return error;
+}
+
+PackedIndexRange MeshPacking::AppendIndices(std::vector<unsigned char> &buffer, const unsigned int *indices, unsigned int indexNum)
+{
+	unsigned int maxIndex = 0;
+	for (unsigned int i = 0; i < indexNum; i++) {
+		if (indices[i] > maxIndex)
+			maxIndex = indices[i];
+	}
+
+	PackedIndexRange range;
+	range.type = maxIndex <= 0xffff ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	range.offset = (unsigned int)((buffer.size() + 3) & ~(size_t)3);
+
+	buffer.resize(range.offset + indexNum * IndexSize(range.type), 0);
+
+	if (range.type == GL_UNSIGNED_SHORT && indexNum > 0) {
+		unsigned short *out = (unsigned short*)&buffer[range.offset];
+		for (unsigned int i = 0; i < indexNum; i++)
+			out[i] = (unsigned short)indices[i];
+	}
+	else if (indexNum > 0) {
+		memcpy(&buffer[range.offset], indices, indexNum * sizeof(unsigned int));
+	}
+
+	return range;
+}
+
+PackedBoneLayout MeshPacking::BoneLayout(unsigned int boneNum, bool byteWeights)
+{
+	PackedBoneLayout layout;
+	layout.idType = boneNum <= 256 ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT;
+	layout.weightType = byteWeights ? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT;
+	layout.weightOffset = layout.idType == GL_UNSIGNED_BYTE ? 4 : 8;
+	layout.stride = layout.weightOffset + (byteWeights ? 4 : 8);
+	return layout;
+}
+
+void MeshPacking::PackBones(const unsigned int *ids, const float *weights, unsigned int sourceStride, unsigned int vertexNum,
+	const PackedBoneLayout &layout, unsigned char *out)
+{
+	const unsigned int maxWeight = layout.weightType == GL_UNSIGNED_BYTE ? 0xff : 0xffff;
+
+	for (unsigned int i = 0; i < vertexNum; i++) {
+		const unsigned int *id = (const unsigned int*)((const unsigned char*)ids + (size_t)i * sourceStride);
+		const float *weight = (const float*)((const unsigned char*)weights + (size_t)i * sourceStride);
+		unsigned char *v = out + (size_t)i * layout.stride;
+
+		unsigned int quantized[4];
+		unsigned int sum = 0;
+		int largest = 0;
+
+		for (int k = 0; k < 4; k++) {
+			float w = weight[k] < 0.0f ? 0.0f : weight[k] > 1.0f ? 1.0f : weight[k];
+			quantized[k] = (unsigned int)(w * maxWeight + 0.5f);
+			sum += quantized[k];
+			if (weight[k] > weight[largest])
+				largest = k;
+		}
+
+		// Rounding must not make the vertex grow or shrink; vertices without
+		// any weight stay at zero
+		if (sum > 0) {
+			int remainder = (int)maxWeight - (int)sum;
+			int fixed = (int)quantized[largest] + remainder;
+			quantized[largest] = fixed < 0 ? 0 : fixed > (int)maxWeight ? maxWeight : (unsigned int)fixed;
+		}
+
+		for (int k = 0; k < 4; k++) {
+			if (layout.idType == GL_UNSIGNED_BYTE)
+				v[k] = (unsigned char)id[k];
+			else
+				((unsigned short*)v)[k] = (unsigned short)id[k];
+
+			if (layout.weightType == GL_UNSIGNED_BYTE)
+				v[layout.weightOffset + k] = (unsigned char)quantized[k];
+			else
+				((unsigned short*)(v + layout.weightOffset))[k] = (unsigned short)quantized[k];
+		}
+	}
+}
+
+void MeshPacking::EncodeOctahedral(const float *normal, short *out)
+{
+	float x = normal[0], y = normal[1], z = normal[2];
+	float l1 = fabsf(x) + fabsf(y) + fabsf(z);
+
+	if (l1 == 0.0f) {
+		out[0] = out[1] = 0;
+		return;
+	}
+
+	// Project onto the octahedron, then fold the lower half over the upper one
+	x /= l1;
+	y /= l1;
+
+	if (z < 0.0f) {
+		float fx = (1.0f - fabsf(y)) * SignNotZero(x);
+		float fy = (1.0f - fabsf(x)) * SignNotZero(y);
+		x = fx;
+		y = fy;
+	}
+
+	out[0] = (short)lrintf(fmaxf(-1.0f, fminf(1.0f, x)) * 32767.0f);
+	out[1] = (short)lrintf(fmaxf(-1.0f, fminf(1.0f, y)) * 32767.0f);
+}
+
+void MeshPacking::DecodeOctahedral(const short *in, float *normal)
+{
+	float x = DequantizeSnorm16(in[0]);
+	float y = DequantizeSnorm16(in[1]);
+	float z = 1.0f - fabsf(x) - fabsf(y);
+
+	if (z < 0.0f) {
+		float fx = (1.0f - fabsf(y)) * SignNotZero(x);
+		float fy = (1.0f - fabsf(x)) * SignNotZero(y);
+		x = fx;
+		y = fy;
+	}
+
+	float length = sqrtf(x * x + y * y + z * z);
+	normal[0] = x / length;
+	normal[1] = y / length;
+	normal[2] = z / length;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+#include <GL/glew.h>
+
+// Compact vertex layout for static meshes, 16 bytes instead of 32:
+//   position  3 x GL_UNSIGNED_SHORT normalized, relative to the mesh bounds
+//   (pad)     1 x unsigned short, keeps the normal 4-byte aligned
+//   normal    2 x GL_SHORT normalized, octahedral encoding
+//   texcoord  2 x GL_UNSIGNED_SHORT normalized, relative to the UV bounds
+// The shader rebuilds the original values with the per-mesh PackedVertexRange.
+struct PackedVertex
+{
+	unsigned short position[3];
+	unsigned short pad;
+	short normal[2];
+	unsigned short texcoord[2];
+};
+
+#define PACKED_POSITION_OFFSET	0
+#define PACKED_NORMAL_OFFSET	8
+#define PACKED_TEXCOORD_OFFSET	12
+
+// Decoded value = packed value (0..1) * scale + offset
+struct PackedVertexRange
+{
+	float positionOffset[3];
+	float positionScale[3];
+	float texcoordOffset[2];
+	float texcoordScale[2];
+};
+
+// Largest round-trip error over all vertices of a mesh
+struct PackedVertexError
+{
+	float position;		// world units, per component
+	float normal;		// degrees
+	float texcoord;		// UV units, per component
+};
+
+// Where one submesh's indices ended up in a packed index buffer
+struct PackedIndexRange
+{
+	GLenum type;			// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	unsigned int offset;	// bytes from the start of the buffer
+};
+
+// Bone influences, 4 per vertex: the ids as GL_UNSIGNED_BYTE (GL_UNSIGNED_SHORT
+// past 256 bones) for an integer attribute, then the weights as normalized
+// GL_UNSIGNED_SHORT or GL_UNSIGNED_BYTE. 8 to 12 bytes instead of 32.
+struct PackedBoneLayout
+{
+	GLenum idType;
+	GLenum weightType;
+	unsigned int weightOffset;	// bytes from the start of a vertex
+	unsigned int stride;		// bytes per vertex
+};
+
+class MeshPacking
+{
+public:
+	// Bounds of the positions and texcoords of vertexNum vertices
+	static PackedVertexRange ComputeRange(const float *positions, const float *texcoords, unsigned int vertexNum);
+
+	static void PackVertices(const float *positions, const float *normals, const float *texcoords, unsigned int vertexNum,
+		const PackedVertexRange &range, PackedVertex *out);
+
+	// Decodes 'packed' again and compares it with the source arrays
+	static PackedVertexError MeasureError(const float *positions, const float *normals, const float *texcoords, unsigned int vertexNum,
+		const PackedVertexRange &range, const PackedVertex *packed);
+
+	// Appends the indices of one submesh, as 16 bits when all of them fit.
+	// Ranges start 4-byte aligned so 32-bit ranges can follow 16-bit ones.
+	static PackedIndexRange AppendIndices(std::vector<unsigned char> &buffer, const unsigned int *indices, unsigned int indexNum);
+
+	static unsigned int IndexSize(GLenum type) { return type == GL_UNSIGNED_SHORT ? 2 : 4; }
+
+	static PackedBoneLayout BoneLayout(unsigned int boneNum, bool byteWeights);
+
+	// ids and weights: 4 per vertex, 'sourceStride' bytes apart. The weights
+	// should sum to one; the packed ones then sum to exactly the largest
+	// value of their type, the rounding going to the largest weight.
+	static void PackBones(const unsigned int *ids, const float *weights, unsigned int sourceStride, unsigned int vertexNum,
+		const PackedBoneLayout &layout, unsigned char *out);
+
+	static void EncodeOctahedral(const float *normal, short *out);
+	static void DecodeOctahedral(const short *in, float *normal);
+};
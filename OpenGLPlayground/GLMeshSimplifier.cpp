@@ -0,0 +1,337 @@
+#include "GLMeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+// Symmetric 4x4 plane quadric, upper triangle only, and the total weight
+// (area) of its planes
+struct Quadric
+{
+	double a2, ab, ac, ad;
+	double b2, bc, bd;
+	double c2, cd;
+	double d2;
+	double w;
+
+	Quadric() { memset(this, 0, sizeof(*this)); }
+
+	void AddPlane(double a, double b, double c, double d, double w)
+	{
+		a2 += w * a * a; ab += w * a * b; ac += w * a * c; ad += w * a * d;
+		b2 += w * b * b; bc += w * b * c; bd += w * b * d;
+		c2 += w * c * c; cd += w * c * d;
+		d2 += w * d * d;
+		this->w += w;
+	}
+
+	void Add(const Quadric &q)
+	{
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+		w += q.w;
+	}
+
+	// Area weighted sum of squared distances of p to the accumulated planes
+	double Evaluate(const float *p) const
+	{
+		double x = p[0], y = p[1], z = p[2];
+		double r = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+			+ b2 * y * y + 2 * bc * y * z + 2 * bd * y
+			+ c2 * z * z + 2 * cd * z
+			+ d2;
+		return r > 0.0 ? r : 0.0;
+	}
+
+	// Root mean square distance of p to the planes, weighted by area: a
+	// distance in model units, unlike Evaluate
+	double Distance(const float *p) const
+	{
+		return w > 0.0 ? sqrt(Evaluate(p) / w) : 0.0;
+	}
+};
+
+struct Collapse
+{
+	unsigned int from;
+	unsigned int to;
+	double cost;		// area weighted, orders the collapses
+	double distance;	// model units, reported as the error
+
+	bool operator<(const Collapse &other) const { return cost < other.cost; }
+};
+
+static void TriangleNormal(const float *p0, const float *p1, const float *p2, double *n)
+{
+	double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+	double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+	n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+	n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+	n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+}
+
+static unsigned long long EdgeKey(unsigned int a, unsigned int b)
+{
+	if (a > b)
+		std::swap(a, b);
+	return ((unsigned long long)a << 32) | b;
+}
+
+// Welds vertices with bitwise equal positions, so seams can be told apart
+// from real topology
+static void WeldPositions(const float *positions, unsigned int vertexNum, std::vector<unsigned int> &welded)
+{
+	struct Key
+	{
+		unsigned int x, y, z;
+		bool operator==(const Key &o) const { return x == o.x && y == o.y && z == o.z; }
+	};
+	struct KeyHash
+	{
+		size_t operator()(const Key &k) const { return (k.x * 73856093u) ^ (k.y * 19349663u) ^ (k.z * 83492791u); }
+	};
+
+	std::unordered_map<Key, unsigned int, KeyHash> first;
+	first.reserve(vertexNum);
+	welded.resize(vertexNum);
+
+	for (unsigned int v = 0; v < vertexNum; v++) {
+		Key key;
+		memcpy(&key, &positions[v * 3], sizeof(key));
+		welded[v] = first.insert(std::make_pair(key, v)).first->second;
+	}
+}
+
+// Triangles around every vertex, as offsets into one flat array
+static void BuildAdjacency(const std::vector<unsigned int> &indices, unsigned int vertexNum,
+	std::vector<unsigned int> &offsets, std::vector<unsigned int> &triangles)
+{
+	offsets.assign(vertexNum + 1, 0);
+	for (size_t i = 0; i < indices.size(); i++)
+		offsets[indices[i] + 1]++;
+	for (unsigned int v = 0; v < vertexNum; v++)
+		offsets[v + 1] += offsets[v];
+
+	triangles.resize(indices.size());
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++)
+		triangles[fill[indices[i]]++] = (unsigned int)(i / 3);
+}
+
+// Moving 'from' onto 'to' must not flip or squash any remaining triangle
+static bool CollapseKeepsOrientation(const float *positions, const std::vector<unsigned int> &indices,
+	const unsigned int *ring, unsigned int ringNum, unsigned int from, unsigned int to,
+	const std::vector<unsigned int> &welded)
+{
+	const float *target = &positions[to * 3];
+
+	for (unsigned int i = 0; i < ringNum; i++) {
+		const unsigned int *tri = &indices[ring[i] * 3];
+
+		if (tri[0] == to || tri[1] == to || tri[2] == to)
+			continue;
+
+		// Another copy of the target position in the ring means a seam runs
+		// through it on our side; collapsing would tear it
+		for (int k = 0; k < 3; k++) {
+			if (tri[k] != from && welded[tri[k]] == welded[to])
+				return false;
+		}
+
+		const float *p[3];
+		for (int k = 0; k < 3; k++)
+			p[k] = tri[k] == from ? target : &positions[tri[k] * 3];
+
+		double before[3], after[3];
+		TriangleNormal(&positions[tri[0] * 3], &positions[tri[1] * 3], &positions[tri[2] * 3], before);
+		TriangleNormal(p[0], p[1], p[2], after);
+
+		double dot = before[0] * after[0] + before[1] * after[1] + before[2] * after[2];
+		double lengths = sqrt(before[0] * before[0] + before[1] * before[1] + before[2] * before[2]) *
+			sqrt(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+
+		// Allow up to ~75 degrees of rotation per collapse
+		if (lengths <= 0.0 || dot < 0.25 * lengths)
+			return false;
+	}
+
+	return true;
+}
+
+float MeshSimplifier::Simplify(const float *positions, unsigned int vertexNum,
+	const unsigned int *indices, unsigned int indexNum,
+	unsigned int targetIndexNum, std::vector<unsigned int> &out)
+{
+	out.assign(indices, indices + indexNum);
+
+	std::vector<unsigned int> welded;
+	WeldPositions(positions, vertexNum, welded);
+
+	// Seams: one position used by several vertices
+	std::vector<unsigned int> copies(vertexNum, 0);
+	for (unsigned int v = 0; v < vertexNum; v++)
+		copies[welded[v]]++;
+
+	std::vector<bool> locked(vertexNum, false);
+	for (unsigned int v = 0; v < vertexNum; v++) {
+		if (copies[welded[v]] > 1)
+			locked[v] = true;
+	}
+
+	// Borders and non-manifold edges: not shared by exactly two triangles
+	std::unordered_map<unsigned long long, unsigned int> edgeUse;
+	edgeUse.reserve(indexNum);
+	for (unsigned int i = 0; i < indexNum; i += 3) {
+		for (int k = 0; k < 3; k++)
+			edgeUse[EdgeKey(welded[out[i + k]], welded[out[i + (k + 1) % 3]])]++;
+	}
+	for (unsigned int i = 0; i < indexNum; i += 3) {
+		for (int k = 0; k < 3; k++) {
+			unsigned int a = out[i + k], b = out[i + (k + 1) % 3];
+			if (edgeUse[EdgeKey(welded[a], welded[b])] != 2) {
+				locked[a] = true;
+				locked[b] = true;
+			}
+		}
+	}
+
+	// Area weighted plane quadrics, accumulated per position
+	std::vector<Quadric> quadrics(vertexNum);
+	for (unsigned int i = 0; i < indexNum; i += 3) {
+		const float *p0 = &positions[out[i] * 3];
+		double n[3];
+		TriangleNormal(p0, &positions[out[i + 1] * 3], &positions[out[i + 2] * 3], n);
+
+		double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length <= 0.0)
+			continue;
+
+		n[0] /= length; n[1] /= length; n[2] /= length;
+		double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+
+		for (int k = 0; k < 3; k++)
+			quadrics[welded[out[i + k]]].AddPlane(n[0], n[1], n[2], d, length * 0.5);
+	}
+
+	std::vector<unsigned int> remap(vertexNum);
+	std::vector<bool> dirty(vertexNum);
+	std::vector<unsigned int> offsets, ring;
+	std::vector<Collapse> collapses;
+	double maxDistance = 0.0;
+
+	while (out.size() > targetIndexNum) {
+		BuildAdjacency(out, vertexNum, offsets, ring);
+
+		collapses.clear();
+		for (size_t i = 0; i < out.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				unsigned int a = out[i + k], b = out[i + (k + 1) % 3];
+
+				for (int dir = 0; dir < 2; dir++) {
+					unsigned int from = dir ? b : a, to = dir ? a : b;
+					if (locked[from])
+						continue;
+
+					Quadric q = quadrics[welded[from]];
+					q.Add(quadrics[welded[to]]);
+
+					Collapse c = { from, to, q.Evaluate(&positions[to * 3]), q.Distance(&positions[to * 3]) };
+					collapses.push_back(c);
+				}
+			}
+		}
+
+		if (collapses.empty())
+			break;
+
+		std::sort(collapses.begin(), collapses.end());
+
+		for (unsigned int v = 0; v < vertexNum; v++) {
+			remap[v] = v;
+			dirty[v] = false;
+		}
+
+		// Each collapse removes about two triangles; stop once the pass
+		// would overshoot the target
+		size_t collapseBudget = (out.size() - targetIndexNum) / 6 + 1;
+		size_t collapsed = 0;
+
+		for (size_t i = 0; i < collapses.size() && collapsed < collapseBudget; i++) {
+			const Collapse &c = collapses[i];
+
+			// Neighbourhoods already changed in this pass are retried next pass
+			if (dirty[c.from] || dirty[c.to])
+				continue;
+
+			const unsigned int *fromRing = &ring[offsets[c.from]];
+			unsigned int fromRingNum = offsets[c.from + 1] - offsets[c.from];
+
+			if (!CollapseKeepsOrientation(positions, out, fromRing, fromRingNum, c.from, c.to, welded))
+				continue;
+
+			remap[c.from] = c.to;
+			quadrics[welded[c.to]].Add(quadrics[welded[c.from]]);
+			maxDistance = std::max(maxDistance, c.distance);
+			collapsed++;
+
+			dirty[c.from] = true;
+			dirty[c.to] = true;
+			for (unsigned int t = 0; t < fromRingNum; t++) {
+				for (int k = 0; k < 3; k++)
+					dirty[out[fromRing[t] * 3 + k]] = true;
+			}
+		}
+
+		if (collapsed == 0)
+			break;
+
+		// Apply the pass and drop triangles that became degenerate
+		size_t write = 0;
+		for (size_t i = 0; i < out.size(); i += 3) {
+			unsigned int a = remap[out[i]], b = remap[out[i + 1]], c = remap[out[i + 2]];
+			if (a == b || b == c || c == a)
+				continue;
+
+			out[write++] = a;
+			out[write++] = b;
+			out[write++] = c;
+		}
+		out.resize(write);
+	}
+
+	return (float)maxDistance;
+}
+
+unsigned int MeshSimplifier::BuildLodChain(const float *positions, unsigned int vertexNum,
+	const unsigned int *indices, unsigned int indexNum, unsigned int minIndexNum,
+	unsigned int maxLods, std::vector<unsigned int> *lods, float *errors)
+{
+	const unsigned int *source = indices;
+	unsigned int sourceNum = indexNum;
+	float error = 0.0f;
+	unsigned int lodNum = 0;
+
+	while (lodNum < maxLods && sourceNum / 2 >= minIndexNum) {
+		unsigned int target = sourceNum / 6 * 3;
+
+		// Each level starts from the previous one, so errors only grow
+		float levelError = Simplify(positions, vertexNum, source, sourceNum, target, lods[lodNum]);
+
+		if (lods[lodNum].empty() || lods[lodNum].size() > (size_t)sourceNum * 3 / 4) {
+			lods[lodNum].clear();
+			break;
+		}
+
+		error = std::max(error, levelError);
+		errors[lodNum] = error;
+
+		source = &lods[lodNum][0];
+		sourceNum = (unsigned int)lods[lodNum].size();
+		lodNum++;
+	}
+
+	return lodNum;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Quadric error metric simplification by half-edge collapse. A vertex is
+// only ever moved onto one of its neighbours, so every LOD indexes the
+// original vertex buffer and only needs its own index range.
+//
+// Vertices on open borders and on UV/normal seams (several vertices sharing
+// one position) are locked, and collapses that flip a triangle are rejected.
+class MeshSimplifier
+{
+public:
+	// Simplifies the triangle list 'indices' (3 floats per position) towards
+	// targetIndexNum indices and writes the result to 'out'. Stops early when
+	// nothing more can be collapsed. Returns the largest collapse error: the
+	// area weighted RMS distance of a moved vertex to the planes of the
+	// surface it replaced, in model units.
+	static float Simplify(const float *positions, unsigned int vertexNum,
+		const unsigned int *indices, unsigned int indexNum,
+		unsigned int targetIndexNum, std::vector<unsigned int> &out);
+
+	// Up to maxLods simplified copies of a submesh, each aiming at half the
+	// triangles of the one before. Stops once a level sheds less than a
+	// quarter of its triangles (too much is locked) or would fall below
+	// minIndexNum. Returns the number of levels written to lods and errors.
+	static unsigned int BuildLodChain(const float *positions, unsigned int vertexNum,
+		const unsigned int *indices, unsigned int indexNum, unsigned int minIndexNum,
+		unsigned int maxLods, std::vector<unsigned int> *lods, float *errors);
+};
@@ -0,0 +1,167 @@
+#include "GLMeshlet.h"
+
+#include <cfloat>
+#include <cmath>
+
+static void ComputeBounds(const float *positions, const unsigned int *indices, Meshlet &meshlet)
+{
+	const unsigned int *tris = indices + meshlet.triangleOffset * 3;
+	const unsigned int indexNum = meshlet.triangleNum * 3;
+
+	// Sphere around the bounding box
+	float minPos[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float maxPos[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (unsigned int i = 0; i < indexNum; i++) {
+		const float *p = &positions[tris[i] * 3];
+		for (int k = 0; k < 3; k++) {
+			minPos[k] = fminf(minPos[k], p[k]);
+			maxPos[k] = fmaxf(maxPos[k], p[k]);
+		}
+	}
+
+	for (int k = 0; k < 3; k++)
+		meshlet.center[k] = (minPos[k] + maxPos[k]) * 0.5f;
+
+	float radius2 = 0.0f;
+	for (unsigned int i = 0; i < indexNum; i++) {
+		const float *p = &positions[tris[i] * 3];
+		float dx = p[0] - meshlet.center[0], dy = p[1] - meshlet.center[1], dz = p[2] - meshlet.center[2];
+		radius2 = fmaxf(radius2, dx * dx + dy * dy + dz * dz);
+	}
+	meshlet.radius = sqrtf(radius2);
+
+	// Cone around the average of the unit face normals
+	std::vector<float> normals(meshlet.triangleNum * 3);
+	float axis[3] = { 0.0f, 0.0f, 0.0f };
+
+	for (unsigned int t = 0; t < meshlet.triangleNum; t++) {
+		const float *p0 = &positions[tris[t * 3 + 0] * 3];
+		const float *p1 = &positions[tris[t * 3 + 1] * 3];
+		const float *p2 = &positions[tris[t * 3 + 2] * 3];
+
+		float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		float e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		float *n = &normals[t * 3];
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+
+		float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		float scale = length > 0.0f ? 1.0f / length : 0.0f;
+
+		for (int k = 0; k < 3; k++) {
+			n[k] *= scale;
+			axis[k] += n[k];
+		}
+	}
+
+	float axisLength = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+
+	float minDot = 1.0f;
+	for (int k = 0; k < 3; k++)
+		axis[k] = axisLength > 0.0f ? axis[k] / axisLength : 0.0f;
+
+	for (unsigned int t = 0; t < meshlet.triangleNum; t++) {
+		const float *n = &normals[t * 3];
+		if (n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f)
+			continue;
+		minDot = fminf(minDot, n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2]);
+	}
+
+	for (int k = 0; k < 3; k++)
+		meshlet.coneAxis[k] = axis[k];
+
+	// A spread of 90 degrees or more can always be seen from some side
+	meshlet.coneCutoff = (axisLength > 0.0f && minDot > 0.0f) ? sqrtf(1.0f - minDot * minDot) : 1.0f;
+}
+
+// Distinct vertices of 'tri' that are not in the current meshlet yet
+static unsigned int CountNewVertices(const unsigned int *tri, const std::vector<unsigned int> &stamp, unsigned int current)
+{
+	unsigned int count = 0;
+
+	for (int k = 0; k < 3; k++) {
+		bool repeated = (k > 0 && tri[k] == tri[0]) || (k > 1 && tri[k] == tri[1]);
+		if (!repeated && stamp[tri[k]] != current)
+			count++;
+	}
+
+	return count;
+}
+
+void MeshletBuilder::Build(const float *positions, unsigned int vertexNum,
+	const unsigned int *indices, unsigned int indexNum, std::vector<Meshlet> &meshlets)
+{
+	// stamp[v] == current when v is already in the current meshlet
+	std::vector<unsigned int> stamp(vertexNum, 0);
+	unsigned int current = 1;
+
+	Meshlet meshlet = Meshlet();
+
+	for (unsigned int t = 0; t < indexNum / 3; t++) {
+		const unsigned int *tri = &indices[t * 3];
+		unsigned int newVertices = CountNewVertices(tri, stamp, current);
+
+		if (meshlet.triangleNum == MESHLET_MAX_TRIANGLES ||
+			meshlet.vertexNum + newVertices > MESHLET_MAX_VERTICES) {
+			ComputeBounds(positions, indices, meshlet);
+			meshlets.push_back(meshlet);
+
+			meshlet = Meshlet();
+			meshlet.triangleOffset = t;
+			current++;
+			newVertices = CountNewVertices(tri, stamp, current);
+		}
+
+		for (int k = 0; k < 3; k++)
+			stamp[tri[k]] = current;
+
+		meshlet.vertexNum += newVertices;
+		meshlet.triangleNum++;
+	}
+
+	if (meshlet.triangleNum > 0) {
+		ComputeBounds(positions, indices, meshlet);
+		meshlets.push_back(meshlet);
+	}
+}
+
+MeshletCuller::MeshletCuller(const float *mvp, const float *eye)
+{
+	// Gribb/Hartmann: the clip planes are sums and differences of the rows
+	// of the matrix. Column-major, so row i is mvp[i], mvp[4 + i], ...
+	for (int p = 0; p < 6; p++) {
+		const int row = p / 2;
+		const float sign = (p & 1) ? -1.0f : 1.0f;
+
+		for (int k = 0; k < 4; k++)
+			planes[p][k] = mvp[k * 4 + 3] + sign * mvp[k * 4 + row];
+	}
+
+	for (int k = 0; k < 3; k++)
+		this->eye[k] = eye[k];
+}
+
+bool MeshletCuller::InFrustum(const Meshlet &meshlet) const
+{
+	for (int p = 0; p < 6; p++) {
+		const float *plane = planes[p];
+		float distance = plane[0] * meshlet.center[0] + plane[1] * meshlet.center[1] + plane[2] * meshlet.center[2] + plane[3];
+		float scale = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+
+		if (distance < -meshlet.radius * scale)
+			return false;
+	}
+
+	return true;
+}
+
+bool MeshletCuller::IsBackfacing(const Meshlet &meshlet) const
+{
+	float d[3] = { meshlet.center[0] - eye[0], meshlet.center[1] - eye[1], meshlet.center[2] - eye[2] };
+	float length = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+
+	return d[0] * meshlet.coneAxis[0] + d[1] * meshlet.coneAxis[1] + d[2] * meshlet.coneAxis[2] >=
+		meshlet.coneCutoff * length + meshlet.radius;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+
+#define MESHLET_MAX_VERTICES	64
+#define MESHLET_MAX_TRIANGLES	124
+
+// A run of consecutive triangles of one submesh that touches at most
+// MESHLET_MAX_VERTICES vertices. The triangle order is left untouched, so a
+// meshlet is drawn straight out of the submesh's index range.
+struct Meshlet
+{
+	unsigned int triangleOffset;	// relative to the submesh
+	unsigned int triangleNum;
+	unsigned int vertexNum;
+
+	// Bounding sphere in model space
+	float center[3];
+	float radius;
+
+	// Normal cone: all triangles face away from any eye for which
+	// dot(center - eye, coneAxis) >= coneCutoff * |center - eye| + radius.
+	// coneCutoff is 1 when the normals spread too far to ever pass.
+	float coneAxis[3];
+	float coneCutoff;
+};
+
+class MeshletBuilder
+{
+public:
+	// Splits one submesh (indices relative to its first vertex) into
+	// meshlets and appends them. Feed it vertex cache optimized indices;
+	// that order already keeps neighbouring triangles together.
+	static void Build(const float *positions, unsigned int vertexNum,
+		const unsigned int *indices, unsigned int indexNum, std::vector<Meshlet> &meshlets);
+};
+
+// Frustum and backface tests for one view, done in the model space of the
+// meshlets so their bounds never have to be transformed
+class MeshletCuller
+{
+public:
+	// mvp: column-major model-view-projection, as glUniformMatrix4fv takes it
+	// without transpose. eye: camera position in model space.
+	MeshletCuller(const float *mvp, const float *eye);
+
+	bool IsVisible(const Meshlet &meshlet) const { return InFrustum(meshlet) && !IsBackfacing(meshlet); }
+	bool InFrustum(const Meshlet &meshlet) const;
+	bool IsBackfacing(const Meshlet &meshlet) const;
+
+private:
+	float planes[6][4];
+	float eye[3];
+};
@@ -0,0 +1,155 @@
+#include "GLSkinnedRenderer.h"
+#include "ogldev_skinned_mesh.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#define MAX_SKINNING_BONES 100	// MAX_BONES in skinning.vs
+
+struct SkinnedRenderer::State
+{
+	SkinnedMesh mesh;
+	vector<AffineTransform> bones;
+
+	GLuint programs[SkinnedMesh::NUM_INFLUENCE_CLASSES];
+	GLint wvpLocations[SkinnedMesh::NUM_INFLUENCE_CLASSES];
+	GLint worldLocations[SkinnedMesh::NUM_INFLUENCE_CLASSES];
+	GLint boneLocations[SkinnedMesh::NUM_INFLUENCE_CLASSES];
+
+	State()
+	{
+		for (unsigned int c = 0; c < SkinnedMesh::NUM_INFLUENCE_CLASSES; c++)
+			programs[c] = 0;
+	}
+
+	~State()
+	{
+		for (unsigned int c = 0; c < SkinnedMesh::NUM_INFLUENCE_CLASSES; c++)
+		{
+			if (programs[c] != 0)
+				glDeleteProgram(programs[c]);
+		}
+	}
+};
+
+static GLuint CompileShader(GLenum type, const string &source)
+{
+	GLuint shader = glCreateShader(type);
+
+	const char *text = source.c_str();
+	GLint length = source.length();
+	glShaderSource(shader, 1, &text, &length);
+	glCompileShader(shader);
+
+	GLint success;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+	if (!success)
+	{
+		GLchar log[1024];
+		glGetShaderInfoLog(shader, sizeof(log), NULL, log);
+		fprintf(stderr, "Error compiling shader type %d: '%s'\n", type, log);
+	}
+	return shader;
+}
+
+static GLuint LinkProgram(GLuint vertexShader, GLuint fragmentShader)
+{
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertexShader);
+	glAttachShader(program, fragmentShader);
+	glLinkProgram(program);
+	glDetachShader(program, vertexShader);
+	glDetachShader(program, fragmentShader);
+
+	GLint success;
+	glGetProgramiv(program, GL_LINK_STATUS, &success);
+	if (!success)
+	{
+		GLchar log[1024];
+		glGetProgramInfoLog(program, sizeof(log), NULL, log);
+		fprintf(stderr, "Error linking shader program: '%s'\n", log);
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+SkinnedRenderer::SkinnedRenderer() : loaded(false)
+{
+}
+
+SkinnedRenderer::~SkinnedRenderer()
+{
+}
+
+bool SkinnedRenderer::Load(const std::string &meshPath, const std::string &vertexShaderPath, const std::string &fragmentShaderPath)
+{
+	loaded = false;
+	state.reset(new State);
+
+	string vertexSource, fragmentSource;
+	if (!ReadFile(vertexShaderPath.c_str(), vertexSource) || !ReadFile(fragmentShaderPath.c_str(), fragmentSource))
+		return false;
+
+	GLuint fragmentShader = CompileShader(GL_FRAGMENT_SHADER, fragmentSource);
+	bool linked = true;
+
+	for (unsigned int c = 0; c < SkinnedMesh::NUM_INFLUENCE_CLASSES; c++)
+	{
+		GLuint vertexShader = CompileShader(GL_VERTEX_SHADER, SkinnedMesh::SkinningShaderSource(vertexSource, c));
+		GLuint program = LinkProgram(vertexShader, fragmentShader);
+		glDeleteShader(vertexShader);
+
+		state->programs[c] = program;
+		state->wvpLocations[c] = glGetUniformLocation(program, "gWVP");
+		state->worldLocations[c] = glGetUniformLocation(program, "gWorld");
+		state->boneLocations[c] = glGetUniformLocation(program, "gBones");
+		linked = linked && program != 0;
+	}
+
+	glDeleteShader(fragmentShader);
+
+	if (!linked || !state->mesh.LoadMesh(meshPath))
+		return false;
+
+	if (state->mesh.NumBones() > MAX_SKINNING_BONES)
+		printf("'%s': %u bones, skinning.vs only takes %u\n", meshPath.c_str(), state->mesh.NumBones(), MAX_SKINNING_BONES);
+
+	loaded = true;
+	return true;
+}
+
+unsigned int SkinnedRenderer::NumPrograms() const
+{
+	return SkinnedMesh::NUM_INFLUENCE_CLASSES;
+}
+
+GLuint SkinnedRenderer::Program(unsigned int influenceClass) const
+{
+	return state && influenceClass < SkinnedMesh::NUM_INFLUENCE_CLASSES ? state->programs[influenceClass] : 0;
+}
+
+void SkinnedRenderer::Render(float time, const float *wvp, const float *world)
+{
+	if (!loaded)
+		return;
+
+	state->mesh.BoneTransform(time, state->bones);
+	const unsigned int boneNum = std::min((unsigned int)state->bones.size(), (unsigned int)MAX_SKINNING_BONES);
+
+	GLint previous = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+
+	for (unsigned int c = 0; c < SkinnedMesh::NUM_INFLUENCE_CLASSES; c++)
+	{
+		glUseProgram(state->programs[c]);
+		glUniformMatrix4fv(state->wvpLocations[c], 1, GL_FALSE, wvp);
+		glUniformMatrix4fv(state->worldLocations[c], 1, GL_FALSE, world);
+		if (boneNum > 0)
+			glUniformMatrix4x3fv(state->boneLocations[c], boneNum, GL_TRUE, &state->bones[0].m[0][0]);
+
+		state->mesh.Render(c);
+	}
+
+	glUseProgram(previous);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <GL/glew.h>
+
+// Draws an animated SkinnedMesh with one skinning.vs variant per influence
+// class (SkinnedMesh::INFLUENCE_CLASS), so that triangles bound to fewer
+// bones run a shader that reads fewer. Kept apart from main.cpp, whose own
+// Texture and Material types clash with the ogldev ones.
+class SkinnedRenderer
+{
+public:
+	SkinnedRenderer();
+	~SkinnedRenderer();
+
+	// Links a program per class from skinning.vs and the fragment shader at
+	// fragmentShaderPath, then loads the mesh. Needs a current GL context.
+	bool Load(const std::string &meshPath, const std::string &vertexShaderPath, const std::string &fragmentShaderPath);
+
+	bool IsLoaded() const { return loaded; }
+
+	// The program that draws the triangles of one class, for uniforms the
+	// caller owns (lights, sampler)
+	unsigned int NumPrograms() const;
+	GLuint Program(unsigned int influenceClass) const;
+
+	// Poses the first animation at 'time' seconds and draws every class with
+	// its program. wvp and world are column-major, as glm stores them. The
+	// current program is restored afterwards.
+	void Render(float time, const float *wvp, const float *world);
+
+private:
+	struct State;
+
+	std::unique_ptr<State> state;
+	bool loaded;
+
+	SkinnedRenderer(const SkinnedRenderer &);
+	SkinnedRenderer &operator=(const SkinnedRenderer &);
+};
@@ -0,0 +1,369 @@
+#include "GLSkinning.h"
+#include "GLThreadPool.h"
+
+#include <cmath>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define SKINNING_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SKINNING_AVX2_FUNCTION
+#else
+// MSVC compiles AVX2 intrinsics anywhere; GCC and Clang need the target
+#define SKINNING_AVX2_FUNCTION __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+static inline const unsigned int *BoneIds(const SkinningInput &input, unsigned int v)
+{
+	return (const unsigned int*)((const unsigned char*)input.boneIds + (size_t)v * input.influenceStride);
+}
+
+static inline const float *BoneWeights(const SkinningInput &input, unsigned int v)
+{
+	return (const float*)((const unsigned char*)input.boneWeights + (size_t)v * input.influenceStride);
+}
+
+void SkinningPalette::Set(const float *matrices, unsigned int boneNum)
+{
+	columns.resize(boneNum * 16);
+
+	for (unsigned int b = 0; b < boneNum; b++) {
+		const float *m = matrices + b * 12;
+		float *c = &columns[b * 16];
+
+		// Column j of the row-major matrix is m[0][j], m[1][j], m[2][j]
+		for (int j = 0; j < 4; j++) {
+			c[j * 4 + 0] = m[0 * 4 + j];
+			c[j * 4 + 1] = m[1 * 4 + j];
+			c[j * 4 + 2] = m[2 * 4 + j];
+			c[j * 4 + 3] = 0.0f;
+		}
+	}
+}
+
+static void SkinScalar(const SkinningInput &input, const float *columns,
+	unsigned int begin, unsigned int end, const SkinnedVertices &out)
+{
+	for (unsigned int v = begin; v < end; v++) {
+		const unsigned int *ids = BoneIds(input, v);
+		const float *weights = BoneWeights(input, v);
+
+		float b[16] = { 0.0f };
+		for (int k = 0; k < SKINNING_INFLUENCES; k++) {
+			if (weights[k] == 0.0f)
+				continue;
+
+			const float *bone = columns + ids[k] * 16;
+			for (int j = 0; j < 16; j++)
+				b[j] += weights[k] * bone[j];
+		}
+
+		// Weights are sorted largest first; no influence at all keeps the bind pose
+		if (weights[0] == 0.0f)
+			b[0] = b[5] = b[10] = 1.0f;
+
+		const float *p = input.positions + v * 3;
+		const float *n = input.normals + v * 3;
+
+		out.positionX[v] = b[0] * p[0] + b[4] * p[1] + b[8] * p[2] + b[12];
+		out.positionY[v] = b[1] * p[0] + b[5] * p[1] + b[9] * p[2] + b[13];
+		out.positionZ[v] = b[2] * p[0] + b[6] * p[1] + b[10] * p[2] + b[14];
+
+		float nx = b[0] * n[0] + b[4] * n[1] + b[8] * n[2];
+		float ny = b[1] * n[0] + b[5] * n[1] + b[9] * n[2];
+		float nz = b[2] * n[0] + b[6] * n[1] + b[10] * n[2];
+		float length = sqrtf(nx * nx + ny * ny + nz * nz);
+		float scale = length > 0.0f ? 1.0f / length : 0.0f;
+
+		out.normalX[v] = nx * scale;
+		out.normalY[v] = ny * scale;
+		out.normalZ[v] = nz * scale;
+	}
+}
+
+// Without bones there is no palette to read: every vertex keeps its bind
+// pose, as a vertex without influences does in the kernels
+static void CopyBindPose(const SkinningInput &input, unsigned int begin, unsigned int end, const SkinnedVertices &out)
+{
+	for (unsigned int v = begin; v < end; v++) {
+		const float *p = input.positions + v * 3;
+		const float *n = input.normals + v * 3;
+
+		out.positionX[v] = p[0];
+		out.positionY[v] = p[1];
+		out.positionZ[v] = p[2];
+
+		float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		float scale = length > 0.0f ? 1.0f / length : 0.0f;
+
+		out.normalX[v] = n[0] * scale;
+		out.normalY[v] = n[1] * scale;
+		out.normalZ[v] = n[2] * scale;
+	}
+}
+
+#ifdef SKINNING_X86
+
+// Blended matrix of one vertex, transformed position and normal as xyz_
+static inline void SkinVertexSSE(const SkinningInput &input, const float *columns, unsigned int v,
+	__m128 &position, __m128 &normal)
+{
+	const unsigned int *ids = BoneIds(input, v);
+	const float *weights = BoneWeights(input, v);
+
+	__m128 w = _mm_set1_ps(weights[0]);
+	const float *bone = columns + ids[0] * 16;
+	__m128 c0 = _mm_mul_ps(w, _mm_loadu_ps(bone + 0));
+	__m128 c1 = _mm_mul_ps(w, _mm_loadu_ps(bone + 4));
+	__m128 c2 = _mm_mul_ps(w, _mm_loadu_ps(bone + 8));
+	__m128 c3 = _mm_mul_ps(w, _mm_loadu_ps(bone + 12));
+
+	for (int k = 1; k < SKINNING_INFLUENCES; k++) {
+		w = _mm_set1_ps(weights[k]);
+		bone = columns + ids[k] * 16;
+		c0 = _mm_add_ps(c0, _mm_mul_ps(w, _mm_loadu_ps(bone + 0)));
+		c1 = _mm_add_ps(c1, _mm_mul_ps(w, _mm_loadu_ps(bone + 4)));
+		c2 = _mm_add_ps(c2, _mm_mul_ps(w, _mm_loadu_ps(bone + 8)));
+		c3 = _mm_add_ps(c3, _mm_mul_ps(w, _mm_loadu_ps(bone + 12)));
+	}
+
+	if (weights[0] == 0.0f) {
+		c0 = _mm_setr_ps(1.0f, 0.0f, 0.0f, 0.0f);
+		c1 = _mm_setr_ps(0.0f, 1.0f, 0.0f, 0.0f);
+		c2 = _mm_setr_ps(0.0f, 0.0f, 1.0f, 0.0f);
+	}
+
+	const float *p = input.positions + v * 3;
+	const float *n = input.normals + v * 3;
+
+	position = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+		_mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])), c3));
+	normal = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n[0])), _mm_mul_ps(c1, _mm_set1_ps(n[1]))),
+		_mm_mul_ps(c2, _mm_set1_ps(n[2])));
+}
+
+static void SkinSSE(const SkinningInput &input, const float *columns,
+	unsigned int begin, unsigned int end, const SkinnedVertices &out)
+{
+	const __m128 tiny = _mm_set1_ps(1e-30f);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	unsigned int v = begin;
+	for (; v + 4 <= end; v += 4) {
+		__m128 p0, p1, p2, p3, n0, n1, n2, n3;
+		SkinVertexSSE(input, columns, v + 0, p0, n0);
+		SkinVertexSSE(input, columns, v + 1, p1, n1);
+		SkinVertexSSE(input, columns, v + 2, p2, n2);
+		SkinVertexSSE(input, columns, v + 3, p3, n3);
+
+		// xyz_ per vertex to x, y and z of four vertices
+		_MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+		_MM_TRANSPOSE4_PS(n0, n1, n2, n3);
+
+		_mm_storeu_ps(out.positionX + v, p0);
+		_mm_storeu_ps(out.positionY + v, p1);
+		_mm_storeu_ps(out.positionZ + v, p2);
+
+		__m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n0, n0), _mm_mul_ps(n1, n1)), _mm_mul_ps(n2, n2));
+		__m128 scale = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(lengthSq, tiny)));
+
+		_mm_storeu_ps(out.normalX + v, _mm_mul_ps(n0, scale));
+		_mm_storeu_ps(out.normalY + v, _mm_mul_ps(n1, scale));
+		_mm_storeu_ps(out.normalZ + v, _mm_mul_ps(n2, scale));
+	}
+
+	SkinScalar(input, columns, v, end, out);
+}
+
+SKINNING_AVX2_FUNCTION static inline __m256 Pair(__m128 a, __m128 b)
+{
+	return _mm256_insertf128_ps(_mm256_castps128_ps256(a), b, 1);
+}
+
+// Two vertices at once, one per 128-bit lane
+SKINNING_AVX2_FUNCTION static inline void SkinPairAVX2(const SkinningInput &input, const float *columns, unsigned int v,
+	__m256 &position, __m256 &normal)
+{
+	const unsigned int *idsA = BoneIds(input, v), *idsB = BoneIds(input, v + 1);
+	const float *weightsA = BoneWeights(input, v), *weightsB = BoneWeights(input, v + 1);
+
+	__m256 c0 = _mm256_setzero_ps(), c1 = _mm256_setzero_ps(), c2 = _mm256_setzero_ps(), c3 = _mm256_setzero_ps();
+
+	for (int k = 0; k < SKINNING_INFLUENCES; k++) {
+		const __m256 w = Pair(_mm_set1_ps(weightsA[k]), _mm_set1_ps(weightsB[k]));
+		const float *boneA = columns + idsA[k] * 16;
+		const float *boneB = columns + idsB[k] * 16;
+
+		c0 = _mm256_fmadd_ps(w, Pair(_mm_loadu_ps(boneA + 0), _mm_loadu_ps(boneB + 0)), c0);
+		c1 = _mm256_fmadd_ps(w, Pair(_mm_loadu_ps(boneA + 4), _mm_loadu_ps(boneB + 4)), c1);
+		c2 = _mm256_fmadd_ps(w, Pair(_mm_loadu_ps(boneA + 8), _mm_loadu_ps(boneB + 8)), c2);
+		c3 = _mm256_fmadd_ps(w, Pair(_mm_loadu_ps(boneA + 12), _mm_loadu_ps(boneB + 12)), c3);
+	}
+
+	// The all-zero matrix of a vertex without influences becomes the identity
+	const float noneA = weightsA[0] == 0.0f ? 1.0f : 0.0f;
+	const float noneB = weightsB[0] == 0.0f ? 1.0f : 0.0f;
+	c0 = _mm256_add_ps(c0, Pair(_mm_setr_ps(noneA, 0.0f, 0.0f, 0.0f), _mm_setr_ps(noneB, 0.0f, 0.0f, 0.0f)));
+	c1 = _mm256_add_ps(c1, Pair(_mm_setr_ps(0.0f, noneA, 0.0f, 0.0f), _mm_setr_ps(0.0f, noneB, 0.0f, 0.0f)));
+	c2 = _mm256_add_ps(c2, Pair(_mm_setr_ps(0.0f, 0.0f, noneA, 0.0f), _mm_setr_ps(0.0f, 0.0f, noneB, 0.0f)));
+
+	const float *pA = input.positions + v * 3, *pB = pA + 3;
+	const float *nA = input.normals + v * 3, *nB = nA + 3;
+
+	position = _mm256_fmadd_ps(c0, Pair(_mm_set1_ps(pA[0]), _mm_set1_ps(pB[0])),
+		_mm256_fmadd_ps(c1, Pair(_mm_set1_ps(pA[1]), _mm_set1_ps(pB[1])),
+		_mm256_fmadd_ps(c2, Pair(_mm_set1_ps(pA[2]), _mm_set1_ps(pB[2])), c3)));
+	normal = _mm256_fmadd_ps(c0, Pair(_mm_set1_ps(nA[0]), _mm_set1_ps(nB[0])),
+		_mm256_fmadd_ps(c1, Pair(_mm_set1_ps(nA[1]), _mm_set1_ps(nB[1])),
+		_mm256_mul_ps(c2, Pair(_mm_set1_ps(nA[2]), _mm_set1_ps(nB[2])))));
+}
+
+// r0..r3 hold vertices (0|1), (2|3), (4|5), (6|7) as xyz_; returns x, y
+// and z of all eight
+SKINNING_AVX2_FUNCTION static inline void Transpose8(__m256 r0, __m256 r1, __m256 r2, __m256 r3,
+	__m256 &x, __m256 &y, __m256 &z)
+{
+	__m256 t0 = _mm256_permute2f128_ps(r0, r2, 0x20);	// 0 | 4
+	__m256 t1 = _mm256_permute2f128_ps(r0, r2, 0x31);	// 1 | 5
+	__m256 t2 = _mm256_permute2f128_ps(r1, r3, 0x20);	// 2 | 6
+	__m256 t3 = _mm256_permute2f128_ps(r1, r3, 0x31);	// 3 | 7
+
+	__m256 a = _mm256_unpacklo_ps(t0, t1);
+	__m256 b = _mm256_unpackhi_ps(t0, t1);
+	__m256 c = _mm256_unpacklo_ps(t2, t3);
+	__m256 d = _mm256_unpackhi_ps(t2, t3);
+
+	x = _mm256_shuffle_ps(a, c, _MM_SHUFFLE(1, 0, 1, 0));
+	y = _mm256_shuffle_ps(a, c, _MM_SHUFFLE(3, 2, 3, 2));
+	z = _mm256_shuffle_ps(b, d, _MM_SHUFFLE(1, 0, 1, 0));
+}
+
+SKINNING_AVX2_FUNCTION static void SkinAVX2(const SkinningInput &input, const float *columns,
+	unsigned int begin, unsigned int end, const SkinnedVertices &out)
+{
+	const __m256 tiny = _mm256_set1_ps(1e-30f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+
+	unsigned int v = begin;
+	for (; v + 8 <= end; v += 8) {
+		__m256 p01, p23, p45, p67, n01, n23, n45, n67;
+		SkinPairAVX2(input, columns, v + 0, p01, n01);
+		SkinPairAVX2(input, columns, v + 2, p23, n23);
+		SkinPairAVX2(input, columns, v + 4, p45, n45);
+		SkinPairAVX2(input, columns, v + 6, p67, n67);
+
+		__m256 x, y, z;
+		Transpose8(p01, p23, p45, p67, x, y, z);
+		_mm256_storeu_ps(out.positionX + v, x);
+		_mm256_storeu_ps(out.positionY + v, y);
+		_mm256_storeu_ps(out.positionZ + v, z);
+
+		Transpose8(n01, n23, n45, n67, x, y, z);
+		__m256 lengthSq = _mm256_fmadd_ps(x, x, _mm256_fmadd_ps(y, y, _mm256_mul_ps(z, z)));
+		__m256 scale = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_max_ps(lengthSq, tiny)));
+		_mm256_storeu_ps(out.normalX + v, _mm256_mul_ps(x, scale));
+		_mm256_storeu_ps(out.normalY + v, _mm256_mul_ps(y, scale));
+		_mm256_storeu_ps(out.normalZ + v, _mm256_mul_ps(z, scale));
+	}
+
+	SkinSSE(input, columns, v, end, out);
+}
+
+static bool CpuHasAVX2()
+{
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	// FMA, OSXSAVE and AVX, and the OS saving the YMM registers
+	__cpuid(info, 1);
+	const int required = (1 << 12) | (1 << 27) | (1 << 28);
+	if ((info[2] & required) != required || (_xgetbv(0) & 6) != 6)
+		return false;
+
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+
+#endif // SKINNING_X86
+
+bool CpuSkinning::IsSupported(SkinningKernel kernel)
+{
+	switch (kernel) {
+	case SKINNING_SCALAR:
+		return true;
+#ifdef SKINNING_X86
+	case SKINNING_SSE:
+		return true;
+	case SKINNING_AVX2:
+	{
+		static const bool avx2 = CpuHasAVX2();
+		return avx2;
+	}
+#endif
+	default:
+		return false;
+	}
+}
+
+SkinningKernel CpuSkinning::BestKernel()
+{
+	if (IsSupported(SKINNING_AVX2))
+		return SKINNING_AVX2;
+	if (IsSupported(SKINNING_SSE))
+		return SKINNING_SSE;
+	return SKINNING_SCALAR;
+}
+
+const char *CpuSkinning::KernelName(SkinningKernel kernel)
+{
+	static const char *names[NUM_SKINNING_KERNELS] = { "scalar", "SSE", "AVX2" };
+	return kernel < NUM_SKINNING_KERNELS ? names[kernel] : "unknown";
+}
+
+void CpuSkinning::Skin(SkinningKernel kernel, const SkinningInput &input, const SkinningPalette &palette,
+	unsigned int begin, unsigned int end, const SkinnedVertices &out)
+{
+	if (palette.BoneNum() == 0) {
+		CopyBindPose(input, begin, end, out);
+		return;
+	}
+
+	if (!IsSupported(kernel))
+		kernel = BestKernel();
+
+	switch (kernel) {
+#ifdef SKINNING_X86
+	case SKINNING_AVX2:
+		SkinAVX2(input, palette.Columns(), begin, end, out);
+		break;
+	case SKINNING_SSE:
+		SkinSSE(input, palette.Columns(), begin, end, out);
+		break;
+#endif
+	default:
+		SkinScalar(input, palette.Columns(), begin, end, out);
+		break;
+	}
+}
+
+void CpuSkinning::SkinParallel(SkinningKernel kernel, const SkinningInput &input, const SkinningPalette &palette,
+	const SkinnedVertices &out)
+{
+	const unsigned int batchNum = (input.vertexNum + SKINNING_BATCH_VERTICES - 1) / SKINNING_BATCH_VERTICES;
+
+	ThreadPool::Shared().ParallelFor(batchNum, [&](unsigned int i)
+	{
+		unsigned int begin = i * SKINNING_BATCH_VERTICES;
+		unsigned int end = begin + SKINNING_BATCH_VERTICES < input.vertexNum ? begin + SKINNING_BATCH_VERTICES : input.vertexNum;
+		Skin(kernel, input, palette, begin, end, out);
+	});
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+
+#define SKINNING_INFLUENCES 4
+#define SKINNING_BATCH_VERTICES 2048	// vertices per ThreadPool item
+
+// Bind pose input, laid out like the vertex attributes of SkinnedMesh:
+// float3 positions and normals, and per vertex SKINNING_INFLUENCES bone
+// ids and weights that are 'influenceStride' bytes apart
+struct SkinningInput
+{
+	const float *positions;
+	const float *normals;
+	const unsigned int *boneIds;
+	const float *boneWeights;
+	unsigned int influenceStride;
+	unsigned int vertexNum;
+};
+
+// Caller-owned output, one array of vertexNum floats per component
+struct SkinnedVertices
+{
+	float *positionX;
+	float *positionY;
+	float *positionZ;
+	float *normalX;
+	float *normalY;
+	float *normalZ;
+};
+
+// Bone matrices rearranged for the kernels: per bone the four columns of
+// the upper 3x4 part, each padded to four floats
+class SkinningPalette
+{
+public:
+	// matrices: boneNum row-major 3x4 matrices (AffineTransform layout)
+	void Set(const float *matrices, unsigned int boneNum);
+
+	const float *Columns() const { return columns.empty() ? 0 : &columns[0]; }
+	unsigned int BoneNum() const { return columns.size() / 16; }
+
+private:
+	std::vector<float> columns;
+};
+
+enum SkinningKernel
+{
+	SKINNING_SCALAR,
+	SKINNING_SSE,	// 4 vertices per step
+	SKINNING_AVX2,	// 8 vertices per step, with FMA
+	NUM_SKINNING_KERNELS
+};
+
+// Linear blend skinning on the CPU, the same sum of weighted bone matrices
+// as the skinning vertex shader. Normals are renormalized. Vertices without
+// influences keep their bind pose, as in the shader, and so do all vertices
+// when the palette has no bones.
+class CpuSkinning
+{
+public:
+	// Skins vertices [begin, end) on the calling thread
+	static void Skin(SkinningKernel kernel, const SkinningInput &input, const SkinningPalette &palette,
+		unsigned int begin, unsigned int end, const SkinnedVertices &out);
+
+	// All vertices, in SKINNING_BATCH_VERTICES ranges on ThreadPool::Shared()
+	static void SkinParallel(SkinningKernel kernel, const SkinningInput &input, const SkinningPalette &palette,
+		const SkinnedVertices &out);
+
+	// Fastest kernel this CPU and build support
+	static SkinningKernel BestKernel();
+	static bool IsSupported(SkinningKernel kernel);
+	static const char *KernelName(SkinningKernel kernel);
+};
@@ -0,0 +1,103 @@
+#include "GLThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int numThreads) :
+	job(NULL), jobCount(0), jobId(0), next(0), running(false), busy(0), quit(false)
+{
+	if (numThreads == 0)
+		numThreads = std::thread::hardware_concurrency();
+	if (numThreads == 0)
+		numThreads = 1;
+
+	// The caller of ParallelFor is the last thread
+	for (unsigned int i = 1; i < numThreads; i++)
+		workers.push_back(std::thread(&ThreadPool::WorkerMain, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+
+	for (unsigned int i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+ThreadPool &ThreadPool::Shared()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+void ThreadPool::ParallelFor(unsigned int count, const std::function<void(unsigned int)> &fn)
+{
+	if (count == 0)
+		return;
+
+	bool idle = false;
+
+	if (workers.empty() || count == 1 || !running.compare_exchange_strong(idle, true)) {
+		for (unsigned int i = 0; i < count; i++)
+			fn(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &fn;
+		jobCount = count;
+		jobId++;
+		next = 0;
+		busy = (unsigned int)workers.size();
+	}
+	wake.notify_all();
+
+	RunItems(fn, count);
+
+	// fn lives on our stack, so wait until no worker can still touch it
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return busy == 0; });
+	job = NULL;
+	running = false;
+}
+
+void ThreadPool::RunItems(const std::function<void(unsigned int)> &fn, unsigned int count)
+{
+	for (;;) {
+		unsigned int i = next.fetch_add(1);
+		if (i >= count)
+			break;
+		fn(i);
+	}
+}
+
+void ThreadPool::WorkerMain()
+{
+	unsigned int seenId = 0;
+
+	for (;;) {
+		const std::function<void(unsigned int)> *fn;
+		unsigned int count;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this, seenId] { return quit || jobId != seenId; });
+			if (quit)
+				return;
+
+			seenId = jobId;
+			fn = job;
+			count = jobCount;
+		}
+
+		RunItems(*fn, count);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			busy--;
+		}
+		done.notify_one();
+	}
+}
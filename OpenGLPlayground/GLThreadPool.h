@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads used to fan out CPU-side work (mesh
+// conversion, skinning, ...). The calling thread joins in on every job.
+class ThreadPool
+{
+public:
+	// numThreads == 0 picks one thread per hardware core
+	explicit ThreadPool(unsigned int numThreads = 0);
+	~ThreadPool();
+
+	// Calls fn(i) for every i in [0, count) and returns once all calls are
+	// done. Items are handed out one at a time, so uneven items balance out.
+	// fn must only write state owned by item i.
+	// While another thread's job is running (or when called from inside
+	// fn) the items run serially on the calling thread instead.
+	void ParallelFor(unsigned int count, const std::function<void(unsigned int)> &fn);
+
+	unsigned int NumThreads() const { return (unsigned int)workers.size() + 1; }
+
+	// Pool shared by the loaders
+	static ThreadPool &Shared();
+
+private:
+	std::vector<std::thread> workers;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	// Current job, guarded by mutex except for the atomic cursor
+	const std::function<void(unsigned int)> *job;
+	unsigned int jobCount;
+	unsigned int jobId;
+	std::atomic<unsigned int> next;
+	std::atomic<bool> running;
+	unsigned int busy;
+	bool quit;
+
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+
+	void WorkerMain();
+	void RunItems(const std::function<void(unsigned int)> &fn, unsigned int count);
+};
@@ -0,0 +1,91 @@
+#include "GLTransformCompose.h"
+
+#include <cmath>
+
+// The rotation part of the quaternion, each column scaled
+static inline void RotationScaled(const float *scaling, const float *rotation, float r[3][3])
+{
+	const float x = rotation[0], y = rotation[1], z = rotation[2], w = rotation[3];
+
+	const float xx = x * x, yy = y * y, zz = z * z;
+	const float xy = x * y, xz = x * z, yz = y * z;
+	const float wx = w * x, wy = w * y, wz = w * z;
+
+	r[0][0] = (1.0f - 2.0f * (yy + zz)) * scaling[0];
+	r[0][1] = 2.0f * (xy - wz) * scaling[1];
+	r[0][2] = 2.0f * (xz + wy) * scaling[2];
+	r[1][0] = 2.0f * (xy + wz) * scaling[0];
+	r[1][1] = (1.0f - 2.0f * (xx + zz)) * scaling[1];
+	r[1][2] = 2.0f * (yz - wx) * scaling[2];
+	r[2][0] = 2.0f * (xz - wy) * scaling[0];
+	r[2][1] = 2.0f * (yz + wx) * scaling[1];
+	r[2][2] = (1.0f - 2.0f * (xx + yy)) * scaling[2];
+}
+
+void TransformCompose::ComposeTRS(const float *scaling, const float *rotation, const float *translation, float *out)
+{
+	float r[3][3];
+	RotationScaled(scaling, rotation, r);
+
+	for (int i = 0; i < 3; i++) {
+		out[i * 4 + 0] = r[i][0];
+		out[i * 4 + 1] = r[i][1];
+		out[i * 4 + 2] = r[i][2];
+		out[i * 4 + 3] = translation[i];
+	}
+}
+
+void TransformCompose::ComposeTRSColumns(const float *scaling, const float *rotation, const float *translation, float *out)
+{
+	float r[3][3];
+	RotationScaled(scaling, rotation, r);
+
+	for (int j = 0; j < 3; j++) {
+		out[j * 3 + 0] = r[0][j];
+		out[j * 3 + 1] = r[1][j];
+		out[j * 3 + 2] = r[2][j];
+	}
+
+	out[9] = translation[0];
+	out[10] = translation[1];
+	out[11] = translation[2];
+}
+
+void TransformCompose::ComposeTRSBatch(const float *scalings, const float *rotations, const float *translations, unsigned int stride,
+	unsigned int count, float *out)
+{
+	const unsigned char *s = (const unsigned char*)scalings;
+	const unsigned char *r = (const unsigned char*)rotations;
+	const unsigned char *t = (const unsigned char*)translations;
+
+	for (unsigned int i = 0; i < count; i++) {
+		const size_t offset = (size_t)i * stride;
+		ComposeTRS((const float*)(s + offset), (const float*)(r + offset), (const float*)(t + offset), out + (size_t)i * 12);
+	}
+}
+
+// Both products written out: three half-angle sine/cosine pairs instead of
+// three quaternions or matrices multiplied together
+void TransformCompose::QuaternionXYZ(float x, float y, float z, float *rotation)
+{
+	const float sx = sinf(x * 0.5f), cx = cosf(x * 0.5f);
+	const float sy = sinf(y * 0.5f), cy = cosf(y * 0.5f);
+	const float sz = sinf(z * 0.5f), cz = cosf(z * 0.5f);
+
+	rotation[0] = sx * cy * cz + cx * sy * sz;
+	rotation[1] = cx * sy * cz - sx * cy * sz;
+	rotation[2] = cx * cy * sz + sx * sy * cz;
+	rotation[3] = cx * cy * cz - sx * sy * sz;
+}
+
+void TransformCompose::QuaternionZYX(float x, float y, float z, float *rotation)
+{
+	const float sx = sinf(x * 0.5f), cx = cosf(x * 0.5f);
+	const float sy = sinf(y * 0.5f), cy = cosf(y * 0.5f);
+	const float sz = sinf(z * 0.5f), cz = cosf(z * 0.5f);
+
+	rotation[0] = sx * cy * cz - cx * sy * sz;
+	rotation[1] = cx * sy * cz + sx * cy * sz;
+	rotation[2] = cx * cy * sz - sx * sy * cz;
+	rotation[3] = cx * cy * cz + sx * sy * sz;
+}
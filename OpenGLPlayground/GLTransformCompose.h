@@ -0,0 +1,29 @@
+#pragma once
+
+// Builds transforms straight from scaling, rotation and translation:
+// translation * rotation * scaling in one pass, without the three
+// matrices and their products. Plain floats so that both the ogldev types
+// and glm can use it.
+//
+// scaling and translation are 3 floats, rotation a unit quaternion x, y, z, w.
+class TransformCompose
+{
+public:
+	// out: 12 floats, row-major 3x4 (AffineTransform, or the upper rows of a Matrix4f)
+	static void ComposeTRS(const float *scaling, const float *rotation, const float *translation, float *out);
+
+	// out: 12 floats, column-major 4x3 (glm::mat4x3)
+	static void ComposeTRSColumns(const float *scaling, const float *rotation, const float *translation, float *out);
+
+	// count transforms whose parts are 'stride' bytes apart in the three
+	// arrays (which may be fields of one array of structs); out gets 12
+	// floats per transform as in ComposeTRS
+	static void ComposeTRSBatch(const float *scalings, const float *rotations, const float *translations, unsigned int stride,
+		unsigned int count, float *out);
+
+	// Quaternion of the rotation X(x) * Y(y) * Z(z), angles in radians
+	static void QuaternionXYZ(float x, float y, float z, float *rotation);
+
+	// Quaternion of the rotation Z(z) * Y(y) * X(x), angles in radians
+	static void QuaternionZYX(float x, float y, float z, float *rotation);
+};
@@ -0,0 +1,111 @@
+#include "GLVertexStream.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define VERTEX_STREAM_SSE
+#include <immintrin.h>
+#endif
+
+void VertexStream::Copy3(const float *src, unsigned int count, float *dst, unsigned int dstStride)
+{
+	if (dstStride == 3 * sizeof(float)) {
+		memcpy(dst, src, (size_t)count * 3 * sizeof(float));
+		return;
+	}
+
+	unsigned char *out = (unsigned char*)dst;
+
+	for (unsigned int i = 0; i < count; i++, out += dstStride)
+		memcpy(out, src + (size_t)i * 3, 3 * sizeof(float));
+}
+
+void VertexStream::Copy3To2(const float *src, unsigned int count, float *dst, unsigned int dstStride)
+{
+	if (!src) {
+		const float zero[2] = { 0.0f, 0.0f };
+		Fill(zero, 2, count, dst, dstStride);
+		return;
+	}
+
+	unsigned int i = 0;
+
+#ifdef VERTEX_STREAM_SSE
+	// 4 elements per step: 3 loads of xyzx yzxy zxyz, 2 stores of xyxy
+	if (dstStride == 2 * sizeof(float)) {
+		for (; i + 4 <= count; i += 4) {
+			const float *s = src + (size_t)i * 3;
+			__m128 a = _mm_loadu_ps(s);
+			__m128 b = _mm_loadu_ps(s + 4);
+			__m128 c = _mm_loadu_ps(s + 8);
+
+			__m128 x1y1 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 3, 3));
+			_mm_storeu_ps(dst + (size_t)i * 2, _mm_shuffle_ps(a, x1y1, _MM_SHUFFLE(2, 0, 1, 0)));
+			_mm_storeu_ps(dst + (size_t)i * 2 + 4, _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2)));
+		}
+	}
+#endif
+
+	unsigned char *out = (unsigned char*)dst + (size_t)i * dstStride;
+
+	for (; i < count; i++, out += dstStride)
+		memcpy(out, src + (size_t)i * 3, 2 * sizeof(float));
+}
+
+void VertexStream::Fill(const float *value, unsigned int components, unsigned int count, float *dst, unsigned int dstStride)
+{
+	unsigned char *out = (unsigned char*)dst;
+
+	for (unsigned int i = 0; i < count; i++, out += dstStride)
+		memcpy(out, value, components * sizeof(float));
+}
+
+void VertexStream::Bounds3(const float *src, unsigned int count, float *minBound, float *maxBound)
+{
+	unsigned int i = 0;
+
+#ifdef VERTEX_STREAM_SSE
+	// 4 elements per step, each of the 3 loads with its own component order
+	if (count >= 4) {
+		__m128 minA = _mm_loadu_ps(src), maxA = minA;
+		__m128 minB = _mm_loadu_ps(src + 4), maxB = minB;
+		__m128 minC = _mm_loadu_ps(src + 8), maxC = minC;
+
+		for (i = 4; i + 4 <= count; i += 4) {
+			const float *s = src + (size_t)i * 3;
+			__m128 a = _mm_loadu_ps(s);
+			__m128 b = _mm_loadu_ps(s + 4);
+			__m128 c = _mm_loadu_ps(s + 8);
+
+			minA = _mm_min_ps(minA, a);
+			maxA = _mm_max_ps(maxA, a);
+			minB = _mm_min_ps(minB, b);
+			maxB = _mm_max_ps(maxB, b);
+			minC = _mm_min_ps(minC, c);
+			maxC = _mm_max_ps(maxC, c);
+		}
+
+		float lo[12], hi[12];
+		_mm_storeu_ps(lo, minA);
+		_mm_storeu_ps(lo + 4, minB);
+		_mm_storeu_ps(lo + 8, minC);
+		_mm_storeu_ps(hi, maxA);
+		_mm_storeu_ps(hi + 4, maxB);
+		_mm_storeu_ps(hi + 8, maxC);
+
+		// Lane k holds component k % 3
+		for (int k = 0; k < 12; k++) {
+			minBound[k % 3] = std::min(minBound[k % 3], lo[k]);
+			maxBound[k % 3] = std::max(maxBound[k % 3], hi[k]);
+		}
+	}
+#endif
+
+	for (; i < count; i++) {
+		for (int k = 0; k < 3; k++) {
+			minBound[k] = std::min(minBound[k], src[(size_t)i * 3 + k]);
+			maxBound[k] = std::max(maxBound[k], src[(size_t)i * 3 + k]);
+		}
+	}
+}
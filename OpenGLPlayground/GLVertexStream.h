@@ -0,0 +1,22 @@
+#pragma once
+
+// Whole-array conversions of imported vertex data (aiMesh::mVertices,
+// mNormals, mTextureCoords: float3 each) into the loaders' layouts. The
+// destination elements are 'dstStride' bytes apart: the element size for
+// a stream of its own, the vertex size to interleave into a vertex struct.
+class VertexStream
+{
+public:
+	// count float3
+	static void Copy3(const float *src, unsigned int count, float *dst, unsigned int dstStride);
+
+	// x and y of count float3, e.g. texture coordinates. src 0 (a mesh
+	// without the channel) writes zeros.
+	static void Copy3To2(const float *src, unsigned int count, float *dst, unsigned int dstStride);
+
+	// count copies of a value of 'components' floats
+	static void Fill(const float *value, unsigned int components, unsigned int count, float *dst, unsigned int dstStride);
+
+	// Widens minBound/maxBound (3 floats each) to enclose count float3
+	static void Bounds3(const float *src, unsigned int count, float *minBound, float *maxBound);
+};
@@ -1,7 +1,10 @@
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 #include <vector>
+#include <map>
 #include <sstream>
+#include <cstring>
 
 #define _USE_MATH_DEFINES // for C
 #include <math.h>
@@ -19,14 +22,32 @@
 #include "SOIL.h"
 
 #include "GLTextureFactory.h"
+#include "GLAsyncLoader.h"
+#include "GLGeometryRegistry.h"
+#include "GLMeshCache.h"
+#include "GLMeshlet.h"
+#include "GLMeshOptimizer.h"
+#include "GLMeshPacking.h"
+#include "GLMeshSimplifier.h"
+#include "GLSkinnedRenderer.h"
+#include "GLThreadPool.h"
+#include "GLVertexStream.h"
+#include "ogldev_util.h"
 
 using namespace std;
 
 #define DEFAULT_WIDTH 800
 #define DEFAULT_HEIGHT 600
+#define UPLOAD_BUDGET_MICROS 4000	// per frame, for models loading in the background
 #define ToRadian(x) (float)(((x) * M_PI / 180.0f))
 #define ToDegree(x) (float)(((x) * 180.0f / M_PI))
 #define INVALID 0xffffffff
+#define MESH_GROUP_IMPORT_FLAGS (aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_FindDegenerates)
+#define MIN_LOD_INDICES (3 * 128)	// submeshes smaller than this keep full detail only
+#define LOD_ERROR_PIXELS 1.0f	// largest simplification error drawn, projected to the screen
+
+static const MeshCacheFormat MeshGroupCacheFormat = { "group", MESH_GROUP_IMPORT_FLAGS,
+	MESH_CACHE_OPTIMIZED | MESH_CACHE_SHARED | MESH_CACHE_LODS };
 
 typedef GLint GLWindowID;
 
@@ -68,6 +89,37 @@ struct Vertex
 	~Vertex(){}
 };
 
+// Decoded pixels of a texture file. Decoding needs no GL context, so it
+// can run on a loader thread; Texture::Create uploads the result.
+struct TextureImage
+{
+	unsigned char *pixels;
+	int width;
+	int height;
+	int channels;
+
+	TextureImage() : pixels(NULL), width(0), height(0), channels(0) {}
+	~TextureImage() { Free(); }
+
+	bool Decode(const char *filepath)
+	{
+		Free();
+		pixels = SOIL_load_image(filepath, &width, &height, &channels, SOIL_LOAD_AUTO);
+		return pixels != NULL;
+	}
+
+	void Free()
+	{
+		if (pixels)
+			SOIL_free_image_data(pixels);
+		pixels = NULL;
+	}
+
+private:
+	TextureImage(const TextureImage &);
+	TextureImage &operator=(const TextureImage &);
+};
+
 struct Texture
 {
 	Texture(GLenum _target, const char *filepath)
@@ -97,6 +149,22 @@ struct Texture
 		return id > 0;
 	}
 
+	// Same as Load for pixels decoded earlier
+	bool Create(GLenum _target, const TextureImage &image)
+	{
+		target = _target;
+		id = SOIL_create_OGL_texture
+			(
+				image.pixels,
+				image.width,
+				image.height,
+				image.channels,
+				SOIL_CREATE_NEW_ID,
+				SOIL_FLAG_MIPMAPS | SOIL_FLAG_COMPRESS_TO_DXT
+				);
+		return id > 0;
+	}
+
 	void BindTexture(GLenum _unit)
 	{
 		glActiveTexture(_unit);
@@ -128,6 +196,19 @@ struct Material
 		return true;
 	}
 
+	bool AddTexture(GLenum target, const TextureImage &image)
+	{
+		Texture *texture = new Texture;
+		if (!texture->Create(target, image))
+		{
+			delete texture;
+			return false;
+		}
+
+		textures.push_back(texture);
+		return true;
+	}
+
 	void Bind()
 	{
 		for (int i = 0; i < textures.size(); i++)
@@ -145,77 +226,184 @@ struct Mesh
 	int baseVertex;
 	int materialIndex;
 	int indexNum;
+	int vertexNum;
+	GLenum indexType;
+	unsigned int indexOffset;	// bytes
+	PackedVertexRange packedRange;
+	unsigned int meshletOffset;	// into MeshGroup::meshlets
+	unsigned int meshletNum;
+
+	// Simplified levels, coarser with every step; indices are relative to
+	// baseVertex like the full detail ones
+	unsigned int lodNum;
+	int lodBaseIndex[MESH_CACHE_MAX_LODS];
+	int lodIndexNum[MESH_CACHE_MAX_LODS];
+	GLenum lodIndexType[MESH_CACHE_MAX_LODS];
+	unsigned int lodIndexOffset[MESH_CACHE_MAX_LODS];	// bytes
+	float lodError[MESH_CACHE_MAX_LODS];	// model units
+
+	glm::vec3 boundCenter;
+	float boundRadius;
 
 	Mesh() : 
+		baseIndex(INVALID),
+		baseVertex(INVALID),
 		materialIndex(INVALID),
 		indexNum(0),
-		baseIndex(INVALID),
-		baseVertex(INVALID){}
+		vertexNum(0),
+		indexType(GL_UNSIGNED_INT),
+		indexOffset(0),
+		meshletOffset(0),
+		meshletNum(0),
+		lodNum(0),
+		boundCenter(0),
+		boundRadius(0){}
 	~Mesh() {}
 };
 
 struct MeshGroup
 {
-	MeshGroup() : m_Buffers{ 0 } {}
+	MeshGroup() : vao(0), m_Buffers{ 0 }, packedVertices(false), packedUniforms{ -1, -1, -1, -1, -1 },
+		clusterCulling(false), cullViewSet(false), visibleClusters(0), lodViewSet(false), loaded(false) {}
 	~MeshGroup(){}
 
+	// Upload the 16 byte PackedVertex layout instead of full floats.
+	// Has to be called before Load.
+	void SetPackedVertices(bool packed)
+	{
+		packedVertices = packed;
+	}
+
+	// Split every submesh into meshlets at load and draw only the ones that
+	// pass the culling test against the view given to SetCullView.
+	// Has to be called before Load.
+	void SetClusterCulling(bool culling)
+	{
+		clusterCulling = culling;
+	}
+
+	// View used by the next Render: the model-view-projection matrix (as
+	// uploaded to gWVP before transposing) and the eye in model space
+	void SetCullView(const glm::mat4 &mvp, const glm::vec3 &eye)
+	{
+		memcpy(cullMVP, &mvp[0][0], sizeof(cullMVP));
+		cullEye[0] = eye.x;
+		cullEye[1] = eye.y;
+		cullEye[2] = eye.z;
+		cullViewSet = true;
+	}
+
+	// Picks the level of every submesh in the next Render: the coarsest one
+	// whose simplification error, projected at the submesh's distance from
+	// 'eye' (in model space), stays under LOD_ERROR_PIXELS. fovy is the
+	// vertical field of view in radians. Without a call every submesh is
+	// drawn at full detail.
+	void SetLodView(const glm::vec3 &eye, float fovy, unsigned int viewportHeight)
+	{
+		lodEye = eye;
+		lodPixelScale = viewportHeight / (2.0f * tanf(fovy * 0.5f));
+		lodViewSet = true;
+	}
+
+	// Meshlets drawn by the last Render, out of meshlets.size()
+	unsigned int VisibleClusters() const { return visibleClusters; }
+	unsigned int TotalClusters() const { return meshlets.size(); }
+
+	// Looks up the decode uniforms of shader.vs in 'program'
+	void SetProgram(GLuint program)
+	{
+		packedUniforms[PACKED_VERTEX] = glGetUniformLocation(program, "gPackedVertex");
+		packedUniforms[POSITION_SCALE] = glGetUniformLocation(program, "gPositionScale");
+		packedUniforms[POSITION_OFFSET] = glGetUniformLocation(program, "gPositionOffset");
+		packedUniforms[TEXCOORD_SCALE] = glGetUniformLocation(program, "gTexCoordScale");
+		packedUniforms[TEXCOORD_OFFSET] = glGetUniformLocation(program, "gTexCoordOffset");
+	}
+
 	bool Load(std::string filepath)
 	{
-		if (m_Buffers[0] != 0) {
-			glDeleteBuffers(4, m_Buffers);
-		}
+		loaded = false;
 
-		if (vao != 0) {
-			glDeleteVertexArrays(1, &vao);
-			vao = 0;
-		}
+		if (!Prepare(filepath))
+			return false;
 
-		glGenVertexArrays(1, &vao);
-		glBindVertexArray(vao);
-		glGenBuffers(sizeof(m_Buffers) / sizeof(GLuint), m_Buffers);
+		while (!FinishStep())
+			;
 
-		Assimp::Importer importer;
-		const aiScene *scene = importer.ReadFile(filepath,
-			aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_FindDegenerates);
-		bool result = false;
-		if (scene)
-		{
-			GLenum err = LoadScene(scene, filepath);
-			if (err != GL_NO_ERROR) 
-			{
-				result = false;
-				std::cerr << "Mesh load error " << glewGetErrorString(err) << std::endl;
-			}
-		}
-		else
-		{
-			std::cerr << "Mesh import error " << filepath << std::endl;
-		}
+		return loaded;
+	}
 
-		glBindVertexArray(0);
+	// Same as Load, but import, conversion and texture decoding run on
+	// AsyncLoader::Shared() and the GL objects are created by its Update
+	// calls. Render draws nothing until the handle is ready.
+	AsyncLoadHandle LoadAsync(const std::string &filepath)
+	{
+		loaded = false;
 
-		return result;
+		return AsyncLoader::Shared().Load(
+			[this, filepath]() { return Prepare(filepath); },
+			[this]() { return FinishStep(); });
 	}
 
+	bool IsLoaded() const { return loaded; }
+
 	void Render()
 	{
+		if (!loaded)
+			return;
+
 		glBindVertexArray(vao);
 
+		glUniform1i(packedUniforms[PACKED_VERTEX], packedVertices);
+
+		const bool culling = clusterCulling && cullViewSet;
+		const MeshletCuller culler(cullMVP, cullEye);
+		visibleClusters = 0;
+
 		for (unsigned int i = 0; i < meshs.size(); i++) {
 			const unsigned int MaterialIndex = meshs[i].materialIndex;
 
+			if (packedVertices) {
+				const PackedVertexRange &range = meshs[i].packedRange;
+				glUniform3fv(packedUniforms[POSITION_SCALE], 1, range.positionScale);
+				glUniform3fv(packedUniforms[POSITION_OFFSET], 1, range.positionOffset);
+				glUniform2fv(packedUniforms[TEXCOORD_SCALE], 1, range.texcoordScale);
+				glUniform2fv(packedUniforms[TEXCOORD_OFFSET], 1, range.texcoordOffset);
+			}
+
 			assert(MaterialIndex < materials.size());
 
 			if (MaterialIndex < meshs.size()) {
 				materials[MaterialIndex].Bind();
 			}
+
+			const unsigned int lod = SelectLod(meshs[i]);
+
+			// Meshlets cover the full detail triangles only
+			if (lod == 0 && culling && meshs[i].meshletNum > 0) {
+				DrawClusters(meshs[i], culler);
+				continue;
+			}
+
+			if (lod > 0) {
+				glDrawElementsBaseVertex(GL_TRIANGLES,
+					meshs[i].lodIndexNum[lod - 1],
+					meshs[i].lodIndexType[lod - 1],
+					(void*)(size_t)meshs[i].lodIndexOffset[lod - 1],
+					meshs[i].baseVertex);
+				continue;
+			}
+
 			glDrawElementsBaseVertex(GL_TRIANGLES,
 				meshs[i].indexNum,
-				GL_UNSIGNED_INT,
-				(void*)(sizeof(unsigned int) * meshs[i].baseIndex),
+				meshs[i].indexType,
+				(void*)(size_t)meshs[i].indexOffset,
 				meshs[i].baseVertex);
 		}
 
+		// The program is shared with unpacked draws
+		if (packedVertices)
+			glUniform1i(packedUniforms[PACKED_VERTEX], 0);
+
 		// Make sure the VAO is not changed from the outside    
 		glBindVertexArray(0);
 	}
@@ -229,20 +417,359 @@ private:
 #define TEX_COORD_LOCATION 1
 #define NORMAL_LOCATION 2
 
+	enum PackedUniform
+	{
+		PACKED_VERTEX,
+		POSITION_SCALE,
+		POSITION_OFFSET,
+		TEXCOORD_SCALE,
+		TEXCOORD_OFFSET,
+		NUM_PACKED_UNIFORMS
+	};
+
 	std::vector<Mesh> meshs;
 	std::vector<Material> materials;
 	GLuint vao;
 	GLuint m_Buffers[4];
-
-	GLenum LoadScene(const aiScene *scene, const std::string &filepath)
+	bool packedVertices;
+	GLint packedUniforms[NUM_PACKED_UNIFORMS];
+
+	bool clusterCulling;
+	std::vector<Meshlet> meshlets;
+	float cullMVP[16];
+	float cullEye[3];
+	bool cullViewSet;
+	unsigned int visibleClusters;
+
+	glm::vec3 lodEye;
+	float lodPixelScale;	// pixels covered by one model unit at distance one
+	bool lodViewSet;
+
+	// CPU side of a load: filled by Prepare on any thread, consumed and
+	// released by FinishStep on the GL thread
+	struct Staging
 	{
-		meshs.resize(scene->mNumMeshes);
-		materials.resize(scene->mNumMaterials);
-
+		MeshCache cache;
 		std::vector<glm::vec3> positions;
 		std::vector<glm::vec2> texcoords;
 		std::vector<glm::vec3> normals;
 		std::vector<unsigned int> indices;
+		std::vector<std::string> texturePaths;
+		std::unique_ptr<TextureImage[]> images;
+		unsigned int nextMaterial;
+
+		// Points into the vectors above or into the mapped cache
+		MeshCacheData data;
+
+		Staging() : nextMaterial(0) {}
+	};
+
+	std::unique_ptr<Staging> staging;
+	bool loaded;
+
+	// Per-frame multi-draw lists, kept to avoid reallocating
+	std::vector<GLsizei> drawCounts;
+	std::vector<const GLvoid*> drawOffsets;
+	std::vector<GLint> drawBaseVertices;
+
+	// 0 for full detail, otherwise 1 + the index into the mesh's lod arrays
+	unsigned int SelectLod(const Mesh &mesh) const
+	{
+		if (!lodViewSet || mesh.lodNum == 0)
+			return 0;
+
+		const float distance = glm::length(mesh.boundCenter - lodEye) - mesh.boundRadius;
+
+		// Eye inside the bounding sphere
+		if (distance <= 0.0f)
+			return 0;
+
+		// The errors only grow from level to level
+		unsigned int lod = 0;
+		while (lod < mesh.lodNum && mesh.lodError[lod] * lodPixelScale / distance <= LOD_ERROR_PIXELS)
+			lod++;
+
+		return lod;
+	}
+
+	// One multi-draw over the visible meshlets of a submesh. Neighbouring
+	// visible meshlets are contiguous in the index buffer and merge into one range.
+	void DrawClusters(const Mesh &mesh, const MeshletCuller &culler)
+	{
+		drawCounts.clear();
+		drawOffsets.clear();
+		drawBaseVertices.clear();
+
+		const unsigned int indexSize = MeshPacking::IndexSize(mesh.indexType);
+		unsigned int lastEnd = INVALID;
+
+		for (unsigned int i = 0; i < mesh.meshletNum; i++)
+		{
+			const Meshlet &meshlet = meshlets[mesh.meshletOffset + i];
+
+			if (!culler.IsVisible(meshlet))
+				continue;
+
+			if (meshlet.triangleOffset == lastEnd)
+			{
+				drawCounts.back() += meshlet.triangleNum * 3;
+			}
+			else
+			{
+				drawCounts.push_back(meshlet.triangleNum * 3);
+				drawOffsets.push_back((const GLvoid*)(size_t)(mesh.indexOffset + meshlet.triangleOffset * 3 * indexSize));
+				drawBaseVertices.push_back(mesh.baseVertex);
+			}
+
+			lastEnd = meshlet.triangleOffset + meshlet.triangleNum;
+			visibleClusters++;
+		}
+
+		if (!drawCounts.empty())
+		{
+			glMultiDrawElementsBaseVertex(GL_TRIANGLES, &drawCounts[0], mesh.indexType,
+				&drawOffsets[0], drawCounts.size(), &drawBaseVertices[0]);
+		}
+	}
+
+	// Meshlets for every submesh, in submesh order
+	void BuildMeshlets(const float *positions, const unsigned int *indices)
+	{
+		std::vector<std::vector<Meshlet> > perMesh(meshs.size());
+
+		ThreadPool::Shared().ParallelFor(meshs.size(), [&](unsigned int i)
+		{
+			MeshletBuilder::Build(positions + meshs[i].baseVertex * 3, meshs[i].vertexNum,
+				indices + meshs[i].baseIndex, meshs[i].indexNum, perMesh[i]);
+		});
+
+		meshlets.clear();
+		unsigned int triangleNum = 0;
+		for (unsigned int i = 0; i < meshs.size(); i++)
+		{
+			meshs[i].meshletOffset = meshlets.size();
+			meshs[i].meshletNum = perMesh[i].size();
+			meshlets.insert(meshlets.end(), perMesh[i].begin(), perMesh[i].end());
+			triangleNum += meshs[i].indexNum / 3;
+		}
+
+		printf("Meshlets: %u for %u triangles\n", (unsigned int)meshlets.size(), triangleNum);
+	}
+
+	// Simplified index ranges for every submesh, appended behind all full
+	// detail indices. Shared submeshes are simplified once.
+	void BuildLods(std::vector<MeshCacheEntry> &entries)
+	{
+		const std::vector<glm::vec3> &positions = staging->positions;
+		std::vector<unsigned int> &indices = staging->indices;
+
+		std::vector<std::vector<unsigned int> > lods(meshs.size() * MESH_CACHE_MAX_LODS);
+		std::vector<float> errors(meshs.size() * MESH_CACHE_MAX_LODS);
+
+		// The first submesh at every baseIndex; empty ones share theirs with the next
+		std::vector<unsigned int> original(meshs.size());
+		std::map<int, unsigned int> firstAt;
+		for (unsigned int i = 0; i < meshs.size(); i++)
+		{
+			original[i] = i;
+			if (meshs[i].indexNum == 0)
+				continue;
+
+			std::map<int, unsigned int>::iterator it = firstAt.find(meshs[i].baseIndex);
+			if (it != firstAt.end())
+				original[i] = it->second;
+			else
+				firstAt[meshs[i].baseIndex] = i;
+		}
+
+		long long start = GetCurrentTimeMicros();
+
+		ThreadPool::Shared().ParallelFor(meshs.size(), [&](unsigned int i)
+		{
+			Mesh &mesh = meshs[i];
+			if (original[i] != i || mesh.indexNum == 0)
+				return;
+
+			std::vector<unsigned int> *meshLods = &lods[i * MESH_CACHE_MAX_LODS];
+
+			mesh.lodNum = MeshSimplifier::BuildLodChain(&positions[mesh.baseVertex].x, mesh.vertexNum,
+				&indices[mesh.baseIndex], mesh.indexNum, MIN_LOD_INDICES,
+				MESH_CACHE_MAX_LODS, meshLods, &errors[i * MESH_CACHE_MAX_LODS]);
+
+			for (unsigned int j = 0; j < mesh.lodNum; j++)
+				MeshOptimizer::OptimizeVertexCache(&meshLods[j][0], meshLods[j].size(), mesh.vertexNum);
+		});
+
+		const unsigned int fullIndexNum = indices.size();
+
+		for (unsigned int i = 0; i < meshs.size(); i++)
+		{
+			Mesh &mesh = meshs[i];
+
+			if (original[i] != i)
+			{
+				const Mesh &source = meshs[original[i]];
+				mesh.lodNum = source.lodNum;
+				std::copy(source.lodBaseIndex, source.lodBaseIndex + source.lodNum, mesh.lodBaseIndex);
+				std::copy(source.lodIndexNum, source.lodIndexNum + source.lodNum, mesh.lodIndexNum);
+				std::copy(source.lodError, source.lodError + source.lodNum, mesh.lodError);
+			}
+			else
+			{
+				for (unsigned int j = 0; j < mesh.lodNum; j++)
+				{
+					const std::vector<unsigned int> &lod = lods[i * MESH_CACHE_MAX_LODS + j];
+
+					mesh.lodBaseIndex[j] = indices.size();
+					mesh.lodIndexNum[j] = lod.size();
+					mesh.lodError[j] = errors[i * MESH_CACHE_MAX_LODS + j];
+
+					indices.insert(indices.end(), lod.begin(), lod.end());
+				}
+			}
+
+			entries[i].numLods = mesh.lodNum;
+			for (unsigned int j = 0; j < mesh.lodNum; j++)
+			{
+				entries[i].lodBaseIndex[j] = mesh.lodBaseIndex[j];
+				entries[i].lodNumIndices[j] = mesh.lodIndexNum[j];
+				entries[i].lodError[j] = mesh.lodError[j];
+			}
+		}
+
+		printf("Built LODs: %u indices on top of %u full detail (%.1f ms)\n",
+			(unsigned int)indices.size() - fullIndexNum, fullIndexNum, (GetCurrentTimeMicros() - start) / 1000.0);
+	}
+
+	// Bounding sphere of every submesh, for SelectLod
+	void ComputeBounds(const float *positions)
+	{
+		for (unsigned int i = 0; i < meshs.size(); i++)
+		{
+			Mesh &mesh = meshs[i];
+			if (mesh.vertexNum == 0)
+				continue;
+
+			glm::vec3 minBound, maxBound;
+			VertexStream::Bounds3(positions + mesh.baseVertex * 3, mesh.vertexNum, &minBound.x, &maxBound.x);
+			mesh.boundCenter = (minBound + maxBound) * 0.5f;
+			mesh.boundRadius = glm::length(maxBound - minBound) * 0.5f;
+		}
+	}
+
+	// CPU half of a load; makes no GL calls
+	bool Prepare(const std::string &filepath)
+	{
+		staging.reset(new Staging);
+
+		bool result = false;
+
+		// Warm start: the baked cache already holds the final arrays
+		if (staging->cache.Open(filepath, MeshGroupCacheFormat))
+		{
+			PrepareCache(staging->cache);
+			result = true;
+		}
+		else
+		{
+			long long start = GetCurrentTimeMicros();
+			Assimp::Importer importer;
+			const aiScene *scene = importer.ReadFile(filepath, MESH_GROUP_IMPORT_FLAGS);
+			printf("'%s': import %.2f ms\n", filepath.c_str(), (GetCurrentTimeMicros() - start) / 1000.0f);
+			if (scene)
+			{
+				PrepareScene(scene, filepath);
+				result = true;
+			}
+			else
+			{
+				std::cerr << "Mesh import error " << filepath << std::endl;
+			}
+		}
+
+		if (!result)
+		{
+			staging.reset();
+			return false;
+		}
+
+		if (clusterCulling)
+			BuildMeshlets(staging->data.positions, staging->data.indices);
+
+		ComputeBounds(staging->data.positions);
+
+		DecodeTextures();
+
+		return true;
+	}
+
+	// GL half of a load: one texture per call, then the geometry. Returns
+	// true once the group is ready to render.
+	bool FinishStep()
+	{
+		Staging &stage = *staging;
+
+		if (stage.nextMaterial < stage.texturePaths.size())
+		{
+			const unsigned int i = stage.nextMaterial++;
+			const std::string &path = stage.texturePaths[i];
+
+			if (stage.images[i].pixels)
+			{
+				if (materials[i].AddTexture(GL_TEXTURE_2D, stage.images[i]))
+					printf("Loaded texture '%s'\n", path.c_str());
+				else
+					printf("Error loading texture '%s'\n", path.c_str());
+			}
+
+			stage.images[i].Free();
+			return false;
+		}
+
+		if (m_Buffers[0] != 0) {
+			glDeleteBuffers(4, m_Buffers);
+		}
+
+		if (vao != 0) {
+			glDeleteVertexArrays(1, &vao);
+			vao = 0;
+		}
+
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+		glGenBuffers(sizeof(m_Buffers) / sizeof(GLuint), m_Buffers);
+
+		long long start = GetCurrentTimeMicros();
+
+		const MeshCacheData &data = stage.data;
+		GLenum err = Upload(data.positions, data.texcoords, data.normals, data.numVertices,
+			data.indices, data.numIndices);
+
+		printf("Upload %.2f ms\n", (GetCurrentTimeMicros() - start) / 1000.0f);
+
+		glBindVertexArray(0);
+
+		if (err != GL_NO_ERROR)
+		{
+			std::cerr << "Mesh load error " << glewGetErrorString(err) << std::endl;
+		}
+
+		staging.reset();
+		loaded = (err == GL_NO_ERROR);
+
+		return true;
+	}
+
+	void PrepareScene(const aiScene *scene, const std::string &filepath)
+	{
+		meshs.resize(scene->mNumMeshes);
+		materials.resize(scene->mNumMaterials);
+
+		std::vector<glm::vec3> &positions = staging->positions;
+		std::vector<glm::vec2> &texcoords = staging->texcoords;
+		std::vector<glm::vec3> &normals = staging->normals;
+		std::vector<unsigned int> &indices = staging->indices;
+		std::vector<MeshCacheEntry> entries(scene->mNumMeshes);
 
 		unsigned int vertexNum = 0;
 		unsigned int indexNum = 0;
@@ -254,85 +781,405 @@ private:
 			meshs[i].baseIndex = indexNum;
 			meshs[i].materialIndex = mesh->mMaterialIndex;
 			meshs[i].indexNum = mesh->mNumFaces * 3;
+			meshs[i].vertexNum = mesh->mNumVertices;
+
+			entries[i].baseVertex = vertexNum;
+			entries[i].numVertices = mesh->mNumVertices;
+			entries[i].baseIndex = indexNum;
+			entries[i].numIndices = meshs[i].indexNum;
+			entries[i].materialIndex = mesh->mMaterialIndex;
 
 			vertexNum += mesh->mNumVertices;
 			indexNum += meshs[i].indexNum;
 		}
 
-		positions.reserve(vertexNum);
-		texcoords.reserve(vertexNum);
-		normals.reserve(vertexNum);
-		indices.reserve(indexNum);
+		// Each submesh converts into its own slice, so the vectors are sized up front
+		positions.resize(vertexNum);
+		texcoords.resize(vertexNum);
+		normals.resize(vertexNum);
+		indices.resize(indexNum);
 
-		for (int i = 0; i < scene->mNumMeshes; i++)
+		long long start = GetCurrentTimeMicros();
+
+		std::vector<VertexCacheStats> before(scene->mNumMeshes), after(scene->mNumMeshes);
+
+		ThreadPool::Shared().ParallelFor(scene->mNumMeshes, [&](unsigned int i)
 		{
-			const aiMesh *mesh = scene->mMeshes[i];
-			if (!LoadMesh(mesh, positions, texcoords, normals, indices))
-				return false;
+			LoadMesh(scene->mMeshes[i], meshs[i], &positions[0], &texcoords[0], &normals[0], &indices[0]);
+			OptimizeMesh(entries[i], &positions[0], &texcoords[0], &normals[0], &indices[0], before[i], after[i]);
+		});
+
+		size_t savedBytes = DeduplicateMeshes(entries);
+		if (savedBytes > 0)
+			printf("'%s': %u KB of repeated submeshes shared\n", filepath.c_str(), (unsigned int)(savedBytes / 1024));
+
+		BuildLods(entries);
+
+		long long convertTime = GetCurrentTimeMicros();
+
+		VertexCacheStats totalBefore, totalAfter;
+		for (unsigned int i = 0; i < scene->mNumMeshes; i++)
+		{
+			totalBefore += before[i];
+			totalAfter += after[i];
 		}
+		MeshOptimizer::PrintStats(filepath.c_str(), totalBefore, totalAfter);
+
+		GetTexturePaths(scene, filepath, staging->texturePaths);
+
+		MeshCacheData &data = staging->data;
+		data.positions = &positions[0].x;
+		data.normals = &normals[0].x;
+		data.texcoords = &texcoords[0].x;
+		data.indices = &indices[0];
+		data.numVertices = positions.size();
+		data.numIndices = indices.size();
+		data.entries = &entries[0];
+		data.numEntries = entries.size();
+		data.texturePaths = &staging->texturePaths;
+		MeshCache::Write(filepath, MeshGroupCacheFormat, data);
+
+		// Only valid during the write
+		data.entries = NULL;
+		data.numEntries = 0;
+
+		long long cacheTime = GetCurrentTimeMicros();
+
+		printf("'%s': %d meshes on %d threads - convert %.2f ms, cache %.2f ms\n",
+			filepath.c_str(), (int)meshs.size(), ThreadPool::Shared().NumThreads(),
+			(convertTime - start) / 1000.0f, (cacheTime - convertTime) / 1000.0f);
+	}
 
-		if (!LoadMaterial(scene, filepath))
-			return false;
+	void PrepareCache(const MeshCache &cache)
+	{
+		meshs.resize(cache.NumEntries());
+		materials.resize(cache.NumMaterials());
+
+		const MeshCacheEntry *entries = cache.Entries();
+		for (unsigned int i = 0; i < cache.NumEntries(); i++)
+		{
+			meshs[i].baseVertex = entries[i].baseVertex;
+			meshs[i].baseIndex = entries[i].baseIndex;
+			meshs[i].materialIndex = entries[i].materialIndex;
+			meshs[i].indexNum = entries[i].numIndices;
+			meshs[i].vertexNum = entries[i].numVertices;
+
+			meshs[i].lodNum = entries[i].numLods;
+			for (unsigned int j = 0; j < entries[i].numLods; j++)
+			{
+				meshs[i].lodBaseIndex[j] = entries[i].lodBaseIndex[j];
+				meshs[i].lodIndexNum[j] = entries[i].lodNumIndices[j];
+				meshs[i].lodError[j] = entries[i].lodError[j];
+			}
+		}
+
+		staging->texturePaths.resize(cache.NumMaterials());
+		for (unsigned int i = 0; i < cache.NumMaterials(); i++)
+		{
+			staging->texturePaths[i] = cache.TexturePath(i);
+		}
+
+		// Straight from the mapped file into the buffer objects
+		MeshCacheData &data = staging->data;
+		data.positions = cache.Positions();
+		data.texcoords = cache.TexCoords();
+		data.normals = cache.Normals();
+		data.indices = cache.Indices();
+		data.numVertices = cache.NumVertices();
+		data.numIndices = cache.NumIndices();
+	}
+
+	// Decodes every material's texture into staging->images, in parallel
+	void DecodeTextures()
+	{
+		const std::vector<std::string> &paths = staging->texturePaths;
+		staging->images.reset(new TextureImage[paths.size()]);
+
+		ThreadPool::Shared().ParallelFor(paths.size(), [&](unsigned int i)
+		{
+			if (!paths[i].empty() && !staging->images[i].Decode(paths[i].c_str()))
+				printf("Error decoding texture '%s'\n", paths[i].c_str());
+		});
+	}
+
+	GLenum Upload(const float *positions, const float *texcoords, const float *normals, unsigned int vertexNum,
+		const unsigned int *indices, unsigned int indexNum)
+	{
+		if (packedVertices)
+			return UploadPacked(positions, texcoords, normals, vertexNum, indices, indexNum);
 
 		glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[POS_VB]);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(positions[0]) * positions.size(), &positions[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * vertexNum, positions, GL_STATIC_DRAW);
 		glEnableVertexAttribArray(POSITION_LOCATION);
 		glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
 		glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[TEXCOORD_VB]);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(texcoords[0]) * texcoords.size(), &texcoords[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * vertexNum, texcoords, GL_STATIC_DRAW);
 		glEnableVertexAttribArray(TEX_COORD_LOCATION);
 		glVertexAttribPointer(TEX_COORD_LOCATION, 2, GL_FLOAT, GL_FALSE, 0, 0);
 
 		glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[NORMAL_VB]);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(normals[0]) * normals.size(), &normals[0], GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * vertexNum, normals, GL_STATIC_DRAW);
 		glEnableVertexAttribArray(NORMAL_LOCATION);
 		glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices[0]) * indices.size(), &indices[0], GL_STATIC_DRAW);
+		UploadIndices(indices, indexNum);
 
 		return glGetError();
 	}
 
-	bool LoadMesh(const aiMesh *mesh, 
-		std::vector<glm::vec3> &positions,
-		std::vector<glm::vec2> &texcoords,
-		std::vector<glm::vec3> &normals,
-		std::vector<unsigned int> &indices)
+	// 16-bit indices for every submesh whose vertices fit, 32-bit otherwise
+	void UploadIndices(const unsigned int *indices, unsigned int indexNum)
 	{
-		const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
-		for (int i = 0; i < mesh->mNumVertices; i++)
+		std::vector<unsigned char> packed;
+		packed.reserve(sizeof(unsigned int) * indexNum);
+
+		// Deduplicated submeshes share a baseIndex and get the same range
+		std::map<int, unsigned int> packedAt;
+
+		for (unsigned int i = 0; i < meshs.size(); i++)
 		{
-			const aiVector3D *pos = &mesh->mVertices[i];
-			const aiVector3D* texcoord = mesh->HasTextureCoords(0) ? 
-				&(mesh->mTextureCoords[0][i]) : &Zero3D;
-			const aiVector3D *normal = &mesh->mNormals[i];
-			positions.push_back(glm::vec3(pos->x, pos->y, pos->z));
-			texcoords.push_back(glm::vec2(texcoord->x, texcoord->y));
-			normals.push_back(glm::vec3(normal->x, normal->y, normal->z));
+			Mesh &mesh = meshs[i];
+
+			// Draws nothing, and its baseIndex belongs to the next submesh
+			if (mesh.indexNum == 0)
+				continue;
+
+			std::map<int, unsigned int>::iterator it = packedAt.find(mesh.baseIndex);
+			if (it != packedAt.end())
+			{
+				const Mesh &source = meshs[it->second];
+				mesh.indexType = source.indexType;
+				mesh.indexOffset = source.indexOffset;
+				std::copy(source.lodIndexType, source.lodIndexType + source.lodNum, mesh.lodIndexType);
+				std::copy(source.lodIndexOffset, source.lodIndexOffset + source.lodNum, mesh.lodIndexOffset);
+				continue;
+			}
+			packedAt[mesh.baseIndex] = i;
+
+			PackedIndexRange range = MeshPacking::AppendIndices(packed, indices + mesh.baseIndex, mesh.indexNum);
+			mesh.indexType = range.type;
+			mesh.indexOffset = range.offset;
+
+			for (unsigned int j = 0; j < mesh.lodNum; j++)
+			{
+				range = MeshPacking::AppendIndices(packed, indices + mesh.lodBaseIndex[j], mesh.lodIndexNum[j]);
+				mesh.lodIndexType[j] = range.type;
+				mesh.lodIndexOffset[j] = range.offset;
+			}
 		}
+
+		printf("Packed indices: %u KB -> %u KB\n",
+			(unsigned int)(indexNum * sizeof(unsigned int) / 1024), (unsigned int)(packed.size() / 1024));
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, packed.size(), &packed[0], GL_STATIC_DRAW);
+	}
+
+	// Same as Upload, but quantizes every submesh against its own bounds into
+	// one interleaved PackedVertex buffer
+	GLenum UploadPacked(const float *positions, const float *texcoords, const float *normals, unsigned int vertexNum,
+		const unsigned int *indices, unsigned int indexNum)
+	{
+		std::vector<PackedVertex> packed(vertexNum);
+		std::map<int, unsigned int> packedAt;
+		PackedVertexError maxError = { 0.0f, 0.0f, 0.0f };
+
+		for (unsigned int i = 0; i < meshs.size(); i++)
+		{
+			const Mesh &mesh = meshs[i];
+
+			// Nothing to pack, and its baseVertex belongs to the next submesh
+			if (mesh.vertexNum == 0)
+				continue;
+
+			std::map<int, unsigned int>::iterator it = packedAt.find(mesh.baseVertex);
+			if (it != packedAt.end())
+			{
+				meshs[i].packedRange = meshs[it->second].packedRange;
+				continue;
+			}
+			packedAt[mesh.baseVertex] = i;
+
+			const float *meshPositions = positions + mesh.baseVertex * 3;
+			const float *meshTexcoords = texcoords + mesh.baseVertex * 2;
+			const float *meshNormals = normals + mesh.baseVertex * 3;
+
+			meshs[i].packedRange = MeshPacking::ComputeRange(meshPositions, meshTexcoords, mesh.vertexNum);
+			MeshPacking::PackVertices(meshPositions, meshNormals, meshTexcoords, mesh.vertexNum,
+				mesh.packedRange, &packed[mesh.baseVertex]);
+
+			PackedVertexError error = MeshPacking::MeasureError(meshPositions, meshNormals, meshTexcoords, mesh.vertexNum,
+				mesh.packedRange, &packed[mesh.baseVertex]);
+			maxError.position = std::max(maxError.position, error.position);
+			maxError.normal = std::max(maxError.normal, error.normal);
+			maxError.texcoord = std::max(maxError.texcoord, error.texcoord);
+		}
+
+		printf("Packed vertices: max error position %g, normal %.3f deg, texcoord %g\n",
+			maxError.position, maxError.normal, maxError.texcoord);
+
+		printf("Packed vertices: %u KB -> %u KB\n",
+			(unsigned int)(vertexNum * sizeof(float) * 8 / 1024),
+			(unsigned int)(vertexNum * sizeof(PackedVertex) / 1024));
+
+		glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[POS_VB]);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(PackedVertex) * vertexNum, &packed[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(POSITION_LOCATION);
+		glVertexAttribPointer(POSITION_LOCATION, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex),
+			(const GLvoid*)PACKED_POSITION_OFFSET);
+		glEnableVertexAttribArray(NORMAL_LOCATION);
+		glVertexAttribPointer(NORMAL_LOCATION, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex),
+			(const GLvoid*)PACKED_NORMAL_OFFSET);
+		glEnableVertexAttribArray(TEX_COORD_LOCATION);
+		glVertexAttribPointer(TEX_COORD_LOCATION, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex),
+			(const GLvoid*)PACKED_TEXCOORD_OFFSET);
+
+		UploadIndices(indices, indexNum);
+
+		return glGetError();
+	}
+
+	// Writes the submesh at mesh.baseVertex / mesh.baseIndex; safe to run
+	// for several submeshes at once
+	void LoadMesh(const aiMesh *mesh, const Mesh &entry,
+		glm::vec3 *positions,
+		glm::vec2 *texcoords,
+		glm::vec3 *normals,
+		unsigned int *indices)
+	{
+		// Faces index the vertices, so there are none either
+		if (mesh->mNumVertices == 0)
+			return;
+
+		positions += entry.baseVertex;
+		texcoords += entry.baseVertex;
+		normals += entry.baseVertex;
+		indices += entry.baseIndex;
+
+		VertexStream::Copy3(&mesh->mVertices[0].x, mesh->mNumVertices, &positions[0].x, sizeof(glm::vec3));
+		VertexStream::Copy3To2(mesh->HasTextureCoords(0) ? &mesh->mTextureCoords[0][0].x : 0, mesh->mNumVertices,
+			&texcoords[0].x, sizeof(glm::vec2));
+		VertexStream::Copy3(&mesh->mNormals[0].x, mesh->mNumVertices, &normals[0].x, sizeof(glm::vec3));
 		
 		for (int i = 0; i < mesh->mNumFaces; i++)
 		{
 			const aiFace &face = mesh->mFaces[i];
 			assert(face.mNumIndices == 3);
-			indices.push_back(face.mIndices[0]);
-			indices.push_back(face.mIndices[1]);
-			indices.push_back(face.mIndices[2]);
+			indices[i * 3 + 0] = face.mIndices[0];
+			indices[i * 3 + 1] = face.mIndices[1];
+			indices[i * 3 + 2] = face.mIndices[2];
 		}
+	}
 
-		return true;
+	// Post-transform cache order for the triangles, then first-use order for the vertices
+	void OptimizeMesh(const MeshCacheEntry &entry,
+		glm::vec3 *positions,
+		glm::vec2 *texcoords,
+		glm::vec3 *normals,
+		unsigned int *indices,
+		VertexCacheStats &before,
+		VertexCacheStats &after)
+	{
+		if (entry.numIndices == 0)
+			return;
+
+		std::vector<unsigned int> remap;
+		MeshOptimizer::Optimize(indices + entry.baseIndex, entry.numIndices, entry.numVertices, remap, &before, &after);
+		MeshOptimizer::RemapVertices(positions + entry.baseVertex, entry.numVertices, remap);
+		MeshOptimizer::RemapVertices(texcoords + entry.baseVertex, entry.numVertices, remap);
+		MeshOptimizer::RemapVertices(normals + entry.baseVertex, entry.numVertices, remap);
 	}
 
-	bool LoadMaterial(const aiScene *scene, const std::string &filepath)
+	// Points every submesh that repeats an earlier one at the earlier one's
+	// vertices and indices and compacts the arrays over the copies. Repeats
+	// are found by GeometryRegistry::Hash of all four streams. Returns the
+	// bytes saved.
+	size_t DeduplicateMeshes(std::vector<MeshCacheEntry> &entries)
+	{
+		std::vector<glm::vec3> &positions = staging->positions;
+		std::vector<glm::vec2> &texcoords = staging->texcoords;
+		std::vector<glm::vec3> &normals = staging->normals;
+		std::vector<unsigned int> &indices = staging->indices;
+
+		std::vector<unsigned long long> hashes(meshs.size());
+
+		ThreadPool::Shared().ParallelFor(meshs.size(), [&](unsigned int i)
+		{
+			const Mesh &mesh = meshs[i];
+			unsigned long long h = GeometryRegistry::Hash(positions.data() + mesh.baseVertex, sizeof(glm::vec3) * mesh.vertexNum);
+			h = GeometryRegistry::Hash(texcoords.data() + mesh.baseVertex, sizeof(glm::vec2) * mesh.vertexNum, h);
+			h = GeometryRegistry::Hash(normals.data() + mesh.baseVertex, sizeof(glm::vec3) * mesh.vertexNum, h);
+			hashes[i] = GeometryRegistry::Hash(indices.data() + mesh.baseIndex, sizeof(unsigned int) * mesh.indexNum, h);
+		});
+
+		std::map<unsigned long long, unsigned int> firstMesh;
+		std::vector<unsigned int> original(meshs.size());
+		unsigned int vertexNum = 0;
+		unsigned int indexNum = 0;
+		size_t saved = 0;
+
+		for (unsigned int i = 0; i < meshs.size(); i++)
+		{
+			Mesh &mesh = meshs[i];
+			std::map<unsigned long long, unsigned int>::iterator it = firstMesh.find(hashes[i]);
+
+			if (it != firstMesh.end() && meshs[it->second].vertexNum == mesh.vertexNum &&
+				meshs[it->second].indexNum == mesh.indexNum)
+			{
+				original[i] = it->second;
+				saved += (sizeof(glm::vec3) * 2 + sizeof(glm::vec2)) * mesh.vertexNum + sizeof(unsigned int) * mesh.indexNum;
+				continue;
+			}
+
+			firstMesh[hashes[i]] = i;
+			original[i] = i;
+
+			// Only ever moves data towards the front
+			if (mesh.baseVertex != vertexNum)
+			{
+				std::copy(positions.begin() + mesh.baseVertex, positions.begin() + mesh.baseVertex + mesh.vertexNum, positions.begin() + vertexNum);
+				std::copy(texcoords.begin() + mesh.baseVertex, texcoords.begin() + mesh.baseVertex + mesh.vertexNum, texcoords.begin() + vertexNum);
+				std::copy(normals.begin() + mesh.baseVertex, normals.begin() + mesh.baseVertex + mesh.vertexNum, normals.begin() + vertexNum);
+			}
+			if (mesh.baseIndex != indexNum)
+			{
+				std::copy(indices.begin() + mesh.baseIndex, indices.begin() + mesh.baseIndex + mesh.indexNum, indices.begin() + indexNum);
+			}
+
+			mesh.baseVertex = vertexNum;
+			mesh.baseIndex = indexNum;
+			vertexNum += mesh.vertexNum;
+			indexNum += mesh.indexNum;
+		}
+
+		if (saved == 0)
+			return 0;
+
+		for (unsigned int i = 0; i < meshs.size(); i++)
+		{
+			meshs[i].baseVertex = meshs[original[i]].baseVertex;
+			meshs[i].baseIndex = meshs[original[i]].baseIndex;
+			entries[i].baseVertex = meshs[i].baseVertex;
+			entries[i].baseIndex = meshs[i].baseIndex;
+		}
+
+		positions.resize(vertexNum);
+		texcoords.resize(vertexNum);
+		normals.resize(vertexNum);
+		indices.resize(indexNum);
+
+		return saved;
+	}
+
+	void GetTexturePaths(const aiScene *scene, const std::string &filepath, std::vector<std::string> &paths)
 	{
-		bool ret = true;
 		std::string dir = GetDirectoryPath(filepath);
+		paths.resize(scene->mNumMaterials);
 		for (int i = 0; i < scene->mNumMaterials; i++)
 		{
 			const aiMaterial *material = scene->mMaterials[i];
-			for (int j = 0; j < material->GetTextureCount(aiTextureType_DIFFUSE); j++)
+			if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
 			{
 				aiString path;
 				if (material->GetTexture(aiTextureType_DIFFUSE, 0, &path,
@@ -344,21 +1191,10 @@ private:
 						p = p.substr(2, p.size() - 2);
 					}
 
-					string FullPath = dir + "/" + p;
-
-					bool result = materials[i].AddTexture(GL_TEXTURE_2D, FullPath.c_str());
-
-					if (!result){
-						printf("Error loading texture '%s'\n", FullPath.c_str());
-						ret = false;
-					}
-					else {
-						printf("Loaded texture '%s'\n", FullPath.c_str());
-					}
+					paths[i] = dir + "/" + p;
 				}
 			}
 		}
-		return ret;
 	}
 };
 
@@ -443,16 +1279,29 @@ GLuint textureObj;
 GLuint gScaleLocation;
 GLuint gWorldLocation;
 GLuint gWVP;
-GLuint gdirLightColorLocation, gdirLightAmbientIntensityLocation;
-GLuint gdirLightDirectionLocation, gdirLightDiffuseIntensityLocation;
-GLuint gSampler;
-GLuint gEyeWorldPosLocation;
-GLuint gMatSpecularIntensityLocation;
-GLuint gSpecularPowerLocation;
-
 DirectionalLight dirLight{ glm::vec3(0, 0, 1), 0.8f };
 MeshGroup meshGroup;
 
+// The same model skinned on the GPU, one program per influence class;
+// 'K' switches between the two
+SkinnedRenderer skinnedRenderer;
+bool gShowSkinned = false;
+glm::mat4 gWorldMatrix, gWVPMatrix;
+
+// Light and material of shader.fs, shared by every program that uses it
+static void SetLightUniforms(GLuint program)
+{
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "gSampler"), 0);
+	glUniform3f(glGetUniformLocation(program, "gDirectionalLight.Color"), 1, 1, 1);
+	glUniform1f(glGetUniformLocation(program, "gDirectionalLight.AmbientIntensity"), 0.55f);
+	glUniform3f(glGetUniformLocation(program, "gDirectionalLight.Direction"), 0, 0, 1);
+	glUniform1f(glGetUniformLocation(program, "gDirectionalLight.DiffuseIntensity"), .8f);
+	glUniform3f(glGetUniformLocation(program, "gEyeWorldPos"), gCameraPos.x, gCameraPos.y, gCameraPos.z);
+	glUniform1f(glGetUniformLocation(program, "gMatSpecularIntensity"), 1.0);
+	glUniform1f(glGetUniformLocation(program, "gSpecularPower"), 8);
+}
+
 int main(int argc, char *argv[])
 {
 	glutInit(&argc, argv);
@@ -505,26 +1354,20 @@ int main(int argc, char *argv[])
 
 	//CalcNormals(Indices, 12, Vertices, 4);
 
-	meshGroup.Load("resource/boblampclean.md5mesh");
+	meshGroup.SetProgram(gShaderProgram);
+	meshGroup.SetPackedVertices(true);
+	meshGroup.SetClusterCulling(true);
+	meshGroup.LoadAsync("resource/boblampclean.md5mesh");
+
+	if (skinnedRenderer.Load("resource/boblampclean.md5mesh", "skinning.vs", "shader.fs"))
+	{
+		for (unsigned int c = 0; c < skinnedRenderer.NumPrograms(); c++)
+			SetLightUniforms(skinnedRenderer.Program(c));
+	}
 	
 	gWVP = glGetUniformLocation(gShaderProgram, "gWVP");
 	gWorldLocation = glGetUniformLocation(gShaderProgram, "gWorld");
-	gSampler = glGetUniformLocation(gShaderProgram, "gSampler");
-	gdirLightColorLocation = glGetUniformLocation(gShaderProgram, "gDirectionalLight.Color");
-	gdirLightAmbientIntensityLocation = glGetUniformLocation(gShaderProgram, "gDirectionalLight.AmbientIntensity");
-	gdirLightDirectionLocation = glGetUniformLocation(gShaderProgram, "gDirectionalLight.Direction");
-	gdirLightDiffuseIntensityLocation = glGetUniformLocation(gShaderProgram, "gDirectionalLight.DiffuseIntensity");
-	gEyeWorldPosLocation = glGetUniformLocation(gShaderProgram, "gEyeWorldPos");
-	gMatSpecularIntensityLocation = glGetUniformLocation(gShaderProgram, "gMatSpecularIntensity");
-	gSpecularPowerLocation = glGetUniformLocation(gShaderProgram, "gSpecularPower");
-	glUniform1i(gSampler, 0);
-	glUniform3f(gdirLightColorLocation, 1, 1, 1);
-	glUniform1f(gdirLightAmbientIntensityLocation, 0.55f);
-	glUniform3f(gdirLightDirectionLocation, 0, 0, 1);
-	glUniform1f(gdirLightDiffuseIntensityLocation, .8f);
-	glUniform3f(gEyeWorldPosLocation, gCameraPos.x, gCameraPos.y, gCameraPos.z);
-	glUniform1f(gMatSpecularIntensityLocation, 1.0);
-	glUniform1f(gSpecularPowerLocation, 8);
+	SetLightUniforms(gShaderProgram);
 	glutMainLoop();
 
 	return 0;
@@ -532,12 +1375,17 @@ int main(int argc, char *argv[])
 
 static void Display()
 {
+	AsyncLoader::Shared().Update(UPLOAD_BUDGET_MICROS);
+
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glEnable(GL_CULL_FACE);
 	glEnable(GL_DEPTH_TEST);
 	glCullFace(GL_BACK);
 	
-	meshGroup.Render();
+	if (gShowSkinned && skinnedRenderer.IsLoaded())
+		skinnedRenderer.Render(glutGet(GLUT_ELAPSED_TIME) * 0.001f, &gWVPMatrix[0][0], &gWorldMatrix[0][0]);
+	else
+		meshGroup.Render();
 	
 	//glBindVertexArray(vao);
 	//glDrawElements(GL_TRIANGLES, 12, GL_UNSIGNED_INT, 0);
@@ -572,6 +1420,14 @@ static void Timer(int t)
 	glm::mat4 world = transform;
 	glm::mat4 wvp = mvp * world;
 
+	// Cluster culling and LOD selection work in model space
+	const glm::vec3 modelEye(glm::inverse(world) * glm::vec4(gCameraPos, 1.0f));
+	meshGroup.SetCullView(wvp, modelEye);
+	meshGroup.SetLodView(modelEye, glm::radians(45.0f), DEFAULT_HEIGHT);
+
+	gWorldMatrix = world;
+	gWVPMatrix = wvp;
+
 	world = glm::transpose(world);
 	wvp = glm::transpose(wvp);
 
@@ -634,6 +1490,9 @@ static void Keyboard(unsigned char key, int x, int y)
 		break;
 	case 'S':case's':
 		break;
+	case 'K':case'k':
+		gShowSkinned = !gShowSkinned;
+		break;
 	default:
 		break;
 	}
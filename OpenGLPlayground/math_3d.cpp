@@ -21,6 +21,7 @@
 
 #include "ogldev_util.h"
 #include "ogldev_math_3d.h"
+#include "GLTransformCompose.h"
 
 Vector3f Vector3f::Cross(const Vector3f& v) const
 {
@@ -145,7 +146,134 @@ void Matrix4f::InitOrthoProjTransform(const PersProjInfo& p)
 }
 
 
+#ifdef OGLDEV_SIMD
+
+// The inverse and determinant below treat the matrix as four 2x2 blocks
+//   | A B |
+//   | C D |
+// each held row by row in one register. X# is the adjugate of X.
+
+#define SHUFFLE_MASK(x, y, z, w) ((x) | ((y) << 2) | ((z) << 4) | ((w) << 6))
+#define SWIZZLE(v, x, y, z, w) _mm_shuffle_ps(v, v, SHUFFLE_MASK(x, y, z, w))
+
+// A * B
+static inline __m128 Mat2Mul(__m128 A, __m128 B)
+{
+    return _mm_add_ps(_mm_mul_ps(A, SWIZZLE(B, 0, 3, 0, 3)),
+                      _mm_mul_ps(SWIZZLE(A, 1, 0, 3, 2), SWIZZLE(B, 2, 1, 2, 1)));
+}
+
+// A# * B
+static inline __m128 Mat2AdjMul(__m128 A, __m128 B)
+{
+    return _mm_sub_ps(_mm_mul_ps(SWIZZLE(A, 3, 3, 0, 0), B),
+                      _mm_mul_ps(SWIZZLE(A, 1, 1, 2, 2), SWIZZLE(B, 2, 3, 0, 1)));
+}
+
+// A * B#
+static inline __m128 Mat2MulAdj(__m128 A, __m128 B)
+{
+    return _mm_sub_ps(_mm_mul_ps(A, SWIZZLE(B, 3, 0, 3, 0)),
+                      _mm_mul_ps(SWIZZLE(A, 1, 0, 3, 2), SWIZZLE(B, 2, 1, 2, 1)));
+}
+
+struct Matrix4fBlocks
+{
+    __m128 A, B, C, D;
+    __m128 DetA, DetB, DetC, DetD;  // each in all four lanes
+    __m128 A_B, D_C;                // A# * B and D# * C
+    __m128 Det;                     // of the whole matrix, in all four lanes
+};
+
+static inline void SplitBlocks(const float m[4][4], Matrix4fBlocks& b)
+{
+    const __m128 R0 = _mm_loadu_ps(m[0]);
+    const __m128 R1 = _mm_loadu_ps(m[1]);
+    const __m128 R2 = _mm_loadu_ps(m[2]);
+    const __m128 R3 = _mm_loadu_ps(m[3]);
+
+    b.A = _mm_movelh_ps(R0, R1);
+    b.B = _mm_movehl_ps(R1, R0);
+    b.C = _mm_movelh_ps(R2, R3);
+    b.D = _mm_movehl_ps(R3, R2);
+
+    // (|A|, |B|, |C|, |D|)
+    const __m128 DetSub = _mm_sub_ps(
+        _mm_mul_ps(_mm_shuffle_ps(R0, R2, SHUFFLE_MASK(0, 2, 0, 2)), _mm_shuffle_ps(R1, R3, SHUFFLE_MASK(1, 3, 1, 3))),
+        _mm_mul_ps(_mm_shuffle_ps(R0, R2, SHUFFLE_MASK(1, 3, 1, 3)), _mm_shuffle_ps(R1, R3, SHUFFLE_MASK(0, 2, 0, 2))));
+
+    b.DetA = SWIZZLE(DetSub, 0, 0, 0, 0);
+    b.DetB = SWIZZLE(DetSub, 1, 1, 1, 1);
+    b.DetC = SWIZZLE(DetSub, 2, 2, 2, 2);
+    b.DetD = SWIZZLE(DetSub, 3, 3, 3, 3);
+
+    b.A_B = Mat2AdjMul(b.A, b.B);
+    b.D_C = Mat2AdjMul(b.D, b.C);
+
+    // |M| = |A||D| + |B||C| - tr((A# * B) * (D# * C))
+    __m128 Trace = _mm_mul_ps(b.A_B, SWIZZLE(b.D_C, 0, 2, 1, 3));
+    Trace = _mm_add_ps(Trace, _mm_movehl_ps(Trace, Trace));
+    Trace = _mm_add_ps(Trace, SWIZZLE(Trace, 1, 1, 1, 1));
+    Trace = SWIZZLE(Trace, 0, 0, 0, 0);
+
+    b.Det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(b.DetA, b.DetD), _mm_mul_ps(b.DetB, b.DetC)), Trace);
+}
+
+#endif
+
+
 float Matrix4f::Determinant() const
+{
+#ifdef OGLDEV_SIMD
+    Matrix4fBlocks Blocks;
+    SplitBlocks(m, Blocks);
+    return _mm_cvtss_f32(Blocks.Det);
+#else
+    return DeterminantScalar();
+#endif
+}
+
+
+Matrix4f& Matrix4f::Inverse()
+{
+#ifdef OGLDEV_SIMD
+    Matrix4fBlocks b;
+    SplitBlocks(m, b);
+
+    if (_mm_cvtss_f32(b.Det) == 0.0f) {
+        // Matrix not invertible, same as InverseScalar
+        assert(0);
+        return *this;
+    }
+
+    // The adjugates of the blocks of the inverse
+    const __m128 X_ = _mm_sub_ps(_mm_mul_ps(b.DetD, b.A), Mat2Mul(b.B, b.D_C));
+    const __m128 W_ = _mm_sub_ps(_mm_mul_ps(b.DetA, b.D), Mat2Mul(b.C, b.A_B));
+    const __m128 Y_ = _mm_sub_ps(_mm_mul_ps(b.DetB, b.C), Mat2MulAdj(b.D, b.A_B));
+    const __m128 Z_ = _mm_sub_ps(_mm_mul_ps(b.DetC, b.B), Mat2MulAdj(b.A, b.D_C));
+
+    // The adjugate signs, divided by |M|
+    const __m128 Scale = _mm_div_ps(_mm_setr_ps(1.0f, -1.0f, -1.0f, 1.0f), b.Det);
+
+    const __m128 X = _mm_mul_ps(X_, Scale);
+    const __m128 Y = _mm_mul_ps(Y_, Scale);
+    const __m128 Z = _mm_mul_ps(Z_, Scale);
+    const __m128 W = _mm_mul_ps(W_, Scale);
+
+    // Taking the adjugates and putting the blocks back into rows in one go
+    _mm_storeu_ps(m[0], _mm_shuffle_ps(X, Y, SHUFFLE_MASK(3, 1, 3, 1)));
+    _mm_storeu_ps(m[1], _mm_shuffle_ps(X, Y, SHUFFLE_MASK(2, 0, 2, 0)));
+    _mm_storeu_ps(m[2], _mm_shuffle_ps(Z, W, SHUFFLE_MASK(3, 1, 3, 1)));
+    _mm_storeu_ps(m[3], _mm_shuffle_ps(Z, W, SHUFFLE_MASK(2, 0, 2, 0)));
+
+    return *this;
+#else
+    return InverseScalar();
+#endif
+}
+
+
+float Matrix4f::DeterminantScalar() const
 {
 	return m[0][0]*m[1][1]*m[2][2]*m[3][3] - m[0][0]*m[1][1]*m[2][3]*m[3][2] + m[0][0]*m[1][2]*m[2][3]*m[3][1] - m[0][0]*m[1][2]*m[2][1]*m[3][3] 
 		+ m[0][0]*m[1][3]*m[2][1]*m[3][2] - m[0][0]*m[1][3]*m[2][2]*m[3][1] - m[0][1]*m[1][2]*m[2][3]*m[3][0] + m[0][1]*m[1][2]*m[2][0]*m[3][3] 
@@ -156,10 +284,10 @@ float Matrix4f::Determinant() const
 }
 
 
-Matrix4f& Matrix4f::Inverse()
+Matrix4f& Matrix4f::InverseScalar()
 {
 	// Compute the reciprocal determinant
-	float det = Determinant();
+	float det = DeterminantScalar();
 	if(det == 0.0f) 
 	{
 		// Matrix not invertible. Setting all elements to nan is not really
@@ -199,6 +327,79 @@ Matrix4f& Matrix4f::Inverse()
 	return *this;
 }
 
+void AffineTransform::InitTransform(const Vector3f& Translation, const Vector3f& Rotation, const Vector3f& Scaling)
+{
+    // InitRotateTransform is Z * Y * X, turning the other way round Y
+    float Quaternion[4];
+    TransformCompose::QuaternionZYX(ToRadian(Rotation.x), ToRadian(-Rotation.y), ToRadian(Rotation.z), Quaternion);
+    TransformCompose::ComposeTRS(&Scaling.x, Quaternion, &Translation.x, &m[0][0]);
+}
+
+void AffineTransform::InitCameraTransform(const Vector3f& Pos, const Vector3f& Target, const Vector3f& Up)
+{
+    Matrix4f CameraRotateTrans;
+    CameraRotateTrans.InitCameraTransform(Target, Up);
+
+    for (unsigned int i = 0 ; i < 3 ; i++) {
+        m[i][0] = CameraRotateTrans.m[i][0];
+        m[i][1] = CameraRotateTrans.m[i][1];
+        m[i][2] = CameraRotateTrans.m[i][2];
+        m[i][3] = -(m[i][0] * Pos.x + m[i][1] * Pos.y + m[i][2] * Pos.z);
+    }
+}
+
+AffineTransform AffineTransform::InverseRigid() const
+{
+    AffineTransform Ret;
+
+    // The rotation's inverse is its transpose, which also takes the
+    // translation back
+    for (unsigned int i = 0 ; i < 3 ; i++) {
+        Ret.m[i][0] = m[0][i];
+        Ret.m[i][1] = m[1][i];
+        Ret.m[i][2] = m[2][i];
+        Ret.m[i][3] = -(m[0][i] * m[0][3] + m[1][i] * m[1][3] + m[2][i] * m[2][3]);
+    }
+
+    return Ret;
+}
+
+bool AffineTransform::Inverse()
+{
+    // Cofactors of the 3x3 part, the first column of them gives the determinant
+    const float c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+    const float c10 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+    const float c20 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+
+    const float det = m[0][0] * c00 + m[0][1] * c10 + m[0][2] * c20;
+
+    if (det == 0.0f) {
+        return false;
+    }
+
+    const float invdet = 1.0f / det;
+
+    AffineTransform res;
+    res.m[0][0] = c00 * invdet;
+    res.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * invdet;
+    res.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * invdet;
+    res.m[1][0] = c10 * invdet;
+    res.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * invdet;
+    res.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * invdet;
+    res.m[2][0] = c20 * invdet;
+    res.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * invdet;
+    res.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * invdet;
+
+    // The translation, taken back through the inverted 3x3 part
+    for (unsigned int i = 0 ; i < 3 ; i++) {
+        res.m[i][3] = -(res.m[i][0] * m[0][3] + res.m[i][1] * m[1][3] + res.m[i][2] * m[2][3]);
+    }
+
+    *this = res;
+
+    return true;
+}
+
 Quaternion::Quaternion(float _x, float _y, float _z, float _w)
 {
     x = _x;
@@ -20,6 +20,9 @@
 
 #include "ogldev_basic_mesh.h"
 #include "ogldev_engine_common.h"
+#include "GLMeshCache.h"
+#include "GLMeshPacking.h"
+#include "GLVertexStream.h"
 
 using namespace std;
 
@@ -27,6 +30,11 @@ using namespace std;
 #define TEX_COORD_LOCATION 1
 #define NORMAL_LOCATION 2
 
+#define ASSIMP_LOAD_FLAGS (aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_FindDegenerates)
+
+// Baked as imported, without reordering or LODs
+static const MeshCacheFormat CacheFormat = { "basic", ASSIMP_LOAD_FLAGS, 0 };
+
 BasicMesh::BasicMesh()
 {
     m_VAO = 0;
@@ -70,15 +78,24 @@ bool BasicMesh::LoadMesh(const string& Filename)
     glGenBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
 
     bool Ret = false;
-    Assimp::Importer Importer;
 
-    const aiScene* pScene = Importer.ReadFile(Filename.c_str(), aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_FindDegenerates);
-    
-    if (pScene) {
-        Ret = InitFromScene(pScene, Filename);
+    // Use the baked cache when it is up to date - no Assimp import needed
+    MeshCache Cache;
+
+    if (Cache.Open(Filename, CacheFormat)) {
+        Ret = InitFromCache(Cache);
     }
     else {
-        printf("Error parsing '%s': '%s'\n", Filename.c_str(), Importer.GetErrorString());
+        Assimp::Importer Importer;
+
+        const aiScene* pScene = Importer.ReadFile(Filename.c_str(), ASSIMP_LOAD_FLAGS);
+    
+        if (pScene) {
+            Ret = InitFromScene(pScene, Filename);
+        }
+        else {
+            printf("Error parsing '%s': '%s'\n", Filename.c_str(), Importer.GetErrorString());
+        }
     }
 
     // Make sure the VAO is not changed from the outside
@@ -96,6 +113,7 @@ bool BasicMesh::InitFromScene(const aiScene* pScene, const string& Filename)
     vector<Vector3f> Normals;
     vector<Vector2f> TexCoords;
     vector<unsigned int> Indices;
+    vector<MeshCacheEntry> CacheEntries(pScene->mNumMeshes);
 
     unsigned int NumVertices = 0;
     unsigned int NumIndices = 0;
@@ -106,6 +124,12 @@ bool BasicMesh::InitFromScene(const aiScene* pScene, const string& Filename)
         m_Entries[i].NumIndices = pScene->mMeshes[i]->mNumFaces * 3;
         m_Entries[i].BaseVertex = NumVertices;
         m_Entries[i].BaseIndex = NumIndices;
+
+        CacheEntries[i].baseVertex    = NumVertices;
+        CacheEntries[i].numVertices   = pScene->mMeshes[i]->mNumVertices;
+        CacheEntries[i].baseIndex     = NumIndices;
+        CacheEntries[i].numIndices    = m_Entries[i].NumIndices;
+        CacheEntries[i].materialIndex = m_Entries[i].MaterialIndex;
         
         NumVertices += pScene->mMeshes[i]->mNumVertices;
         NumIndices  += m_Entries[i].NumIndices;
@@ -123,28 +147,88 @@ bool BasicMesh::InitFromScene(const aiScene* pScene, const string& Filename)
         InitMesh(paiMesh, Positions, Normals, TexCoords, Indices);
     }
 
-    if (!InitMaterials(pScene, Filename)) {
+    vector<string> TexturePaths;
+    GetTexturePaths(pScene, Filename, TexturePaths);
+
+    MeshCacheData Data;
+    Data.positions    = &Positions[0].x;
+    Data.normals      = &Normals[0].x;
+    Data.texcoords    = &TexCoords[0].x;
+    Data.indices      = &Indices[0];
+    Data.numVertices  = NumVertices;
+    Data.numIndices   = NumIndices;
+    Data.entries      = &CacheEntries[0];
+    Data.numEntries   = CacheEntries.size();
+    Data.texturePaths = &TexturePaths;
+    MeshCache::Write(Filename, CacheFormat, Data);
+
+    if (!InitMaterials(TexturePaths)) {
         return false;
     }
 
+    return InitBuffers(Data.positions, Data.normals, Data.texcoords, NumVertices, Data.indices, NumIndices);
+}
+
+bool BasicMesh::InitFromCache(const MeshCache& Cache)
+{
+    m_Entries.resize(Cache.NumEntries());
+    m_Textures.resize(Cache.NumMaterials());
+
+    const MeshCacheEntry* pEntries = Cache.Entries();
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        m_Entries[i].MaterialIndex = pEntries[i].materialIndex;
+        m_Entries[i].NumIndices    = pEntries[i].numIndices;
+        m_Entries[i].BaseVertex    = pEntries[i].baseVertex;
+        m_Entries[i].BaseIndex     = pEntries[i].baseIndex;
+    }
+
+    vector<string> TexturePaths(Cache.NumMaterials());
+
+    for (unsigned int i = 0 ; i < TexturePaths.size() ; i++) {
+        TexturePaths[i] = Cache.TexturePath(i);
+    }
+
+    if (!InitMaterials(TexturePaths)) {
+        return false;
+    }
+
+    // The arrays are read straight out of the mapped file
+    return InitBuffers(Cache.Positions(), Cache.Normals(), Cache.TexCoords(), Cache.NumVertices(),
+                       Cache.Indices(), Cache.NumIndices());
+}
+
+bool BasicMesh::InitBuffers(const float* pPositions, const float* pNormals, const float* pTexCoords, unsigned int NumVertices,
+                            const unsigned int* pIndices, unsigned int NumIndices)
+{
     // Generate and populate the buffers with vertex attributes and the indices
     glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[POS_VB]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Positions[0]) * Positions.size(), &Positions[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * NumVertices, pPositions, GL_STATIC_DRAW);
     glEnableVertexAttribArray(POSITION_LOCATION);
     glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);    
 
     glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[TEXCOORD_VB]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(TexCoords[0]) * TexCoords.size(), &TexCoords[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 2 * NumVertices, pTexCoords, GL_STATIC_DRAW);
     glEnableVertexAttribArray(TEX_COORD_LOCATION);
     glVertexAttribPointer(TEX_COORD_LOCATION, 2, GL_FLOAT, GL_FALSE, 0, 0);
 
     glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[NORMAL_VB]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Normals[0]) * Normals.size(), &Normals[0], GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * 3 * NumVertices, pNormals, GL_STATIC_DRAW);
     glEnableVertexAttribArray(NORMAL_LOCATION);
     glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
+    // Each entry gets 16-bit indices when its vertices allow it
+    vector<unsigned char> PackedIndices;
+    PackedIndices.reserve(sizeof(unsigned int) * NumIndices);
+
+    for (unsigned int i = 0 ; i < m_Entries.size() ; i++) {
+        PackedIndexRange Range = MeshPacking::AppendIndices(PackedIndices, pIndices + m_Entries[i].BaseIndex, m_Entries[i].NumIndices);
+        m_Entries[i].IndexType   = Range.type;
+        m_Entries[i].IndexOffset = Range.offset;
+    }
+
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Indices[0]) * Indices.size(), &Indices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, PackedIndices.size(), &PackedIndices[0], GL_STATIC_DRAW);
 
     return GLCheckError();
 }
@@ -155,19 +239,24 @@ void BasicMesh::InitMesh(const aiMesh* paiMesh,
                     vector<Vector2f>& TexCoords,
                     vector<unsigned int>& Indices)
 {    
-    const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
+    const unsigned int BaseVertex  = Positions.size();
+    const unsigned int NumVertices = paiMesh->mNumVertices;
 
-    // Populate the vertex attribute vectors
-    for (unsigned int i = 0 ; i < paiMesh->mNumVertices ; i++) {
-        const aiVector3D* pPos      = &(paiMesh->mVertices[i]);
-        const aiVector3D* pNormal   = &(paiMesh->mNormals[i]);
-        const aiVector3D* pTexCoord = paiMesh->HasTextureCoords(0) ? &(paiMesh->mTextureCoords[0][i]) : &Zero3D;
+    // Populate the vertex attribute vectors, whole arrays at a time
+    Positions.resize(BaseVertex + NumVertices);
+    Normals.resize(BaseVertex + NumVertices);
+    TexCoords.resize(BaseVertex + NumVertices);
 
-        Positions.push_back(Vector3f(pPos->x, pPos->y, pPos->z));
-        Normals.push_back(Vector3f(pNormal->x, pNormal->y, pNormal->z));
-        TexCoords.push_back(Vector2f(pTexCoord->x, pTexCoord->y));
+    // Faces index the vertices, so there are none either
+    if (NumVertices == 0) {
+        return;
     }
 
+    VertexStream::Copy3(&paiMesh->mVertices[0].x, NumVertices, &Positions[BaseVertex].x, sizeof(Vector3f));
+    VertexStream::Copy3(&paiMesh->mNormals[0].x, NumVertices, &Normals[BaseVertex].x, sizeof(Vector3f));
+    VertexStream::Copy3To2(paiMesh->HasTextureCoords(0) ? &paiMesh->mTextureCoords[0][0].x : NULL, NumVertices,
+                           &TexCoords[BaseVertex].x, sizeof(Vector2f));
+
     // Populate the index buffer
     for (unsigned int i = 0 ; i < paiMesh->mNumFaces ; i++) {
         const aiFace& Face = paiMesh->mFaces[i];
@@ -178,7 +267,7 @@ void BasicMesh::InitMesh(const aiMesh* paiMesh,
     }
 }
 
-bool BasicMesh::InitMaterials(const aiScene* pScene, const string& Filename)
+void BasicMesh::GetTexturePaths(const aiScene* pScene, const string& Filename, vector<string>& TexturePaths)
 {
     // Extract the directory part from the file name
     string::size_type SlashIndex = Filename.find_last_of("/");
@@ -194,14 +283,11 @@ bool BasicMesh::InitMaterials(const aiScene* pScene, const string& Filename)
         Dir = Filename.substr(0, SlashIndex);
     }
 
-    bool Ret = true;
+    TexturePaths.resize(pScene->mNumMaterials);
 
-    // Initialize the materials
     for (unsigned int i = 0 ; i < pScene->mNumMaterials ; i++) {
         const aiMaterial* pMaterial = pScene->mMaterials[i];
 
-        m_Textures[i] = NULL;
-
         if (pMaterial->GetTextureCount(aiTextureType_DIFFUSE) > 0) {
             aiString Path;
 
@@ -212,19 +298,33 @@ bool BasicMesh::InitMaterials(const aiScene* pScene, const string& Filename)
                     p = p.substr(2, p.size() - 2);
                 }
                                
-                string FullPath = Dir + "/" + p;
+                TexturePaths[i] = Dir + "/" + p;
+            }
+        }
+    }
+}
+
+bool BasicMesh::InitMaterials(const vector<string>& TexturePaths)
+{
+    bool Ret = true;
+
+    // Initialize the materials
+    for (unsigned int i = 0 ; i < TexturePaths.size() ; i++) {
+        m_Textures[i] = NULL;
+
+        if (!TexturePaths[i].empty()) {
+            const string& FullPath = TexturePaths[i];
                     
-                m_Textures[i] = new Texture(GL_TEXTURE_2D, FullPath.c_str());
+            m_Textures[i] = new Texture(GL_TEXTURE_2D, FullPath.c_str());
 
-                if (!m_Textures[i]->Load()) {
-                    printf("Error loading texture '%s'\n", FullPath.c_str());
-                    delete m_Textures[i];
-                    m_Textures[i] = NULL;
-                    Ret = false;
-                }
-                else {
-                    printf("Loaded texture '%s'\n", FullPath.c_str());
-                }
+            if (!m_Textures[i]->Load()) {
+                printf("Error loading texture '%s'\n", FullPath.c_str());
+                delete m_Textures[i];
+                m_Textures[i] = NULL;
+                Ret = false;
+            }
+            else {
+                printf("Loaded texture '%s'\n", FullPath.c_str());
             }
         }
     }
@@ -250,8 +350,8 @@ void BasicMesh::Render()
 
         glDrawElementsBaseVertex(GL_TRIANGLES, 
                          m_Entries[i].NumIndices, 
-                         GL_UNSIGNED_INT, 
-                         (void*)(sizeof(unsigned int) * m_Entries[i].BaseIndex), 
+                         m_Entries[i].IndexType, 
+                         (void*)(size_t)m_Entries[i].IndexOffset, 
                          m_Entries[i].BaseVertex);
 		glDisableClientState(GL_TEXTURE_COORD_ARRAY);
     }
@@ -281,8 +381,8 @@ void BasicMesh::Render(unsigned int NumInstances, const Matrix4f* WVPMats, const
 
 		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, 
                                           m_Entries[i].NumIndices, 
-                                          GL_UNSIGNED_INT, 
-                                          (void*)(sizeof(unsigned int) * m_Entries[i].BaseIndex), 
+                                          m_Entries[i].IndexType, 
+                                          (void*)(size_t)m_Entries[i].IndexOffset, 
                                           NumInstances,
                                           m_Entries[i].BaseVertex);
     }
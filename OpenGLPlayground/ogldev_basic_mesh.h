@@ -31,6 +31,8 @@
 #include "ogldev_texture.h"
 #include "ogldev_pipeline.h"
 
+class MeshCache;
+
 struct Vertex
 {
     Vector3f m_pos;
@@ -59,12 +61,16 @@ public:
 			BaseVertex = 0;
 			BaseIndex = 0;
 			MaterialIndex = INVALID_MATERIAL;
+			IndexType = GL_UNSIGNED_INT;
+			IndexOffset = 0;
 		}
 
 		unsigned int NumIndices;
 		unsigned int BaseVertex;
 		unsigned int BaseIndex;
 		unsigned int MaterialIndex;
+		GLenum IndexType;          // GL_UNSIGNED_SHORT when the entry fits in 16 bits
+		unsigned int IndexOffset;  // in bytes, into the index buffer
 	};
 
     BasicMesh();
@@ -81,13 +87,17 @@ public:
 
 private:
     bool InitFromScene(const aiScene* pScene, const std::string& Filename);
+    bool InitFromCache(const MeshCache& Cache);
+    bool InitBuffers(const float* pPositions, const float* pNormals, const float* pTexCoords, unsigned int NumVertices,
+                     const unsigned int* pIndices, unsigned int NumIndices);
     void InitMesh(const aiMesh* paiMesh,
                   std::vector<Vector3f>& Positions,
                   std::vector<Vector3f>& Normals,
                   std::vector<Vector2f>& TexCoords,
                   std::vector<unsigned int>& Indices);
 
-    bool InitMaterials(const aiScene* pScene, const std::string& Filename);
+    void GetTexturePaths(const aiScene* pScene, const std::string& Filename, std::vector<std::string>& TexturePaths);
+    bool InitMaterials(const std::vector<std::string>& TexturePaths);
     void Clear();
 
 
@@ -44,6 +44,23 @@ public:
         m_scale      = Vector3f(1.0f, 1.0f, 1.0f);
         m_worldPos   = Vector3f(0.0f, 0.0f, 0.0f);
         m_rotateInfo = Vector3f(0.0f, 0.0f, 0.0f);
+
+        // SetPerspectiveProj and SetCamera compare against these
+        m_persProjInfo.FOV    = 0.0f;
+        m_persProjInfo.Width  = 0.0f;
+        m_persProjInfo.Height = 0.0f;
+        m_persProjInfo.zNear  = 0.0f;
+        m_persProjInfo.zFar   = 0.0f;
+
+        m_camera.Pos    = Vector3f(0.0f, 0.0f, 0.0f);
+        m_camera.Target = Vector3f(0.0f, 0.0f, 0.0f);
+        m_camera.Up     = Vector3f(0.0f, 0.0f, 0.0f);
+
+        // The stamps of the cached products start at 0, so everything is
+        // built on first use
+        m_WorldVersion  = 1;
+        m_CameraVersion = 1;
+        m_ProjVersion   = 1;
     }
 
     void Scale(float s)
@@ -62,6 +79,7 @@ public:
         m_scale.x = ScaleX;
         m_scale.y = ScaleY;
         m_scale.z = ScaleZ;
+        m_WorldVersion++;
     }
 
     void WorldPos(float x, float y, float z)
@@ -69,11 +87,13 @@ public:
         m_worldPos.x = x;
         m_worldPos.y = y;
         m_worldPos.z = z;
+        m_WorldVersion++;
     }
     
     void WorldPos(const Vector3f& Pos)
     {
         m_worldPos = Pos;
+        m_WorldVersion++;
     }
 
     void Rotate(float RotateX, float RotateY, float RotateZ)
@@ -81,6 +101,7 @@ public:
         m_rotateInfo.x = RotateX;
         m_rotateInfo.y = RotateY;
         m_rotateInfo.z = RotateZ;
+        m_WorldVersion++;
     }
     
     void Rotate(const Vector3f& r)
@@ -88,16 +109,25 @@ public:
         Rotate(r.x, r.y, r.z);
     }
 
+    // The projection and the camera are usually set again every frame with
+    // the same values; that keeps the cached products that depend on them
     void SetPerspectiveProj(const PersProjInfo& p)
     {
-        m_persProjInfo = p;
+        if (p.FOV != m_persProjInfo.FOV || p.Width != m_persProjInfo.Width || p.Height != m_persProjInfo.Height ||
+            p.zNear != m_persProjInfo.zNear || p.zFar != m_persProjInfo.zFar) {
+            m_persProjInfo = p;
+            m_ProjVersion++;
+        }
     }
 
     void SetCamera(const Vector3f& Pos, const Vector3f& Target, const Vector3f& Up)
     {
-        m_camera.Pos = Pos;
-        m_camera.Target = Target;
-        m_camera.Up = Up;
+        if (!SameVector(Pos, m_camera.Pos) || !SameVector(Target, m_camera.Target) || !SameVector(Up, m_camera.Up)) {
+            m_camera.Pos = Pos;
+            m_camera.Target = Target;
+            m_camera.Up = Up;
+            m_CameraVersion++;
+        }
     }
     
     void SetCamera(const Camera& camera)
@@ -110,14 +140,24 @@ public:
         m_scale      = o.m_scale;
         m_worldPos   = o.m_pos;
         m_rotateInfo = o.m_rotation;
+        m_WorldVersion++;
+    }
+
+    const PersProjInfo& GetPerspectiveProj() const
+    {
+        return m_persProjInfo;
     }
 
+    // Each product is cached and only rebuilt when an input it depends on
+    // was set since, so that many objects under one camera cost a world
+    // transform and one multiply with the cached view-projection each
     const Matrix4f& GetWPTrans();
     const Matrix4f& GetWVTrans();
     const Matrix4f& GetVPTrans();
     const Matrix4f& GetWVPTrans();
     const Matrix4f& GetWVOrthoPTrans();
     const Matrix4f& GetWorldTrans();
+    const AffineTransform& GetWorldAffineTrans();
     const Matrix4f& GetViewTrans();
     const Matrix4f& GetProjTrans();
 
@@ -135,12 +175,72 @@ private:
     } m_camera;
 
     Matrix4f m_WVPtransformation;
+    Matrix4f m_WVOrthoPtransformation;
     Matrix4f m_VPtransformation;
     Matrix4f m_WPtransformation;
     Matrix4f m_WVtransformation;
     Matrix4f m_Wtransformation;
     Matrix4f m_Vtransformation;
     Matrix4f m_ProjTransformation;
+    Matrix4f m_OrthoProjTransformation;
+
+    // World and view are affine; the 4x4 versions above are only filled
+    // in for the callers that ask for them
+    AffineTransform m_WorldAffine;
+    AffineTransform m_ViewAffine;
+
+    // Bumped whenever the world (scale, position, rotation), the camera
+    // or the projection is set
+    unsigned int m_WorldVersion;
+    unsigned int m_CameraVersion;
+    unsigned int m_ProjVersion;
+
+    enum PIPELINE_INPUT
+    {
+        WORLD_INPUT  = 1,
+        CAMERA_INPUT = 2,
+        PROJ_INPUT   = 4
+    };
+
+    // The input versions a cached product was built from
+    struct Stamp
+    {
+        unsigned int World;
+        unsigned int Camera;
+        unsigned int Proj;
+
+        Stamp()
+        {
+            World  = 0;
+            Camera = 0;
+            Proj   = 0;
+        }
+    };
+
+    Stamp m_WVPStamp;
+    Stamp m_WVOrthoPStamp;
+    Stamp m_VPStamp;
+    Stamp m_WPStamp;
+    Stamp m_WVStamp;
+    Stamp m_WStamp;
+    Stamp m_VStamp;
+    Stamp m_ProjStamp;
+    Stamp m_OrthoProjStamp;
+    Stamp m_WorldAffineStamp;
+    Stamp m_ViewAffineStamp;
+
+    // Brings the stamp up to the current versions of the inputs in the
+    // PIPELINE_INPUT mask; returns true when the product has to be rebuilt
+    bool Refresh(Stamp& s, unsigned int Inputs);
+
+    static bool SameVector(const Vector3f& a, const Vector3f& b)
+    {
+        return a.x == b.x && a.y == b.y && a.z == b.z;
+    }
+
+    void UpdateWorld();
+    void UpdateView();
+    void UpdateOrthoProj();
 };
 
 
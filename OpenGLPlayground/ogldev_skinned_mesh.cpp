@@ -19,6 +19,12 @@
 
 
 #include "ogldev_skinned_mesh.h"
+#include "GLThreadPool.h"
+#include "GLMeshPacking.h"
+#include "GLTransformCompose.h"
+#include "GLVertexStream.h"
+
+#include <algorithm>
 
 #define POSITION_LOCATION    0
 #define TEX_COORD_LOCATION   1
@@ -28,16 +34,92 @@
 
 void SkinnedMesh::VertexBoneData::AddBoneData(uint BoneID, float Weight)
 {
+    // Keep the strongest influences: once all slots are taken the new
+    // weight replaces the smallest one if it is larger
+    uint Smallest = 0;
+
     for (uint i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(IDs) ; i++) {
         if (Weights[i] == 0.0) {
             IDs[i]     = BoneID;
             Weights[i] = Weight;
             return;
-        }        
+        }
+
+        if (Weights[i] < Weights[Smallest]) {
+            Smallest = i;
+        }
     }
-    
-    // should never get here - more bones than we have space for
-    assert(0);
+
+    if (Weight > Weights[Smallest]) {
+        IDs[Smallest]     = BoneID;
+        Weights[Smallest] = Weight;
+    }
+}
+
+
+void SkinnedMesh::VertexBoneData::Normalize()
+{
+    float Sum = 0.0f;
+
+    for (uint i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(Weights) ; i++) {
+        Sum += Weights[i];
+    }
+
+    if (Sum > 0.0f) {
+        for (uint i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(Weights) ; i++) {
+            Weights[i] /= Sum;
+        }
+    }
+
+    for (uint i = 1 ; i < ARRAY_SIZE_IN_ELEMENTS(Weights) ; i++) {
+        for (uint j = i ; j > 0 && Weights[j] > Weights[j - 1] ; j--) {
+            std::swap(Weights[j], Weights[j - 1]);
+            std::swap(IDs[j], IDs[j - 1]);
+        }
+    }
+}
+
+
+uint SkinnedMesh::VertexBoneData::NumInfluences() const
+{
+    uint Count = 0;
+
+    for (uint i = 0 ; i < ARRAY_SIZE_IN_ELEMENTS(Weights) ; i++) {
+        if (Weights[i] > 0.0f) {
+            Count++;
+        }
+    }
+
+    return Count;
+}
+
+
+// Vertices without influences go with the rigid ones: every skinning.vs
+// variant keeps them in the bind pose
+static uint InfluenceClassOf(uint NumInfluences)
+{
+    return NumInfluences <= 1 ? SkinnedMesh::ONE_INFLUENCE :
+           NumInfluences == 2 ? SkinnedMesh::TWO_INFLUENCES : SkinnedMesh::FOUR_INFLUENCES;
+}
+
+
+uint SkinnedMesh::InfluenceCount(uint InfluenceClass)
+{
+    return InfluenceClass == ONE_INFLUENCE ? 1 : InfluenceClass == TWO_INFLUENCES ? 2 : 4;
+}
+
+
+string SkinnedMesh::SkinningShaderSource(const string& Source, uint InfluenceClass)
+{
+    // #version has to stay the first line
+    string Define = "#define NUM_INFLUENCES " + std::to_string(InfluenceCount(InfluenceClass)) + "\n";
+    string::size_type LineEnd = Source.find('\n');
+
+    if (LineEnd == string::npos) {
+        return Source + "\n" + Define;
+    }
+
+    return Source.substr(0, LineEnd + 1) + Define + Source.substr(LineEnd + 1);
 }
 
 SkinnedMesh::SkinnedMesh()
@@ -45,7 +127,13 @@ SkinnedMesh::SkinnedMesh()
     m_VAO = 0;
     ZERO_MEM(m_Buffers);
     m_NumBones = 0;
-    m_pScene = NULL;
+    m_AnimationSampleRate = 0.0f;
+    m_CompressAnimations = false;
+    m_CurrentAnimation = 0;
+    m_CpuSkinning = false;
+    m_Headless = false;
+    m_CompactBoneWeights = false;
+    m_NumVertices = 0;
 }
 
 
@@ -77,28 +165,42 @@ bool SkinnedMesh::LoadMesh(const string& Filename)
     // Release the previously loaded mesh (if it exists)
     Clear();
  
-    // Create the VAO
-    glGenVertexArrays(1, &m_VAO);   
-    glBindVertexArray(m_VAO);
+    if (!m_Headless) {
+        // Create the VAO
+        glGenVertexArrays(1, &m_VAO);   
+        glBindVertexArray(m_VAO);
     
-    // Create the buffers for the vertices attributes
-    glGenBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+        // Create the buffers for the vertices attributes
+        glGenBuffers(ARRAY_SIZE_IN_ELEMENTS(m_Buffers), m_Buffers);
+    }
 
     bool Ret = false;    
   
-    m_pScene = m_Importer.ReadFile(Filename.c_str(), aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs);
+    long long StartTime = GetCurrentTimeMicros();
+
+    // Everything needed after load is copied out, so the scene goes with the importer
+    Assimp::Importer Importer;
+    const aiScene* pScene = Importer.ReadFile(Filename.c_str(), aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs);
     
-    if (m_pScene) {  
-        m_GlobalInverseTransform = m_pScene->mRootNode->mTransformation;
-        m_GlobalInverseTransform.Inverse();
-        Ret = InitFromScene(m_pScene, Filename);
+    printf("'%s': import %.2f ms\n", Filename.c_str(), (GetCurrentTimeMicros() - StartTime) / 1000.0f);
+
+    if (pScene) {  
+        m_GlobalInverseTransform = pScene->mRootNode->mTransformation;
+
+        if (!m_GlobalInverseTransform.Inverse()) {
+            printf("'%s': the root node's transformation cannot be inverted, using the identity\n", Filename.c_str());
+            m_GlobalInverseTransform.InitIdentity();
+        }
+        Ret = InitFromScene(pScene, Filename);
     }
     else {
-        printf("Error parsing '%s': '%s'\n", Filename.c_str(), m_Importer.GetErrorString());
+        printf("Error parsing '%s': '%s'\n", Filename.c_str(), Importer.GetErrorString());
     }
 
-    // Make sure the VAO is not changed from the outside
-    glBindVertexArray(0);	
+    if (!m_Headless) {
+        // Make sure the VAO is not changed from the outside
+        glBindVertexArray(0);	
+    }
 
     return Ret;
 }
@@ -129,23 +231,91 @@ bool SkinnedMesh::InitFromScene(const aiScene* pScene, const string& Filename)
         NumIndices  += m_Entries[i].NumIndices;
     }
     
-    // Reserve space in the vectors for the vertex attributes and indices
-    Positions.reserve(NumVertices);
-    Normals.reserve(NumVertices);
-    TexCoords.reserve(NumVertices);
+    // Size the vectors up front - every submesh writes its own slice
+    Positions.resize(NumVertices);
+    Normals.resize(NumVertices);
+    TexCoords.resize(NumVertices);
     Bones.resize(NumVertices);
-    Indices.reserve(NumIndices);
-        
-    // Initialize the meshes in the scene one by one
+    Indices.resize(NumIndices);
+
+    // Bone indices are handed out in mesh order, so keep that part serial
+    long long StartTime = GetCurrentTimeMicros();
+
     for (uint i = 0 ; i < m_Entries.size() ; i++) {
-        const aiMesh* paiMesh = pScene->mMeshes[i];
-        InitMesh(i, paiMesh, Positions, Normals, TexCoords, Bones, Indices);
+        MapBones(pScene->mMeshes[i]);
+    }
+
+    long long MapTime = GetCurrentTimeMicros();
+
+    // Convert the meshes in the scene in parallel
+    ThreadPool::Shared().ParallelFor(m_Entries.size(), [&](uint i) {
+        InitMesh(i, pScene->mMeshes[i], Positions, Normals, TexCoords, Bones, Indices);
+    });
+
+    long long ConvertTime = GetCurrentTimeMicros();
+
+    m_NumVertices = NumVertices;
+
+    if (m_CpuSkinning || m_Headless) {
+        m_BindPositions = Positions;
+        m_BindNormals   = Normals;
+        m_BindBones     = Bones;
     }
 
-    if (!InitMaterials(pScene, Filename)) {
+    if (!m_Headless && !InitMaterials(pScene, Filename)) {
         return false;
     }
 
+    long long MaterialTime = GetCurrentTimeMicros();
+
+    m_Clips.resize(pScene->mNumAnimations);
+
+    for (uint i = 0 ; i < m_Clips.size() ; i++) {
+        m_Clips[i].Init(pScene->mAnimations[i], m_AnimationSampleRate);
+
+        if (m_CompressAnimations) {
+            m_Clips[i].Compress(m_AnimationCompression);
+        }
+
+        printf("'%s': animation %d - %d channels, %d keys%s%s, %d KB (%d KB imported)\n", Filename.c_str(), i,
+               m_Clips[i].ChannelNum(), (int)m_Clips[i].KeyNum(), m_Clips[i].IsResampled() ? " (resampled)" : "",
+               m_Clips[i].IsCompressed() ? " (compressed)" : "",
+               (int)(m_Clips[i].MemoryBytes() / 1024), (int)(m_Clips[i].SourceBytes() / 1024));
+    }
+
+    m_Cursors.resize(m_Clips.size());
+
+    for (uint i = 0 ; i < m_Clips.size() ; i++) {
+        m_Clips[i].InitCursor(m_Cursors[i]);
+    }
+
+    // Needs the bone mapping and the clips' channels
+    m_Skeleton.clear();
+    m_NodeChannels.clear();
+    InitSkeleton(pScene->mRootNode, -1);
+    MarkDetailNodes(Bones);
+    m_LocalPoses.resize(m_Skeleton.size());
+    m_GlobalTransforms.resize(m_Skeleton.size());
+
+    uint ClassIndices[NUM_INFLUENCE_CLASSES];
+    ZERO_MEM(ClassIndices);
+
+    for (uint i = 0 ; i < m_Entries.size() ; i++) {
+        for (uint c = 0 ; c < NUM_INFLUENCE_CLASSES ; c++) {
+            ClassIndices[c] += m_Entries[i].ClassIndices[c];
+        }
+    }
+
+    printf("'%s': triangles by influences - 1: %d, 2: %d, 4: %d\n", Filename.c_str(),
+           ClassIndices[ONE_INFLUENCE] / 3, ClassIndices[TWO_INFLUENCES] / 3, ClassIndices[FOUR_INFLUENCES] / 3);
+
+    if (m_Headless) {
+        printf("'%s': %d meshes on %d threads, headless - bones %.2f ms, convert %.2f ms\n",
+               Filename.c_str(), (int)m_Entries.size(), ThreadPool::Shared().NumThreads(),
+               (MapTime - StartTime) / 1000.0f, (ConvertTime - MapTime) / 1000.0f);
+        return true;
+    }
+
     // Generate and populate the buffers with vertex attributes and the indices
   	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[POS_VB]);
     glBufferData(GL_ARRAY_BUFFER, sizeof(Positions[0]) * Positions.size(), &Positions[0], GL_STATIC_DRAW);
@@ -162,15 +332,41 @@ bool SkinnedMesh::InitFromScene(const aiScene* pScene, const string& Filename)
     glEnableVertexAttribArray(NORMAL_LOCATION);
     glVertexAttribPointer(NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
+    // Bone ids as bytes and weights as normalized shorts (or bytes) instead
+    // of 32 bytes of ints and floats per vertex. A scene without vertices
+    // leaves both vectors empty, with no element to take the address of.
+    PackedBoneLayout BoneLayout = MeshPacking::BoneLayout(m_NumBones, m_CompactBoneWeights);
+    vector<unsigned char> PackedBones(BoneLayout.stride * Bones.size());
+    if (!Bones.empty()) {
+        MeshPacking::PackBones(Bones[0].IDs, Bones[0].Weights, sizeof(VertexBoneData), Bones.size(), BoneLayout, &PackedBones[0]);
+    }
+
    	glBindBuffer(GL_ARRAY_BUFFER, m_Buffers[BONE_VB]);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Bones[0]) * Bones.size(), &Bones[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, PackedBones.size(), PackedBones.empty() ? NULL : &PackedBones[0], GL_STATIC_DRAW);
     glEnableVertexAttribArray(BONE_ID_LOCATION);
-    glVertexAttribIPointer(BONE_ID_LOCATION, 4, GL_INT, sizeof(VertexBoneData), (const GLvoid*)0);
+    glVertexAttribIPointer(BONE_ID_LOCATION, 4, BoneLayout.idType, BoneLayout.stride, (const GLvoid*)0);
     glEnableVertexAttribArray(BONE_WEIGHT_LOCATION);    
-    glVertexAttribPointer(BONE_WEIGHT_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(VertexBoneData), (const GLvoid*)16);
+    glVertexAttribPointer(BONE_WEIGHT_LOCATION, 4, BoneLayout.weightType, GL_TRUE, BoneLayout.stride, (const GLvoid*)(size_t)BoneLayout.weightOffset);
     
+    // Each entry gets 16-bit indices when its vertices allow it
+    vector<unsigned char> PackedIndices;
+    PackedIndices.reserve(sizeof(Indices[0]) * Indices.size());
+
+    for (uint i = 0 ; i < m_Entries.size() ; i++) {
+        PackedIndexRange Range = MeshPacking::AppendIndices(PackedIndices, &Indices[m_Entries[i].BaseIndex], m_Entries[i].NumIndices);
+        m_Entries[i].IndexType   = Range.type;
+        m_Entries[i].IndexOffset = Range.offset;
+    }
+
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_Buffers[INDEX_BUFFER]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(Indices[0]) * Indices.size(), &Indices[0], GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, PackedIndices.size(), &PackedIndices[0], GL_STATIC_DRAW);
+
+    long long UploadTime = GetCurrentTimeMicros();
+
+    printf("'%s': %d meshes on %d threads - bones %.2f ms, convert %.2f ms, materials %.2f ms, upload %.2f ms, %d bytes of bone data per vertex\n",
+           Filename.c_str(), (int)m_Entries.size(), ThreadPool::Shared().NumThreads(),
+           (MapTime - StartTime) / 1000.0f, (ConvertTime - MapTime) / 1000.0f,
+           (MaterialTime - ConvertTime) / 1000.0f, (UploadTime - MaterialTime) / 1000.0f, BoneLayout.stride);
 
     return GLCheckError();
 }
@@ -184,57 +380,102 @@ void SkinnedMesh::InitMesh(uint MeshIndex,
                     vector<VertexBoneData>& Bones,
                     vector<uint>& Indices)
 {    
-    const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
-    
-    // Populate the vertex attribute vectors
-    for (uint i = 0 ; i < paiMesh->mNumVertices ; i++) {
-        const aiVector3D* pPos      = &(paiMesh->mVertices[i]);
-        const aiVector3D* pNormal   = &(paiMesh->mNormals[i]);
-        const aiVector3D* pTexCoord = paiMesh->HasTextureCoords(0) ? &(paiMesh->mTextureCoords[0][i]) : &Zero3D;
+    const uint BaseVertex  = m_Entries[MeshIndex].BaseVertex;
+    const uint NumVertices = paiMesh->mNumVertices;
 
-        Positions.push_back(Vector3f(pPos->x, pPos->y, pPos->z));
-        Normals.push_back(Vector3f(pNormal->x, pNormal->y, pNormal->z));
-        TexCoords.push_back(Vector2f(pTexCoord->x, pTexCoord->y));        
+    // No vertices means no faces and no weights either
+    if (NumVertices == 0) {
+        ZERO_MEM(m_Entries[MeshIndex].ClassIndices);
+        return;
     }
     
+    // Populate this mesh's slice of the vertex attribute vectors
+    VertexStream::Copy3(&paiMesh->mVertices[0].x, NumVertices, &Positions[BaseVertex].x, sizeof(Vector3f));
+    VertexStream::Copy3(&paiMesh->mNormals[0].x, NumVertices, &Normals[BaseVertex].x, sizeof(Vector3f));
+    VertexStream::Copy3To2(paiMesh->HasTextureCoords(0) ? &paiMesh->mTextureCoords[0][0].x : NULL, NumVertices,
+                           &TexCoords[BaseVertex].x, sizeof(Vector2f));
+    
     LoadBones(MeshIndex, paiMesh, Bones);
     
-    // Populate the index buffer
+    // A triangle goes with the vertex that has the most influences
+    vector<unsigned char> FaceClass(paiMesh->mNumFaces);
+    uint* pClassIndices = m_Entries[MeshIndex].ClassIndices;
+    ZERO_MEM(m_Entries[MeshIndex].ClassIndices);
+
     for (uint i = 0 ; i < paiMesh->mNumFaces ; i++) {
         const aiFace& Face = paiMesh->mFaces[i];
         assert(Face.mNumIndices == 3);
-        Indices.push_back(Face.mIndices[0]);
-        Indices.push_back(Face.mIndices[1]);
-        Indices.push_back(Face.mIndices[2]);
+
+        uint MaxInfluences = 0;
+
+        for (uint j = 0 ; j < 3 ; j++) {
+            MaxInfluences = std::max(MaxInfluences, Bones[BaseVertex + Face.mIndices[j]].NumInfluences());
+        }
+
+        FaceClass[i] = (unsigned char)InfluenceClassOf(MaxInfluences);
+        pClassIndices[FaceClass[i]] += 3;
+    }
+
+    // Populate this mesh's slice of the index buffer, class by class and
+    // in the original order within a class
+    uint* pIndices = &Indices[m_Entries[MeshIndex].BaseIndex];
+    uint ClassStart[NUM_INFLUENCE_CLASSES];
+    uint Start = 0;
+
+    for (uint c = 0 ; c < NUM_INFLUENCE_CLASSES ; c++) {
+        ClassStart[c] = Start;
+        Start += pClassIndices[c];
+    }
+
+    for (uint i = 0 ; i < paiMesh->mNumFaces ; i++) {
+        const aiFace& Face = paiMesh->mFaces[i];
+        uint* pFace = &pIndices[ClassStart[FaceClass[i]]];
+        ClassStart[FaceClass[i]] += 3;
+
+        pFace[0] = Face.mIndices[0];
+        pFace[1] = Face.mIndices[1];
+        pFace[2] = Face.mIndices[2];
     }
 }
 
 
-void SkinnedMesh::LoadBones(uint MeshIndex, const aiMesh* pMesh, vector<VertexBoneData>& Bones)
+void SkinnedMesh::MapBones(const aiMesh* pMesh)
 {
     for (uint i = 0 ; i < pMesh->mNumBones ; i++) {                
-        uint BoneIndex = 0;        
         string BoneName(pMesh->mBones[i]->mName.data);
         
         if (m_BoneMapping.find(BoneName) == m_BoneMapping.end()) {
             // Allocate an index for a new bone
-            BoneIndex = m_NumBones;
+            uint BoneIndex = m_NumBones;
             m_NumBones++;            
 	        BoneInfo bi;			
 			m_BoneInfo.push_back(bi);
             m_BoneInfo[BoneIndex].BoneOffset = pMesh->mBones[i]->mOffsetMatrix;            
             m_BoneMapping[BoneName] = BoneIndex;
         }
-        else {
-            BoneIndex = m_BoneMapping[BoneName];
-        }                      
+    }    
+}
+
+
+void SkinnedMesh::LoadBones(uint MeshIndex, const aiMesh* pMesh, vector<VertexBoneData>& Bones)
+{
+    // Runs on a worker thread: the bone mapping is only read here and the
+    // weights only touch this mesh's vertices
+    for (uint i = 0 ; i < pMesh->mNumBones ; i++) {                
+        string BoneName(pMesh->mBones[i]->mName.data);
+        uint BoneIndex = m_BoneMapping.find(BoneName)->second;
         
         for (uint j = 0 ; j < pMesh->mBones[i]->mNumWeights ; j++) {
             uint VertexID = m_Entries[MeshIndex].BaseVertex + pMesh->mBones[i]->mWeights[j].mVertexId;
             float Weight  = pMesh->mBones[i]->mWeights[j].mWeight;                   
             Bones[VertexID].AddBoneData(BoneIndex, Weight);
         }
-    }    
+    }
+
+    // Dropped influences leave the rest summing to less than one
+    for (uint i = 0 ; i < pMesh->mNumVertices ; i++) {
+        Bones[m_Entries[MeshIndex].BaseVertex + i].Normalize();
+    }
 }
 
 
@@ -295,6 +536,10 @@ bool SkinnedMesh::InitMaterials(const aiScene* pScene, const string& Filename)
 
 void SkinnedMesh::Render()
 {
+    if (m_Headless) {
+        return;
+    }
+
     glBindVertexArray(m_VAO);
     
     for (uint i = 0 ; i < m_Entries.size() ; i++) {
@@ -308,8 +553,8 @@ void SkinnedMesh::Render()
 
 		glDrawElementsBaseVertex(GL_TRIANGLES, 
                                  m_Entries[i].NumIndices, 
-                                 GL_UNSIGNED_INT, 
-                                 (void*)(sizeof(uint) * m_Entries[i].BaseIndex), 
+                                 m_Entries[i].IndexType, 
+                                 (void*)(size_t)m_Entries[i].IndexOffset, 
                                  m_Entries[i].BaseVertex);
     }
 
@@ -318,186 +563,370 @@ void SkinnedMesh::Render()
 }
 
 
-uint SkinnedMesh::FindPosition(float AnimationTime, const aiNodeAnim* pNodeAnim)
-{    
-    for (uint i = 0 ; i < pNodeAnim->mNumPositionKeys - 1 ; i++) {
-        if (AnimationTime < (float)pNodeAnim->mPositionKeys[i + 1].mTime) {
-            return i;
+void SkinnedMesh::Render(uint InfluenceClass)
+{
+    if (m_Headless || InfluenceClass >= NUM_INFLUENCE_CLASSES) {
+        return;
+    }
+
+    glBindVertexArray(m_VAO);
+
+    for (uint i = 0 ; i < m_Entries.size() ; i++) {
+        const MeshEntry& Entry = m_Entries[i];
+
+        if (Entry.ClassIndices[InfluenceClass] == 0) {
+            continue;
+        }
+
+        // The classes before this one come first in the entry's indices
+        uint Offset = Entry.IndexOffset;
+
+        for (uint c = 0 ; c < InfluenceClass ; c++) {
+            Offset += Entry.ClassIndices[c] * MeshPacking::IndexSize(Entry.IndexType);
         }
+
+        assert(Entry.MaterialIndex < m_Textures.size());
+
+        if (m_Textures[Entry.MaterialIndex]) {
+            m_Textures[Entry.MaterialIndex]->Bind(GL_TEXTURE0);
+        }
+
+        glDrawElementsBaseVertex(GL_TRIANGLES,
+                                 Entry.ClassIndices[InfluenceClass],
+                                 Entry.IndexType,
+                                 (void*)(size_t)Offset,
+                                 Entry.BaseVertex);
     }
-    
-    assert(0);
 
-    return 0;
+    glBindVertexArray(0);
 }
 
 
-uint SkinnedMesh::FindRotation(float AnimationTime, const aiNodeAnim* pNodeAnim)
+void SkinnedMesh::InitSkeleton(const aiNode* pNode, int Parent)
 {
-    assert(pNodeAnim->mNumRotationKeys > 0);
+    string NodeName(pNode->mName.data);
 
-    for (uint i = 0 ; i < pNodeAnim->mNumRotationKeys - 1 ; i++) {
-        if (AnimationTime < (float)pNodeAnim->mRotationKeys[i + 1].mTime) {
-            return i;
-        }
+    SkeletonNode Node;
+    Node.Parent         = Parent;
+    Node.Bone           = INVALID_BONE;
+    Node.Detail         = pNode->mNumChildren == 0;
+    Node.Transformation = AffineTransform(pNode->mTransformation);
+
+    aiVector3D Scaling, Translation;
+    aiQuaternion Rotation;
+    pNode->mTransformation.Decompose(Scaling, Rotation, Translation);
+
+    Node.BindPose.Translation[0] = Translation.x;
+    Node.BindPose.Translation[1] = Translation.y;
+    Node.BindPose.Translation[2] = Translation.z;
+    Node.BindPose.Rotation[0]    = Rotation.x;
+    Node.BindPose.Rotation[1]    = Rotation.y;
+    Node.BindPose.Rotation[2]    = Rotation.z;
+    Node.BindPose.Rotation[3]    = Rotation.w;
+    Node.BindPose.Scaling[0]     = Scaling.x;
+    Node.BindPose.Scaling[1]     = Scaling.y;
+    Node.BindPose.Scaling[2]     = Scaling.z;
+
+    map<string,uint>::const_iterator it = m_BoneMapping.find(NodeName);
+    if (it != m_BoneMapping.end()) {
+        Node.Bone = it->second;
+    }
+
+    int Index = (int)m_Skeleton.size();
+    m_Skeleton.push_back(Node);
+
+    for (uint i = 0 ; i < m_Clips.size() ; i++) {
+        m_NodeChannels.push_back(m_Clips[i].FindChannel(NodeName));
     }
-    
-    assert(0);
 
-    return 0;
+    for (uint i = 0 ; i < pNode->mNumChildren ; i++) {
+        InitSkeleton(pNode->mChildren[i], Index);
+    }
 }
 
 
-uint SkinnedMesh::FindScaling(float AnimationTime, const aiNodeAnim* pNodeAnim)
+void SkinnedMesh::MarkDetailNodes(const vector<VertexBoneData>& Bones)
 {
-    assert(pNodeAnim->mNumScalingKeys > 0);
-    
-    for (uint i = 0 ; i < pNodeAnim->mNumScalingKeys - 1 ; i++) {
-        if (AnimationTime < (float)pNodeAnim->mScalingKeys[i + 1].mTime) {
-            return i;
+    // Vertices each bone moves
+    vector<uint> Influenced(m_NumBones, 0);
+
+    for (uint i = 0 ; i < Bones.size() ; i++) {
+        for (uint j = 0 ; j < NUM_BONES_PER_VEREX ; j++) {
+            if (Bones[i].Weights[j] > 0.0f) {
+                Influenced[Bones[i].IDs[j]]++;
+            }
         }
     }
-    
-    assert(0);
 
-    return 0;
+    const float Threshold = DETAIL_BONE_VERTEX_SHARE * Bones.size();
+    uint NumDetail = 0;
+
+    for (uint i = 0 ; i < m_Skeleton.size() ; i++) {
+        SkeletonNode& Node = m_Skeleton[i];
+
+        if (Node.Detail && Node.Bone != INVALID_BONE) {
+            Node.Detail = Influenced[Node.Bone] < Threshold;
+        }
+
+        if (Node.Detail) {
+            NumDetail++;
+        }
+    }
+
+    printf("Skeleton: %d nodes, %d detail\n", (int)m_Skeleton.size(), NumDetail);
 }
 
 
-void SkinnedMesh::CalcInterpolatedPosition(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim)
+uint SkinnedMesh::FindAnimation(const string& Name) const
 {
-    if (pNodeAnim->mNumPositionKeys == 1) {
-        Out = pNodeAnim->mPositionKeys[0].mValue;
-        return;
+    for (uint i = 0 ; i < m_Clips.size() ; i++) {
+        if (m_Clips[i].Name() == Name) {
+            return i;
+        }
     }
-            
-    uint PositionIndex = FindPosition(AnimationTime, pNodeAnim);
-    uint NextPositionIndex = (PositionIndex + 1);
-    assert(NextPositionIndex < pNodeAnim->mNumPositionKeys);
-    float DeltaTime = (float)(pNodeAnim->mPositionKeys[NextPositionIndex].mTime - pNodeAnim->mPositionKeys[PositionIndex].mTime);
-    float Factor = (AnimationTime - (float)pNodeAnim->mPositionKeys[PositionIndex].mTime) / DeltaTime;
-    assert(Factor >= 0.0f && Factor <= 1.0f);
-    const aiVector3D& Start = pNodeAnim->mPositionKeys[PositionIndex].mValue;
-    const aiVector3D& End = pNodeAnim->mPositionKeys[NextPositionIndex].mValue;
-    aiVector3D Delta = End - Start;
-    Out = Start + Factor * Delta;
+
+    return INVALID_ANIMATION;
 }
 
 
-void SkinnedMesh::CalcInterpolatedRotation(aiQuaternion& Out, float AnimationTime, const aiNodeAnim* pNodeAnim)
+void SkinnedMesh::SampleLocalPose(uint Clip, uint Channel, float AnimationTime, AnimationCursor* pCursor, LocalPose& Pose) const
 {
-	// we need at least two values to interpolate...
-    if (pNodeAnim->mNumRotationKeys == 1) {
-        Out = pNodeAnim->mRotationKeys[0].mValue;
-        return;
+    // Resampled clips find their keys by index and need no cursor
+    if (m_Clips[Clip].IsResampled()) {
+        pCursor = NULL;
     }
-    
-    uint RotationIndex = FindRotation(AnimationTime, pNodeAnim);
-    uint NextRotationIndex = (RotationIndex + 1);
-    assert(NextRotationIndex < pNodeAnim->mNumRotationKeys);
-    float DeltaTime = (float)(pNodeAnim->mRotationKeys[NextRotationIndex].mTime - pNodeAnim->mRotationKeys[RotationIndex].mTime);
-    float Factor = (AnimationTime - (float)pNodeAnim->mRotationKeys[RotationIndex].mTime) / DeltaTime;
-    assert(Factor >= 0.0f && Factor <= 1.0f);
-    const aiQuaternion& StartRotationQ = pNodeAnim->mRotationKeys[RotationIndex].mValue;
-    const aiQuaternion& EndRotationQ   = pNodeAnim->mRotationKeys[NextRotationIndex].mValue;    
-    aiQuaternion::Interpolate(Out, StartRotationQ, EndRotationQ, Factor);
-    Out = Out.Normalize();
+
+    m_Clips[Clip].Sample(Channel, ANIMATION_POSITION, AnimationTime, pCursor, Pose.Translation);
+    m_Clips[Clip].Sample(Channel, ANIMATION_ROTATION, AnimationTime, pCursor, Pose.Rotation);
+    m_Clips[Clip].Sample(Channel, ANIMATION_SCALING, AnimationTime, pCursor, Pose.Scaling);
 }
 
 
-void SkinnedMesh::CalcInterpolatedScaling(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim)
+void SkinnedMesh::EvaluatePose(const AnimationLayer* pLayers, uint NumLayers, AnimationCursor* pCursors, bool LowDetail,
+                               LocalPose* pLocalPoses, AffineTransform* pGlobalTransforms, AffineTransform* pPalette) const
 {
-    if (pNodeAnim->mNumScalingKeys == 1) {
-        Out = pNodeAnim->mScalingKeys[0].mValue;
-        return;
+    // The layers that play a known animation, with their time in ticks
+    uint Clips[MAX_BLEND_ANIMATIONS];
+    float AnimationTimes[MAX_BLEND_ANIMATIONS];
+    float Weights[MAX_BLEND_ANIMATIONS];
+    uint NumActive = 0;
+    float TotalWeight = 0.0f;
+
+    for (uint i = 0 ; i < NumLayers && NumActive < MAX_BLEND_ANIMATIONS ; i++) {
+        if (pLayers[i].Animation >= m_Clips.size() || pLayers[i].Weight <= 0.0f) {
+            continue;
+        }
+
+        const AnimationClip& Clip = m_Clips[pLayers[i].Animation];
+        float TimeInTicks = pLayers[i].TimeInSeconds * Clip.TicksPerSecond();
+
+        Clips[NumActive]          = pLayers[i].Animation;
+        AnimationTimes[NumActive] = Clip.Duration() > 0.0f ? fmod(TimeInTicks, Clip.Duration()) : 0.0f;
+        Weights[NumActive]        = pLayers[i].Weight;
+        TotalWeight += pLayers[i].Weight;
+        NumActive++;
     }
 
-    uint ScalingIndex = FindScaling(AnimationTime, pNodeAnim);
-    uint NextScalingIndex = (ScalingIndex + 1);
-    assert(NextScalingIndex < pNodeAnim->mNumScalingKeys);
-    float DeltaTime = (float)(pNodeAnim->mScalingKeys[NextScalingIndex].mTime - pNodeAnim->mScalingKeys[ScalingIndex].mTime);
-    float Factor = (AnimationTime - (float)pNodeAnim->mScalingKeys[ScalingIndex].mTime) / DeltaTime;
-    assert(Factor >= 0.0f && Factor <= 1.0f);
-    const aiVector3D& Start = pNodeAnim->mScalingKeys[ScalingIndex].mValue;
-    const aiVector3D& End   = pNodeAnim->mScalingKeys[NextScalingIndex].mValue;
-    aiVector3D Delta = End - Start;
-    Out = Start + Factor * Delta;
-}
+    for (uint i = 0 ; i < NumActive ; i++) {
+        Weights[i] /= TotalWeight;
+    }
 
+    // Bones without a node keep a zero matrix
+    for (uint i = 0 ; i < m_NumBones ; i++) {
+        pPalette[i].SetZero();
+    }
 
-void SkinnedMesh::ReadNodeHeirarchy(float AnimationTime, const aiNode* pNode, const Matrix4f& ParentTransform)
-{    
-    string NodeName(pNode->mName.data);
-    
-    const aiAnimation* pAnimation = m_pScene->mAnimations[0];
-        
-    Matrix4f NodeTransformation(pNode->mTransformation);
-     
-    const aiNodeAnim* pNodeAnim = FindNodeAnim(pAnimation, NodeName);
-    
-    if (pNodeAnim) {
-        // Interpolate scaling and generate scaling transformation matrix
-        aiVector3D Scaling;
-        CalcInterpolatedScaling(Scaling, AnimationTime, pNodeAnim);
-        Matrix4f ScalingM;
-        ScalingM.InitScaleTransform(Scaling.x, Scaling.y, Scaling.z);
-        
-        // Interpolate rotation and generate rotation transformation matrix
-        aiQuaternion RotationQ;
-        CalcInterpolatedRotation(RotationQ, AnimationTime, pNodeAnim);        
-        Matrix4f RotationM = Matrix4f(RotationQ.GetMatrix());
-
-        // Interpolate translation and generate translation transformation matrix
-        aiVector3D Translation;
-        CalcInterpolatedPosition(Translation, AnimationTime, pNodeAnim);
-        Matrix4f TranslationM;
-        TranslationM.InitTranslationTransform(Translation.x, Translation.y, Translation.z);
-        
-        // Combine the above transformations
-        NodeTransformation = TranslationM * RotationM * ScalingM;
+    // First every node's local pose, sampled and blended where animated.
+    // Detail nodes of a low detail pose are not sampled at all.
+    for (uint i = 0 ; i < m_Skeleton.size() ; i++) {
+        const SkeletonNode& Node = m_Skeleton[i];
+        LocalPose& Pose = pLocalPoses[i];
+
+        if (!IsAnimated(i, Clips, NumActive, LowDetail)) {
+            Pose = Node.BindPose;
+            continue;
+        }
+
+        const uint* pChannels = &m_NodeChannels[i * m_Clips.size()];
+
+        ZERO_MEM(Pose.Translation);
+        ZERO_MEM(Pose.Rotation);
+        ZERO_MEM(Pose.Scaling);
+
+        for (uint l = 0 ; l < NumActive ; l++) {
+            const uint Channel = pChannels[Clips[l]];
+
+            LocalPose Sample;
+            if (Channel != INVALID_ANIMATION_CHANNEL) {
+                SampleLocalPose(Clips[l], Channel, AnimationTimes[l], pCursors ? &pCursors[Clips[l]] : NULL, Sample);
+            }
+            else {
+                Sample = Node.BindPose;
+            }
+
+            if (NumActive == 1) {
+                Pose = Sample;
+                break;
+            }
+
+            // Keep the rotations in one hemisphere so that they add up
+            float Dot = Pose.Rotation[0] * Sample.Rotation[0] + Pose.Rotation[1] * Sample.Rotation[1] +
+                        Pose.Rotation[2] * Sample.Rotation[2] + Pose.Rotation[3] * Sample.Rotation[3];
+            float RotationWeight = Dot < 0.0f ? -Weights[l] : Weights[l];
+
+            for (uint k = 0 ; k < 3 ; k++) {
+                Pose.Translation[k] += Weights[l] * Sample.Translation[k];
+                Pose.Scaling[k]     += Weights[l] * Sample.Scaling[k];
+            }
+
+            for (uint k = 0 ; k < 4 ; k++) {
+                Pose.Rotation[k] += RotationWeight * Sample.Rotation[k];
+            }
+        }
+
+        if (NumActive > 1) {
+            float Length = sqrtf(Pose.Rotation[0] * Pose.Rotation[0] + Pose.Rotation[1] * Pose.Rotation[1] +
+                                 Pose.Rotation[2] * Pose.Rotation[2] + Pose.Rotation[3] * Pose.Rotation[3]);
+            for (uint k = 0 ; k < 4 ; k++) {
+                Pose.Rotation[k] /= Length;
+            }
+        }
     }
-       
-    Matrix4f GlobalTransformation = ParentTransform * NodeTransformation;
-    
-    if (m_BoneMapping.find(NodeName) != m_BoneMapping.end()) {
-        uint BoneIndex = m_BoneMapping[NodeName];
-        m_BoneInfo[BoneIndex].FinalTransformation = m_GlobalInverseTransform * GlobalTransformation * m_BoneInfo[BoneIndex].BoneOffset;
+
+    // Then all local matrices in one go, straight from the parts
+    TransformCompose::ComposeTRSBatch(pLocalPoses[0].Scaling, pLocalPoses[0].Rotation, pLocalPoses[0].Translation,
+                                      sizeof(LocalPose), (uint)m_Skeleton.size(), &pGlobalTransforms[0].m[0][0]);
+
+    // Parents come first, so every parent's global transform is ready.
+    // Nodes that are not animated keep their exact transformation rather
+    // than the one rebuilt from their bind pose.
+    for (uint i = 0 ; i < m_Skeleton.size() ; i++) {
+        const SkeletonNode& Node = m_Skeleton[i];
+
+        if (!IsAnimated(i, Clips, NumActive, LowDetail)) {
+            pGlobalTransforms[i] = Node.Transformation;
+        }
+
+        if (Node.Parent >= 0) {
+            pGlobalTransforms[i] = pGlobalTransforms[Node.Parent] * pGlobalTransforms[i];
+        }
+
+        if (Node.Bone != INVALID_BONE) {
+            pPalette[Node.Bone] = m_GlobalInverseTransform * pGlobalTransforms[i] * m_BoneInfo[Node.Bone].BoneOffset;
+        }
     }
-    
-    for (uint i = 0 ; i < pNode->mNumChildren ; i++) {
-        ReadNodeHeirarchy(AnimationTime, pNode->mChildren[i], GlobalTransformation);
+}
+
+
+bool SkinnedMesh::IsAnimated(uint Node, const uint* Clips, uint NumActive, bool LowDetail) const
+{
+    if (NumActive == 0 || (LowDetail && m_Skeleton[Node].Detail)) {
+        return false;
+    }
+
+    const uint* pChannels = &m_NodeChannels[Node * m_Clips.size()];
+
+    for (uint l = 0 ; l < NumActive ; l++) {
+        if (pChannels[Clips[l]] != INVALID_ANIMATION_CHANNEL) {
+            return true;
+        }
     }
+
+    return false;
 }
 
 
-void SkinnedMesh::BoneTransform(float TimeInSeconds, vector<Matrix4f>& Transforms)
+void SkinnedMesh::BoneTransform(float TimeInSeconds, vector<AffineTransform>& Transforms)
 {
-    Matrix4f Identity;
-    Identity.InitIdentity();
-    
-    float TicksPerSecond = (float)(m_pScene->mAnimations[0]->mTicksPerSecond != 0 ? m_pScene->mAnimations[0]->mTicksPerSecond : 25.0f);
-    float TimeInTicks = TimeInSeconds * TicksPerSecond;
-    float AnimationTime = fmod(TimeInTicks, (float)m_pScene->mAnimations[0]->mDuration);
+    AnimationLayer Layer;
+    Layer.Animation     = m_CurrentAnimation;
+    Layer.TimeInSeconds = TimeInSeconds;
+    Layer.Weight        = 1.0f;
 
-    ReadNodeHeirarchy(AnimationTime, m_pScene->mRootNode, Identity);
+    BoneTransform(&Layer, 1, Transforms);
+}
 
+
+void SkinnedMesh::BoneTransform(const AnimationLayer* pLayers, uint NumLayers, vector<AffineTransform>& Transforms)
+{
     Transforms.resize(m_NumBones);
 
-    for (uint i = 0 ; i < m_NumBones ; i++) {
-        Transforms[i] = m_BoneInfo[i].FinalTransformation;
+    if (m_Skeleton.empty() || m_NumBones == 0) {
+        return;
     }
+
+    EvaluatePose(pLayers, NumLayers, m_Cursors.empty() ? NULL : &m_Cursors[0], false,
+                 &m_LocalPoses[0], &m_GlobalTransforms[0], &Transforms[0]);
 }
 
 
-const aiNodeAnim* SkinnedMesh::FindNodeAnim(const aiAnimation* pAnimation, const string NodeName)
+void SkinnedMesh::BoneTransforms(const float* Times, const uint* ClipIDs, uint NumInstances, AffineTransform* Palettes,
+                                 const unsigned char* LowDetail) const
 {
-    for (uint i = 0 ; i < pAnimation->mNumChannels ; i++) {
-        const aiNodeAnim* pNodeAnim = pAnimation->mChannels[i];
-        
-        if (string(pNodeAnim->mNodeName.data) == NodeName) {
-            return pNodeAnim;
+    if (m_Skeleton.empty() || m_NumBones == 0) {
+        return;
+    }
+
+    const uint NumBatches = (NumInstances + ANIMATION_BATCH_INSTANCES - 1) / ANIMATION_BATCH_INSTANCES;
+
+    // Every pool thread has its own scratch and cursors, allocated the first
+    // time round only. Cursors cope with the time jumping between instances,
+    // they just restart their search.
+    ThreadPool::Shared().ParallelFor(NumBatches, [&](uint Batch) {
+        static thread_local vector<LocalPose> LocalPoses;
+        static thread_local vector<AffineTransform> GlobalTransforms;
+        static thread_local vector<AnimationCursor> Cursors;
+
+        LocalPoses.resize(m_Skeleton.size());
+        GlobalTransforms.resize(m_Skeleton.size());
+        Cursors.resize(m_Clips.size());
+
+        for (uint i = 0 ; i < m_Clips.size() ; i++) {
+            if (!m_Clips[i].IsResampled()) {
+                m_Clips[i].InitCursor(Cursors[i]);
+            }
         }
+
+        const uint Begin = Batch * ANIMATION_BATCH_INSTANCES;
+        const uint End = min(Begin + ANIMATION_BATCH_INSTANCES, NumInstances);
+
+        for (uint i = Begin ; i < End ; i++) {
+            AnimationLayer Layer;
+            Layer.Animation     = ClipIDs ? ClipIDs[i] : 0;
+            Layer.TimeInSeconds = Times[i];
+            Layer.Weight        = 1.0f;
+
+            EvaluatePose(&Layer, 1, Cursors.empty() ? NULL : &Cursors[0], LowDetail && LowDetail[i],
+                         &LocalPoses[0], &GlobalTransforms[0], Palettes + (size_t)i * m_NumBones);
+        }
+    });
+}
+
+
+SkinningInput SkinnedMesh::GetSkinningInput() const
+{
+    SkinningInput Input;
+    memset(&Input, 0, sizeof(Input));
+
+    if (m_BindPositions.empty()) {
+        return Input;
     }
-    
-    return NULL;
-}
\ No newline at end of file
+
+    Input.positions       = &m_BindPositions[0].x;
+    Input.normals         = &m_BindNormals[0].x;
+    Input.boneIds         = m_BindBones[0].IDs;
+    Input.boneWeights     = m_BindBones[0].Weights;
+    Input.influenceStride = sizeof(VertexBoneData);
+    Input.vertexNum       = m_BindPositions.size();
+
+    return Input;
+}
+
+
+void SkinnedMesh::SkinCpu(const vector<AffineTransform>& Transforms, const SkinnedVertices& Out)
+{
+    assert(!m_BindPositions.empty() && Transforms.size() >= m_NumBones);
+
+    m_SkinningPalette.Set(&Transforms[0].m[0][0], m_NumBones);
+    CpuSkinning::SkinParallel(CpuSkinning::BestKernel(), GetSkinningInput(), m_SkinningPalette, Out);
+}
@@ -30,6 +30,8 @@
 #include "ogldev_util.h"
 #include "ogldev_math_3d.h"
 #include "ogldev_texture.h"
+#include "GLAnimationClip.h"
+#include "GLSkinning.h"
 
 using namespace std;
 
@@ -40,29 +42,139 @@ public:
 
     ~SkinnedMesh();
 
+    // Keys per second that the animation is resampled to at load, or 0 to
+    // keep the source keys. Has to be called before LoadMesh.
+    void SetAnimationSampleRate(float SampleRate)
+    {
+        m_AnimationSampleRate = SampleRate;
+    }
+
+    // Keeps the bind pose in memory after load so that SkinCpu can skin it.
+    // Has to be called before LoadMesh.
+    void SetCpuSkinning(bool Enable)
+    {
+        m_CpuSkinning = Enable;
+    }
+
+    // Loads without touching GL (no buffers, no textures, Render does
+    // nothing), for tools that run without a context. Implies CPU skinning.
+    void SetHeadless(bool Headless)
+    {
+        m_Headless = Headless;
+    }
+
+    // Compresses the animations at load, see AnimationClip::Compress. Has to
+    // be called before LoadMesh.
+    void SetAnimationCompression(const AnimationCompression& Settings)
+    {
+        m_CompressAnimations = true;
+        m_AnimationCompression = Settings;
+    }
+
+    // Uploads the bone weights as bytes instead of shorts, 8 bytes of bone
+    // data per vertex instead of 12. Has to be called before LoadMesh.
+    void SetCompactBoneWeights(bool Enable)
+    {
+        m_CompactBoneWeights = Enable;
+    }
+
     bool LoadMesh(const string& Filename);
 
     void Render();
+
+    // Triangles are grouped by the most bones any of their vertices is
+    // bound to, so that each group can be drawn with a skinning shader that
+    // reads no more bones than it needs
+    enum INFLUENCE_CLASS {
+        ONE_INFLUENCE,
+        TWO_INFLUENCES,
+        FOUR_INFLUENCES,
+        NUM_INFLUENCE_CLASSES
+    };
+
+    // Draws the triangles of one class only. The caller binds the
+    // skinning.vs variant built for it, see SkinningShaderSource.
+    void Render(uint InfluenceClass);
+
+    // Bones per vertex that the class's shader reads: 1, 2 or 4
+    static uint InfluenceCount(uint InfluenceClass);
+
+    // Source (skinning.vs) with NUM_INFLUENCES defined for the class
+    static string SkinningShaderSource(const string& Source, uint InfluenceClass);
 	
     uint NumBones() const
     {
         return m_NumBones;
     }
     
-    void BoneTransform(float TimeInSeconds, vector<Matrix4f>& Transforms);
+    uint NumVertices() const
+    {
+        return m_NumVertices;
+    }
+
+    uint NumAnimations() const
+    {
+        return m_Clips.size();
+    }
+
+#define INVALID_ANIMATION 0xFFFFFFFF
+#define MAX_BLEND_ANIMATIONS 4
+
+    // Index of the animation with this name, or INVALID_ANIMATION
+    uint FindAnimation(const string& Name) const;
+
+    // Animation that BoneTransform(TimeInSeconds, ...) plays, the first one
+    // by default. Anything out of range shows the bind pose.
+    void SetAnimation(uint Index)
+    {
+        m_CurrentAnimation = Index;
+    }
+
+    // Pose of the current animation, one transform per bone. Upload them
+    // as mat4x3 (glUniformMatrix4x3fv with transpose set), or use
+    // ToMatrix4f for a mat4.
+    void BoneTransform(float TimeInSeconds, vector<AffineTransform>& Transforms);
+
+    // One input of a blended pose
+    struct AnimationLayer
+    {
+        uint Animation;
+        float TimeInSeconds;
+        float Weight;
+    };
+
+    // Blends up to MAX_BLEND_ANIMATIONS animations bone by bone before the
+    // hierarchy pass, e.g. weights 1 - t and t to crossfade from one to the
+    // other. Weights are normalized. Runs in storage sized at load, so
+    // nothing is allocated once Transforms holds NumBones() matrices.
+    void BoneTransform(const AnimationLayer* pLayers, uint NumLayers, vector<AffineTransform>& Transforms);
+
+    // Poses of many instances of this mesh at once: instance i plays
+    // animation ClipIDs[i] (the first one when ClipIDs is NULL) at Times[i]
+    // and gets NumBones() matrices starting at Palettes + i * NumBones().
+    // Instances are spread over ThreadPool::Shared(); the mesh is only read,
+    // so this can run alongside other const calls. Instances with a nonzero
+    // LowDetail leave the detail bones (small leaves) in their bind pose.
+    void BoneTransforms(const float* Times, const uint* ClipIDs, uint NumInstances, AffineTransform* Palettes,
+                        const unsigned char* LowDetail = NULL) const;
+
+    // Bind pose for CpuSkinning; empty unless CPU skinning is enabled
+    SkinningInput GetSkinningInput() const;
+
+    // Skins the bind pose with the output of BoneTransform into Out, which
+    // holds NumVertices() floats per array
+    void SkinCpu(const vector<AffineTransform>& Transforms, const SkinnedVertices& Out);
     
 private:
     #define NUM_BONES_PER_VEREX 4
 
     struct BoneInfo
     {
-        Matrix4f BoneOffset;
-        Matrix4f FinalTransformation;        
+        AffineTransform BoneOffset;
 
         BoneInfo()
         {
             BoneOffset.SetZero();
-            FinalTransformation.SetZero();            
         }
     };
     
@@ -82,17 +194,31 @@ private:
             ZERO_MEM(Weights);        
         }
         
+        // Keeps the NUM_BONES_PER_VEREX largest weights
         void AddBoneData(uint BoneID, float Weight);
+
+        // Scales the kept weights to sum to one and sorts them largest
+        // first, so that a vertex with N influences has them in slots 0..N-1
+        void Normalize();
+
+        uint NumInfluences() const;
+    };
+
+    // A node's transformation split into its parts
+    struct LocalPose
+    {
+        float Translation[3];
+        float Rotation[4];          // x, y, z, w
+        float Scaling[3];
     };
 
-    void CalcInterpolatedScaling(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim);
-    void CalcInterpolatedRotation(aiQuaternion& Out, float AnimationTime, const aiNodeAnim* pNodeAnim);
-    void CalcInterpolatedPosition(aiVector3D& Out, float AnimationTime, const aiNodeAnim* pNodeAnim);    
-    uint FindScaling(float AnimationTime, const aiNodeAnim* pNodeAnim);
-    uint FindRotation(float AnimationTime, const aiNodeAnim* pNodeAnim);
-    uint FindPosition(float AnimationTime, const aiNodeAnim* pNodeAnim);
-    const aiNodeAnim* FindNodeAnim(const aiAnimation* pAnimation, const string NodeName);
-    void ReadNodeHeirarchy(float AnimationTime, const aiNode* pNode, const Matrix4f& ParentTransform);
+    void SampleLocalPose(uint Clip, uint Channel, float AnimationTime, AnimationCursor* pCursor, LocalPose& Pose) const;
+    // pLocalPoses and pGlobalTransforms: scratch, one per skeleton node
+    void EvaluatePose(const AnimationLayer* pLayers, uint NumLayers, AnimationCursor* pCursors, bool LowDetail,
+                      LocalPose* pLocalPoses, AffineTransform* pGlobalTransforms, AffineTransform* pPalette) const;
+    bool IsAnimated(uint Node, const uint* Clips, uint NumActive, bool LowDetail) const;
+    void MarkDetailNodes(const vector<VertexBoneData>& Bones);
+    void InitSkeleton(const aiNode* pNode, int Parent);
     bool InitFromScene(const aiScene* pScene, const string& Filename);
     void InitMesh(uint MeshIndex,
                   const aiMesh* paiMesh,
@@ -101,6 +227,7 @@ private:
                   vector<Vector2f>& TexCoords,
                   vector<VertexBoneData>& Bones,
                   vector<unsigned int>& Indices);
+    void MapBones(const aiMesh* paiMesh);
     void LoadBones(uint MeshIndex, const aiMesh* paiMesh, vector<VertexBoneData>& Bones);
     bool InitMaterials(const aiScene* pScene, const string& Filename);
     void Clear();
@@ -126,12 +253,18 @@ enum VB_TYPES {
             BaseVertex    = 0;
             BaseIndex     = 0;
             MaterialIndex = INVALID_MATERIAL;
+            IndexType     = GL_UNSIGNED_INT;
+            IndexOffset   = 0;
+            ZERO_MEM(ClassIndices);
         }
         
         unsigned int NumIndices;
         unsigned int BaseVertex;
         unsigned int BaseIndex;
         unsigned int MaterialIndex;
+        GLenum IndexType;          // GL_UNSIGNED_SHORT when the entry fits in 16 bits
+        unsigned int IndexOffset;  // in bytes, into the index buffer
+        unsigned int ClassIndices[NUM_INFLUENCE_CLASSES];  // indices of each influence class, which follow each other
     };
     
     vector<MeshEntry> m_Entries;
@@ -140,10 +273,46 @@ enum VB_TYPES {
     map<string,uint> m_BoneMapping; // maps a bone name to its index
     uint m_NumBones;
     vector<BoneInfo> m_BoneInfo;
-    Matrix4f m_GlobalInverseTransform;
+    AffineTransform m_GlobalInverseTransform;
+
+    // Runtime copies of the animations, and where BoneTransform is in each
+    vector<AnimationClip> m_Clips;
+    vector<AnimationCursor> m_Cursors;
+    uint m_CurrentAnimation;
+    float m_AnimationSampleRate;
+    bool m_CompressAnimations;
+    AnimationCompression m_AnimationCompression;
     
-    const aiScene* m_pScene;
-    Assimp::Importer m_Importer;
+    #define INVALID_BONE 0xFFFFFFFF
+    #define ANIMATION_BATCH_INSTANCES 16    // instances per ThreadPool item in BoneTransforms
+    #define DETAIL_BONE_VERTEX_SHARE 0.02f  // leaf bones moving fewer vertices than this share are detail
+
+    // The node hierarchy, flattened at load so that the aiScene can be
+    // released. Parents come before their children.
+    struct SkeletonNode
+    {
+        int Parent;                 // -1 for the root
+        uint Bone;                  // INVALID_BONE when no vertex is bound to it
+        AffineTransform Transformation;  // used when not animated
+        LocalPose BindPose;         // the same, blended with clips that animate the node
+        bool Detail;                // leaf that low detail poses leave in its bind pose
+    };
+
+    vector<SkeletonNode> m_Skeleton;
+    vector<uint> m_NodeChannels;            // node * NumAnimations() + clip; INVALID_ANIMATION_CHANNEL when not animated
+    vector<LocalPose> m_LocalPoses;             // per node, reused every frame
+    vector<AffineTransform> m_GlobalTransforms; // per node, reused every frame
+
+    bool m_CpuSkinning;
+    bool m_Headless;
+    bool m_CompactBoneWeights;
+    uint m_NumVertices;
+
+    // Bind pose kept for CPU skinning
+    vector<Vector3f> m_BindPositions;
+    vector<Vector3f> m_BindNormals;
+    vector<VertexBoneData> m_BindBones;
+    SkinningPalette m_SkinningPalette;
 };
 
 
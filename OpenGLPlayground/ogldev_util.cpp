@@ -85,6 +85,28 @@ long long GetCurrentTimeMillis()
 #endif    
 }
 
+
+long long GetCurrentTimeMicros()
+{
+#ifdef WIN32
+    LARGE_INTEGER Frequency, Counter;
+    QueryPerformanceFrequency(&Frequency);
+    QueryPerformanceCounter(&Counter);
+
+    // Split to keep the multiplication from overflowing on long uptimes
+    long long Seconds = Counter.QuadPart / Frequency.QuadPart;
+    long long Rest = Counter.QuadPart % Frequency.QuadPart;
+
+    return Seconds * 1000000 + Rest * 1000000 / Frequency.QuadPart;
+#else
+    timeval t;
+    gettimeofday(&t, NULL);
+
+    long long ret = (long long)t.tv_sec * 1000000 + t.tv_usec;
+    return ret;
+#endif
+}
+
 #ifdef WIN32
 #if _MSC_VER != 1800
 //float fmax(float a, float b)
@@ -65,6 +65,7 @@ void OgldevFileError(const char* pFileName, uint line, const char* pFileError);
 #define GLCheckError() (glGetError() == GL_NO_ERROR)
 
 long long GetCurrentTimeMillis();
+long long GetCurrentTimeMicros();
 
 #endif	/* OGLDEV_UTIL_H */
 
@@ -18,85 +18,137 @@
 
 #include "ogldev_pipeline.h"
 
+bool Pipeline::Refresh(Stamp& s, unsigned int Inputs)
+{
+    Stamp Current;
+    Current.World  = (Inputs & WORLD_INPUT)  ? m_WorldVersion  : 0;
+    Current.Camera = (Inputs & CAMERA_INPUT) ? m_CameraVersion : 0;
+    Current.Proj   = (Inputs & PROJ_INPUT)   ? m_ProjVersion   : 0;
+
+    if (Current.World == s.World && Current.Camera == s.Camera && Current.Proj == s.Proj) {
+        return false;
+    }
+
+    s = Current;
+    return true;
+}
+
 const Matrix4f& Pipeline::GetProjTrans() 
 {
-    m_ProjTransformation.InitPersProjTransform(m_persProjInfo);
+    if (Refresh(m_ProjStamp, PROJ_INPUT)) {
+        m_ProjTransformation.InitPersProjTransform(m_persProjInfo);
+    }
+
     return m_ProjTransformation;
 }
 
 
+void Pipeline::UpdateWorld()
+{
+    if (Refresh(m_WorldAffineStamp, WORLD_INPUT)) {
+        m_WorldAffine.InitTransform(m_worldPos, m_rotateInfo, m_scale);
+    }
+}
+
+void Pipeline::UpdateView()
+{
+    if (Refresh(m_ViewAffineStamp, CAMERA_INPUT)) {
+        m_ViewAffine.InitCameraTransform(m_camera.Pos, m_camera.Target, m_camera.Up);
+    }
+}
+
+void Pipeline::UpdateOrthoProj()
+{
+    if (Refresh(m_OrthoProjStamp, PROJ_INPUT)) {
+        m_OrthoProjTransformation.InitOrthoProjTransform(m_persProjInfo);
+    }
+}
+
 const Matrix4f& Pipeline::GetVPTrans()
 {
-    GetViewTrans();
-    GetProjTrans();
-       
-    m_VPtransformation = m_ProjTransformation * m_Vtransformation;
+    if (Refresh(m_VPStamp, CAMERA_INPUT | PROJ_INPUT)) {
+        UpdateView();
+        GetProjTrans();
+
+        m_VPtransformation = m_ProjTransformation * m_ViewAffine;
+    }
+
     return m_VPtransformation;
 }
 
-const Matrix4f& Pipeline::GetWorldTrans()
+const AffineTransform& Pipeline::GetWorldAffineTrans()
 {
-    Matrix4f ScaleTrans, RotateTrans, TranslationTrans;
+    UpdateWorld();
+    return m_WorldAffine;
+}
 
-    ScaleTrans.InitScaleTransform(m_scale.x, m_scale.y, m_scale.z);
-    RotateTrans.InitRotateTransform(m_rotateInfo.x, m_rotateInfo.y, m_rotateInfo.z);
-    TranslationTrans.InitTranslationTransform(m_worldPos.x, m_worldPos.y, m_worldPos.z);
+const Matrix4f& Pipeline::GetWorldTrans()
+{
+    if (Refresh(m_WStamp, WORLD_INPUT)) {
+        UpdateWorld();
+        m_Wtransformation = m_WorldAffine.ToMatrix4f();
+    }
 
-    m_Wtransformation = TranslationTrans * RotateTrans * ScaleTrans;
     return m_Wtransformation;
 }
 
 const Matrix4f& Pipeline::GetViewTrans()
 {
-    Matrix4f CameraTranslationTrans, CameraRotateTrans;
-
-    CameraTranslationTrans.InitTranslationTransform(-m_camera.Pos.x, -m_camera.Pos.y, -m_camera.Pos.z);
-    CameraRotateTrans.InitCameraTransform(m_camera.Target, m_camera.Up);
-    
-    m_Vtransformation = CameraRotateTrans * CameraTranslationTrans;
+    if (Refresh(m_VStamp, CAMERA_INPUT)) {
+        UpdateView();
+        m_Vtransformation = m_ViewAffine.ToMatrix4f();
+    }
 
     return m_Vtransformation;
 }
 
 const Matrix4f& Pipeline::GetWVPTrans()
 {
-    GetWorldTrans();
-    GetVPTrans();
+    if (Refresh(m_WVPStamp, WORLD_INPUT | CAMERA_INPUT | PROJ_INPUT)) {
+        UpdateWorld();
+        GetVPTrans();
+
+        m_WVPtransformation = m_VPtransformation * m_WorldAffine;
+    }
 
-    m_WVPtransformation = m_VPtransformation * m_Wtransformation;
     return m_WVPtransformation;
 }
 
 const Matrix4f& Pipeline::GetWVOrthoPTrans()
 {
-    GetWorldTrans();
-    GetViewTrans();
+    if (Refresh(m_WVOrthoPStamp, WORLD_INPUT | CAMERA_INPUT | PROJ_INPUT)) {
+        UpdateWorld();
+        UpdateView();
+        UpdateOrthoProj();
 
-    Matrix4f P;
-    P.InitOrthoProjTransform(m_persProjInfo);
-    
-    m_WVPtransformation = P * m_Vtransformation * m_Wtransformation;
-    return m_WVPtransformation;
+        m_WVOrthoPtransformation = m_OrthoProjTransformation * (m_ViewAffine * m_WorldAffine);
+    }
+
+    return m_WVOrthoPtransformation;
 }
 
 
 const Matrix4f& Pipeline::GetWVTrans()
 {
-	GetWorldTrans();
-    GetViewTrans();
-	
-	m_WVtransformation = m_Vtransformation * m_Wtransformation;
-	return m_WVtransformation;
+    if (Refresh(m_WVStamp, WORLD_INPUT | CAMERA_INPUT)) {
+        UpdateWorld();
+        UpdateView();
+
+        m_WVtransformation = (m_ViewAffine * m_WorldAffine).ToMatrix4f();
+    }
+
+    return m_WVtransformation;
 }
 
 
 const Matrix4f& Pipeline::GetWPTrans()
 {
-	Matrix4f PersProjTrans;
+    if (Refresh(m_WPStamp, WORLD_INPUT | PROJ_INPUT)) {
+        UpdateWorld();
+        GetProjTrans();
 
-	GetWorldTrans();
-	PersProjTrans.InitPersProjTransform(m_persProjInfo);
+        m_WPtransformation = m_ProjTransformation * m_WorldAffine;
+    }
 
-	m_WPtransformation = PersProjTrans * m_Wtransformation;
-	return m_WPtransformation;
+    return m_WPtransformation;
 }
\ No newline at end of file
@@ -7,14 +7,41 @@ layout (location = 2) in vec3 Normal;
 uniform mat4 gWVP;                                                                  
 uniform mat4 gWorld;                                                                
                                                                                     
+// Packed vertices (GLMeshPacking.h): position and texcoord are 0..1 within         
+// the mesh bounds, the normal is octahedral encoded in Normal.xy                   
+uniform bool gPackedVertex;                                                         
+uniform vec3 gPositionScale;                                                        
+uniform vec3 gPositionOffset;                                                       
+uniform vec2 gTexCoordScale;                                                        
+uniform vec2 gTexCoordOffset;                                                       
+                                                                                    
 out vec2 TexCoord0;                                                                 
 out vec3 Normal0;                                                                   
 out vec3 WorldPos0;                                                                 
                                                                                     
+vec3 DecodeOctahedral(vec2 e)                                                       
+{                                                                                   
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));                                    
+    if (n.z < 0.0) {                                                                
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }                                                                               
+    return normalize(n);                                                            
+}                                                                                   
+                                                                                    
 void main()                                                                         
 {                                                                                   
-    gl_Position = gWVP * vec4(Position, 1.0);                                       
-    TexCoord0   = TexCoord;                                                         
-    Normal0     = (gWorld * vec4(Normal, 0.0)).xyz;                                 
-    WorldPos0   = (gWorld * vec4(Position, 1.0)).xyz;                               
-}
+    vec3 Pos = Position;                                                            
+    vec2 UV  = TexCoord;                                                            
+    vec3 N   = Normal;                                                              
+                                                                                    
+    if (gPackedVertex) {                                                            
+        Pos = Position * gPositionScale + gPositionOffset;                          
+        UV  = TexCoord * gTexCoordScale + gTexCoordOffset;                          
+        N   = DecodeOctahedral(Normal.xy);                                          
+    }                                                                               
+                                                                                    
+    gl_Position = gWVP * vec4(Pos, 1.0);                                            
+    TexCoord0   = UV;                                                               
+    Normal0     = (gWorld * vec4(N, 0.0)).xyz;                                      
+    WorldPos0   = (gWorld * vec4(Pos, 1.0)).xyz;                                    
+}
\ No newline at end of file
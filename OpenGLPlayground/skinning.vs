@@ -0,0 +1,56 @@
+#version 330                                                                        
+                                                                                    
+layout (location = 0) in vec3 Position;                                             
+layout (location = 1) in vec2 TexCoord;                                             
+layout (location = 2) in vec3 Normal;                                               
+layout (location = 3) in ivec4 BoneIDs;                                             
+layout (location = 4) in vec4 Weights;                                              
+                                                                                    
+// Bones read per vertex: 1, 2 or 4. SkinnedMesh::SkinningShaderSource defines      
+// it for the triangles that SkinnedMesh::Render(InfluenceClass) draws; their       
+// influences are sorted largest first, so the first N are all there is.            
+#ifndef NUM_INFLUENCES                                                              
+#define NUM_INFLUENCES 4                                                            
+#endif                                                                              
+                                                                                    
+const int MAX_BONES = 100;                                                          
+                                                                                    
+uniform mat4 gWVP;                                                                  
+uniform mat4 gWorld;                                                                
+// The bone transforms of SkinnedMesh, 3x4: glUniformMatrix4x3fv with transpose     
+// set, straight from the AffineTransforms                                          
+uniform mat4x3 gBones[MAX_BONES];                                                   
+                                                                                    
+out vec2 TexCoord0;                                                                 
+out vec3 Normal0;                                                                   
+out vec3 WorldPos0;                                                                 
+                                                                                    
+void main()                                                                         
+{                                                                                   
+#if NUM_INFLUENCES == 1                                                             
+    // Rigidly bound, the one weight is 1 (or 0, see below)                         
+    mat4x3 BoneTransform = gBones[BoneIDs[0]];                                      
+#elif NUM_INFLUENCES == 2                                                           
+    mat4x3 BoneTransform = gBones[BoneIDs[0]] * Weights[0];                         
+    BoneTransform       += gBones[BoneIDs[1]] * Weights[1];                         
+#else                                                                               
+    mat4x3 BoneTransform = gBones[BoneIDs[0]] * Weights[0];                         
+    BoneTransform       += gBones[BoneIDs[1]] * Weights[1];                         
+    BoneTransform       += gBones[BoneIDs[2]] * Weights[2];                         
+    BoneTransform       += gBones[BoneIDs[3]] * Weights[3];                         
+#endif                                                                              
+                                                                                    
+    // Weights are sorted largest first, so a vertex bound to no bone at all        
+    // has Weights[0] == 0. It stays in the bind pose in every variant.             
+    if (Weights[0] == 0.0) {                                                        
+        BoneTransform = mat4x3(1.0);                                                
+    }                                                                               
+                                                                                    
+    vec4 PosL    = vec4(BoneTransform * vec4(Position, 1.0), 1.0);                  
+    vec3 NormalL = BoneTransform * vec4(Normal, 0.0);                               
+                                                                                    
+    gl_Position = gWVP * PosL;                                                      
+    TexCoord0   = TexCoord;                                                         
+    Normal0     = (gWorld * vec4(NormalL, 0.0)).xyz;                                
+    WorldPos0   = (gWorld * PosL).xyz;                                              
+}                                                                                   
\ No newline at end of file
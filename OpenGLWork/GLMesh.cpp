@@ -1,5 +1,9 @@
 #include "GLMesh.h"
 #include "FileUtil.h"
+#include "..\OpenGLPlayground\GLMeshOptimizer.h"
+#include "..\OpenGLPlayground\GLVertexStream.h"
+
+#include <glm\gtc\type_ptr.hpp>
 
 GLMesh::GLMesh()
 	: GlutRenderable()
@@ -9,31 +13,108 @@ GLMesh::GLMesh()
 
 GLMesh::~GLMesh()
 {
+	for (unsigned int i = 0; i < entries.size(); i++)
+		GeometryRegistry::Shared().Release(entries[i].geometry);
+	for (unsigned int i = entries.size(); i < staged.size(); i++)
+		GeometryRegistry::Shared().Release(staged[i].geometry.handle);
 }
 
 void GLMesh::Load(std::string filepath)
+{
+	if (Prepare(filepath))
+	{
+		while (!FinishStep())
+			;
+	}
+}
+
+AsyncLoadHandle GLMesh::LoadAsync(std::string filepath)
+{
+	return AsyncLoader::Shared().Load(
+		[this, filepath]() { return Prepare(filepath); },
+		[this]() { return FinishStep(); });
+}
+
+// Import and conversion; no GL calls
+bool GLMesh::Prepare(std::string filepath)
 {
 	const aiScene *scene = importer.ReadFile(filepath,
 		aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_FindDegenerates);
-	bool result = false;
-	if (scene)
+	if (!scene)
 	{
-		LoadScene(scene);
-		LoadMaterial(scene, filepath);
+		std::cerr << "GLMesh import error " << filepath << std::endl;
+		return false;
 	}
-	else
+
+	stagedPath = filepath;
+	LoadScene(scene, filepath);
+	return true;
+}
+
+// One entry's buffers per call, then the materials
+bool GLMesh::FinishStep()
+{
+	if (entries.size() < staged.size())
 	{
-		std::cerr << "GLMesh import error " << filepath << std::endl;
+		StagedEntry &stage = staged[entries.size()];
+
+		GLMeshEntry entry;
+		entry.numVertexes = stage.numVertexes;
+		entry.numIndices = stage.numIndices;
+		entry.materialIndex = stage.materialIndex;
+		entry.geometry = stage.geometry.handle;
+		entry.mirrored = stage.geometry.mirrored;
+
+		// Shared geometry is only uploaded by its first owner
+		if (entry.geometry != INVALID_GEOMETRY)
+		{
+			GeometryBuffers buffers = GeometryRegistry::Shared().Upload(entry.geometry);
+			entry.vbo = buffers.vertexBuffer;
+			entry.ibo = buffers.indexBuffer;
+		}
+
+		if (entry.mirrored)
+			entry.localTransform.ScaleTo(vec3(-1, 1, 1));
+
+		entries.push_back(entry);
+		return false;
 	}
+
+	// Textures are created by GLMaterial itself, so they stay on the GL thread
+	LoadMaterial(importer.GetScene(), stagedPath);
+	importer.FreeScene();
+	staged.clear();
+
+	return true;
 }
 
 void GLMesh::RenderShader()
 {
+	// Mirrored entries draw their shared geometry through localTransform,
+	// applied on top of the WVP the caller left in the current program
+	GLint wvpLocation = -1;
+	glm::mat4 wvp(1.0f);
+
+	for (unsigned int i = 0; i < entries.size(); i++) {
+		if (entries[i].mirrored) {
+			GLint program = 0;
+			glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+			if (program)
+				wvpLocation = glGetUniformLocation(program, "gWVP");
+			if (wvpLocation >= 0)
+				glGetUniformfv(program, wvpLocation, glm::value_ptr(wvp));
+			break;
+		}
+	}
+
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 	glEnableVertexAttribArray(2);
 
 	for (unsigned int i = 0; i < entries.size(); i++) {
+		if (entries[i].numIndices == 0)
+			continue;
+
 		glBindBuffer(GL_ARRAY_BUFFER, entries[i].vbo);
 		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), 0);
 		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)12);
@@ -47,7 +128,21 @@ void GLMesh::RenderShader()
 			materials[entries[i].materialIndex].Bind(GL_TEXTURE_2D);
 		}
 
+		if (entries[i].mirrored) {
+			if (wvpLocation >= 0) {
+				glm::mat4 mirroredWVP = wvp * entries[i].localTransform.GetTransformMatrix();
+				glUniformMatrix4fv(wvpLocation, 1, GL_FALSE, glm::value_ptr(mirroredWVP));
+			}
+			glFrontFace(GL_CW);
+		}
+
 		glDrawElements(GL_TRIANGLES, entries[i].numIndices, GL_UNSIGNED_INT, 0);
+
+		if (entries[i].mirrored) {
+			if (wvpLocation >= 0)
+				glUniformMatrix4fv(wvpLocation, 1, GL_FALSE, glm::value_ptr(wvp));
+			glFrontFace(GL_CCW);
+		}
 	}
 
 	glDisableVertexAttribArray(0);
@@ -63,6 +158,9 @@ void GLMesh::RenderFixedPipeline()
 	glEnableClientState(GL_NORMAL_ARRAY);
 	for (int i = 0; i < entries.size(); i++)
 	{
+		if (entries[i].numIndices == 0)
+			continue;
+
 		glBindBuffer(GL_ARRAY_BUFFER, entries[i].vbo);
 		glVertexPointer(3, GL_FLOAT, sizeof(Vertex), 0);
 		glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), (const GLvoid*)12);
@@ -75,7 +173,11 @@ void GLMesh::RenderFixedPipeline()
 			materials[entries[i].materialIndex].Bind(GL_TEXTURE_2D);
 		}
 		entries[i].localTransform.PushTransformMatrix();
+		if (entries[i].mirrored)
+			glFrontFace(GL_CW);
 		glDrawElements(GL_TRIANGLES, entries[i].numIndices, GL_UNSIGNED_INT, 0);
+		if (entries[i].mirrored)
+			glFrontFace(GL_CCW);
 		entries[i].localTransform.PopTransformMatrix();
 		
 	}
@@ -85,40 +187,40 @@ void GLMesh::RenderFixedPipeline()
 	glPopMatrix();
 }
 
-void GLMesh::LoadScene(const aiScene * scene)
+void GLMesh::LoadScene(const aiScene * scene, std::string filepath)
 {
-	entries.resize(scene->mNumMeshes);
+	staged.resize(scene->mNumMeshes);
 
-	for (int i = 0; i < entries.size(); i++)
+	VertexCacheStats before, after;
+
+	const GeometryLayout layout = { sizeof(Vertex), offsetof(Vertex, pos), offsetof(Vertex, normal) };
+	unsigned int sharedNum = 0;
+	size_t sharedBytes = 0;
+
+	for (int i = 0; i < staged.size(); i++)
 	{
 		std::vector<Vertex> vertexes;
 		std::vector<unsigned int> indicies;
 
 		const aiMesh *mesh = scene->mMeshes[i];
-		const aiVector3D Zero3D(0.0f, 0.0f, 0.0f);
 
-		entries[i].numVertexes = mesh->mNumVertices;
-		entries[i].numIndices = mesh->mNumFaces * 3;
-		entries[i].materialIndex = mesh->mMaterialIndex;
+		staged[i].materialIndex = mesh->mMaterialIndex;
 
-		for (int j = 0; j < mesh->mNumVertices; j++)
+		// Nothing to draw; the entry keeps INVALID_GEOMETRY and no buffers
+		if (mesh->mNumVertices == 0)
 		{
-			const aiVector3D *pos = &mesh->mVertices[j];
-			const aiVector3D* texcoord = mesh->HasTextureCoords(0) ?
-				&(mesh->mTextureCoords[0][j]) : &Zero3D;
-			const aiVector3D *normal = &mesh->mNormals[j];
-			vertexes.push_back(
-				Vertex(glm::vec3(pos->x, pos->y, pos->z),
-					glm::vec2(texcoord->x, texcoord->y),
-					glm::vec3(normal->x, normal->y, normal->z)));
-			bound.minBound.x = std::min(pos->x, bound.minBound.x);
-			bound.minBound.y = std::min(pos->y, bound.minBound.y);
-			bound.minBound.z = std::min(pos->z, bound.minBound.z);
-			bound.maxBound.x = std::max(pos->x, bound.maxBound.x);
-			bound.maxBound.y = std::max(pos->y, bound.maxBound.y);
-			bound.maxBound.z = std::max(pos->z, bound.maxBound.z);
+			staged[i].numVertexes = 0;
+			staged[i].numIndices = 0;
+			continue;
 		}
 
+		vertexes.resize(mesh->mNumVertices);
+		VertexStream::Copy3(&mesh->mVertices[0].x, mesh->mNumVertices, &vertexes[0].pos.x, sizeof(Vertex));
+		VertexStream::Copy3To2(mesh->HasTextureCoords(0) ? &mesh->mTextureCoords[0][0].x : 0, mesh->mNumVertices,
+			&vertexes[0].texcoord.x, sizeof(Vertex));
+		VertexStream::Copy3(&mesh->mNormals[0].x, mesh->mNumVertices, &vertexes[0].normal.x, sizeof(Vertex));
+		VertexStream::Bounds3(&mesh->mVertices[0].x, mesh->mNumVertices, &bound.minBound.x, &bound.maxBound.x);
+
 		for (int j = 0; j < mesh->mNumFaces; j++)
 		{
 			assert(mesh->mFaces[j].mNumIndices == 3);
@@ -128,14 +230,31 @@ void GLMesh::LoadScene(const aiScene * scene)
 			indicies.push_back(face.mIndices[2]);
 		}
 
-		glGenBuffers(1, &entries[i].vbo);
-		glBindBuffer(GL_ARRAY_BUFFER, entries[i].vbo);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertexes.size(), &vertexes[0], GL_STATIC_DRAW);
+		// Reorder for the post-transform cache, then renumber vertices by first use
+		VertexCacheStats meshBefore, meshAfter;
+		std::vector<unsigned int> remap;
+		MeshOptimizer::Optimize(&indicies[0], indicies.size(), vertexes.size(), remap, &meshBefore, &meshAfter);
+		MeshOptimizer::RemapVertices(&vertexes[0], vertexes.size(), remap);
+		before += meshBefore;
+		after += meshAfter;
 
-		glGenBuffers(1, &entries[i].ibo);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, entries[i].ibo);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indicies.size(), &indicies[0], GL_STATIC_DRAW);
+		staged[i].numVertexes = vertexes.size();
+		staged[i].numIndices = indicies.size();
+		staged[i].geometry = GeometryRegistry::Shared().Acquire(layout,
+			&vertexes[0], vertexes.size(), &indicies[0], indicies.size());
+
+		if (!staged[i].geometry.created)
+		{
+			sharedNum++;
+			sharedBytes += sizeof(Vertex) * vertexes.size() + sizeof(unsigned int) * indicies.size();
+		}
 	}
+
+	MeshOptimizer::PrintStats(filepath.c_str(), before, after);
+
+	if (sharedNum > 0)
+		std::cout << "'" << filepath << "': " << sharedNum << " of " << staged.size()
+			<< " entries shared, " << sharedBytes / 1024 << " KB saved" << std::endl;
 }
 
 void GLMesh::LoadMaterial(const aiScene * scene, std::string filepath)
@@ -7,6 +7,8 @@
 #include "GlutRenderable.h"
 #include "GLMaterial.h"
 #include "Transform.h"
+#include "..\OpenGLPlayground\GLAsyncLoader.h"
+#include "..\OpenGLPlayground\GLGeometryRegistry.h"
 
 #include <GL\glew.h>
 #include <GL\freeglut.h>
@@ -40,6 +42,8 @@ public:
 		vec2 texcoord;
 		vec3 normal;
 
+		Vertex() {}
+
 		Vertex(const vec3 _pos, const vec2 _texcoord, const vec3 _normal = vec3(0))
 			: pos(_pos), texcoord(_texcoord), normal(_normal)
 		{
@@ -57,13 +61,17 @@ public:
 		unsigned int numIndices;
 		unsigned int materialIndex;
 		Transform localTransform;
+		GeometryHandle geometry;	// vbo and ibo belong to GeometryRegistry::Shared()
+		bool mirrored;				// drawn through localTransform scaled by (-1, 1, 1)
 		
 		GLMeshEntry() : 
 			vbo(INVALID_ID), 
 			ibo(INVALID_ID),
 			numVertexes(0),
 			numIndices(0),
-			materialIndex(0)
+			materialIndex(0),
+			geometry(INVALID_GEOMETRY),
+			mirrored(false)
 		{}
 		
 		~GLMeshEntry()
@@ -83,6 +91,12 @@ public:
 	const Bound &GetBound() const { return bound; }
 
 	void Load(std::string filepath);
+
+	// Import and conversion run on AsyncLoader::Shared(); its Update
+	// creates the buffers one entry per step, so entries pop in as they
+	// arrive. GetBound is valid once the handle has left LOADING.
+	AsyncLoadHandle LoadAsync(std::string filepath);
+
 	void RenderShader();
 	void RenderFixedPipeline();
 private:
@@ -92,7 +106,20 @@ private:
 	std::vector<GLMaterial> materials;
 	Bound bound;
 
-	void LoadScene(const aiScene *scene);
+	// Converted entries waiting for their buffers, filled off the GL thread
+	struct StagedEntry
+	{
+		GeometryRef geometry;
+		unsigned int numVertexes;
+		unsigned int numIndices;
+		unsigned int materialIndex;
+	};
+	std::vector<StagedEntry> staged;
+	std::string stagedPath;
+
+	bool Prepare(std::string filepath);
+	bool FinishStep();
+	void LoadScene(const aiScene *scene, std::string filepath);
 	void LoadMaterial(const aiScene *scene, std::string filepath);
 };
 
@@ -14,6 +14,7 @@ public:
 	~GLMeshObject();
 	
 	void Load(std::string filepath);
+	AsyncLoadHandle LoadAsync(std::string filepath) { return mesh.LoadAsync(filepath); }
 	void RenderShader();
 	void RenderFixedPipeline();
 	void AddChild(GLMeshObject  *);
@@ -6,10 +6,12 @@
 #include "glm\gtc\quaternion.hpp"
 #include "glm\gtc\type_ptr.hpp"
 
+#include "..\OpenGLPlayground\GLTransformCompose.h"
+
 using namespace glm;
 
 Transform::Transform() :
-	position(0), rotation(0), scale(glm::vec3(1, 1, 1))
+	position(0), rotation(0), scale(glm::vec3(1, 1, 1)), transformMatrix(glm::mat4x3(1.0f))
 {
 
 }
@@ -17,7 +19,7 @@ Transform::Transform() :
 Transform::Transform(const glm::vec3 _position = glm::vec3(0), 
 	const glm::vec3 _rotation = glm::vec3(0), 
 	const glm::vec3 _scale = glm::vec3(1, 1, 1)) :
-	position(_position), rotation(_rotation), scale(_scale), transformMatrix(glm::mat4(1.0f))
+	position(_position), rotation(_rotation), scale(_scale), transformMatrix(glm::mat4x3(1.0f))
 {
 
 }
@@ -28,19 +30,27 @@ Transform::~Transform()
 
 glm::mat4 Transform::GetTransformMatrix()
 {
-	return transformMatrix;
+	return glm::mat4(transformMatrix);
 }
 
 glm::mat4 Transform::GetInverseTransformMatrix()
 {
-	return glm::inverse(transformMatrix);
+	// Invert the 3x3 part only and take the translation back through it
+	glm::mat3 inverseLinear = glm::inverse(glm::mat3(transformMatrix));
+	glm::vec3 inverseTranslation = -(inverseLinear * transformMatrix[3]);
+
+	glm::mat4 inverseMatrix(inverseLinear);
+	inverseMatrix[3] = glm::vec4(inverseTranslation, 1.0f);
+	return inverseMatrix;
 }
 
 void Transform::PushTransformMatrix()
 {
+	glm::mat4 matrix(transformMatrix);
+
 	glPushMatrix();
 	glMatrixMode(GL_MODELVIEW);
-	glMultMatrixf(glm::value_ptr(transformMatrix));
+	glMultMatrixf(glm::value_ptr(matrix));
 }
 
 void Transform::PopTransformMatrix()
@@ -100,20 +110,9 @@ const glm::vec3 Transform::Orientation()
 
 void Transform::updateTransformMatrix()
 {
-	// Translation matrix
-	glm::mat4 translateMatrix = glm::translate(mat4(1.0f), position);
-
-	// Rotation matrix
-	glm::quat qPitch = glm::angleAxis(radians(rotation.x), glm::vec3(1, 0, 0));
-	glm::quat qYaw = glm::angleAxis(radians(rotation.y), glm::vec3(0, 1, 0));
-	glm::quat qRoll = glm::angleAxis(radians(rotation.z), glm::vec3(0, 0, 1));
-
-	glm::quat orientation = qPitch * qYaw * qRoll;
-	orientation = glm::normalize(orientation);
-	glm::mat4 rotateMatrix = glm::mat4_cast(orientation);
-
-	// Scale matrix
-	glm::mat4 scaleMatrix = glm::scale(mat4(1.0f), scale);
-
-	transformMatrix = translateMatrix * rotateMatrix * scaleMatrix;
+	// pitch * yaw * roll as one quaternion, then translate * rotate * scale
+	// written straight into the 4x3 columns
+	float orientation[4];
+	TransformCompose::QuaternionXYZ(radians(rotation.x), radians(rotation.y), radians(rotation.z), orientation);
+	TransformCompose::ComposeTRSColumns(glm::value_ptr(scale), orientation, glm::value_ptr(position), glm::value_ptr(transformMatrix));
 }
@@ -30,7 +30,7 @@ private:
 	glm::vec3 position;
 	glm::vec3 rotation; // Euler angle
 	glm::vec3 scale;
-	glm::mat4 transformMatrix; // Update when Translate, Rotate, Scale
+	glm::mat4x3 transformMatrix; // Update when Translate, Rotate, Scale; affine, the last row is implied
 
 	void updateTransformMatrix();
 };
@@ -13,6 +13,7 @@
 
 #define DEFAULT_WIDTH 640
 #define DEFAULT_HEIGHT 480
+#define UPLOAD_BUDGET_MICROS 4000
 
 static inline void ExceptionHandler(GlutWrapper::GlutWrapperException &e)
 {
@@ -66,86 +67,88 @@ GLMeshObject
 
 static GLKeyFrameAnimation anim;
 
+static std::vector<AsyncLoadHandle> modelLoads;
+static bool modelAssembled = false;
+
+static GLMeshObject *LoadPart(const char *filepath)
+{
+	GLMeshObject *part = new GLMeshObject;
+	modelLoads.push_back(part->LoadAsync(filepath));
+	return part;
+}
+
+// Starts every part at once; AssembleModel runs when their bounds are known
 static void LoadModel()
 {
-	body = new GLMeshObject;
-	body->Load("Body.obj");
+	body = LoadPart("Body.obj");
+	head = LoadPart("Head.obj");
+	helmet = LoadPart("Helmet.obj");
+	rightArm = LoadPart("Right_Arm.obj");
+	rightHand = LoadPart("Right_Hand.obj");
+	leftArm = LoadPart("left_Arm.obj");
+	leftHand = LoadPart("left_Hand.obj");
+	lowerBody = LoadPart("LowerBody.obj");
+	rightLeg = LoadPart("Right_UpperLeg.obj");
+	rightFoot = LoadPart("Right_Foot.obj");
+	leftLeg = LoadPart("Left_UpperLeg.obj");
+	leftFoot = LoadPart("Left_Foot.obj");
+	sword = LoadPart("resource/Robot Warrior/Sword.obj");
+}
 
-	head = new GLMeshObject;
-	head->Load("Head.obj");
+// Lays out the parts from their bounds; their buffers keep popping in
+static void AssembleModel()
+{
 	head->GetTransform().Translate(glm::vec3(
 		0, body->Mesh().GetBound().Height() * 0.2, body->Mesh().GetBound().Length() * 0.2));
 	body->AddChild(head);
 
-	helmet = new GLMeshObject;
-	helmet->Load("Helmet.obj");
 	helmet->GetTransform().Translate(glm::vec3(0, head->Mesh().GetBound().Height() - .05, 0.05));
 	head->AddChild(helmet);
 
-	rightArm = new GLMeshObject;
-	rightArm->Load("Right_Arm.obj");
 	rightArm->GetTransform().Translate(glm::vec3(-body->Mesh().GetBound().Width() / 2 + 0.2,
 		0.25, 0));
 	body->AddChild(rightArm);
-	rightHand = new GLMeshObject;
-	rightHand->Load("Right_Hand.obj");
 	rightHand->GetTransform().Translate(glm::vec3(
 		-rightArm->Mesh().GetBound().Width() + 0.3,
 		-0.08, -0.05));
 	rightArm->AddChild(rightHand);
 
-	leftArm = new GLMeshObject;
-	leftArm->Load("left_Arm.obj");
 	leftArm->GetTransform().Translate(glm::vec3(
 		body->Mesh().GetBound().Width() / 2 - 0.2,
 		0.25, 0));
 	body->AddChild(leftArm);
-	leftHand = new GLMeshObject;
-	leftHand->Load("left_Hand.obj");
 	leftHand->GetTransform().Translate(glm::vec3(
 		leftArm->Mesh().GetBound().Width() - 0.3,
 		-0.08, -0.05));
 	leftArm->AddChild(leftHand);
 
-	lowerBody = new GLMeshObject;
-	lowerBody->Load("LowerBody.obj");
 	lowerBody->GetTransform().Translate(
 		vec3(0,
 			-body->Mesh().GetBound().Height() / 2 - 0.25,
 			0));
 	body->AddChild(lowerBody);
-	rightLeg = new GLMeshObject;
-	rightLeg->Load("Right_UpperLeg.obj");
 	rightLeg->GetTransform().Translate(vec3(
 		-lowerBody->Mesh().GetBound().Width() / 3,
 		-lowerBody->Mesh().GetBound().Height() * 0.1,
 		0));
 	lowerBody->AddChild(rightLeg);
-	rightFoot = new GLMeshObject;
-	rightFoot->Load("Right_Foot.obj");
 	rightFoot->GetTransform().Translate(vec3(
 		-rightLeg->Mesh().GetBound().Width() / 2,
 		-rightLeg->Mesh().GetBound().Height() / 2 - 0.08,
 		rightLeg->Mesh().GetBound().Length() / 2));
 	rightLeg->AddChild(rightFoot);
 
-	leftLeg = new GLMeshObject;
-	leftLeg->Load("Left_UpperLeg.obj");
 	leftLeg->GetTransform().Translate(vec3(
 		lowerBody->Mesh().GetBound().Width() / 3,
 		-lowerBody->Mesh().GetBound().Height() * 0.1,
 		0));
 	lowerBody->AddChild(leftLeg);
-	leftFoot = new GLMeshObject;
-	leftFoot->Load("Left_Foot.obj");
 	leftFoot->GetTransform().Translate(vec3(
 		leftLeg->Mesh().GetBound().Width() / 2,
 		-leftLeg->Mesh().GetBound().Height() / 2 - 0.08,
 		leftLeg->Mesh().GetBound().Length() / 2));
 	leftLeg->AddChild(leftFoot);
 
-	sword = new GLMeshObject;
-	sword->Load("resource/Robot Warrior/Sword.obj");
 	sword->GetTransform().Translate(vec3(-1.0, 0, -0.8));
 	sword->GetTransform().Rotate(vec3(90, 0, 0));
 	sword->GetTransform().Scale(vec3(1, 1, 1.2));
@@ -344,6 +347,34 @@ static void headAnim()
 	anim.AddKeyFrame(head, 9);
 }
 
+static void UpdateModelLoads()
+{
+	AsyncLoader::Shared().Update(UPLOAD_BUDGET_MICROS);
+
+	if (modelAssembled)
+		return;
+
+	for (int i = 0; i < modelLoads.size(); i++)
+		if (modelLoads[i]->GetStatus() == AsyncLoad::LOADING)
+			return;
+
+	AssembleModel();
+	rightArmAnim();
+	rightHandAnim();
+	leftArmAnim();
+	leftHandAnim();
+	rightLegAnim();
+	rightFootAnim();
+	leftLegAnim();
+	leftFootAnim();
+	lowerBodyAnim();
+	bodyAnim();
+	headAnim();
+	modelAssembled = true;
+
+	GeometryRegistry::Shared().PrintStats();
+}
+
 int main(int argc, char *argv[])
 {
 	try {
@@ -356,17 +387,6 @@ int main(int argc, char *argv[])
 		GlutWrapper::SetMouseWheelFunction(MouseWheel);
 		
 		LoadModel();
-		rightArmAnim();
-		rightHandAnim();
-		leftArmAnim();
-		leftHandAnim();
-		rightLegAnim();
-		rightFootAnim();
-		leftLegAnim();
-		leftFootAnim();
-		lowerBodyAnim();
-		bodyAnim();
-		headAnim();
 
 		camera.GetTransform().Translate(glm::vec3(0, 0, 6));
 
@@ -384,6 +404,8 @@ int main(int argc, char *argv[])
 
 static void Display()
 {
+	UpdateModelLoads();
+
 	glShadeModel(GL_SMOOTH);
 	glColorMaterial(GL_FRONT, GL_AMBIENT_AND_DIFFUSE);
 	glCullFace(GL_FRONT);